@@ -2,22 +2,41 @@
 #include <common/args_parser.hpp>
 
 #include <common/a_device_manager.hpp>
+#include <common/generic_device_dispatcher.hpp>
+#include <common/metrics_exporter.hpp>
 
 void run_example(const args_t & args ) {
    print_args(args);
 
+   // It has to be done before the creation of the first device.
+   pooled_allocation_enabled().store(args.pooled_alloc_);
+
+   // An error of listening is reported before the start of SObjectizer.
+   const auto exporter = make_metrics_exporter(args);
+
    so_5::launch([&](so_5::environment_t & env) {
          env.introduce_coop([&](so_5::coop_t & coop) {
+            a_dashboard_t::stats_collector_shptr_t stats_collector;
+            if(args.thread_local_stats_)
+               stats_collector = std::make_shared<
+                     a_dashboard_t::stats_collector_t>();
+
             const auto dashboard_mbox =
-                  coop.make_agent<a_dashboard_t>()->so_direct_mbox();
+                  coop.make_agent<a_dashboard_t>(
+                        stats_collector, make_dashboard_params(args, exporter))
+                        ->so_direct_mbox();
 
-            // Run the device manager on a separate adv_thread_pool-dispatcher.
+            // Run the device manager on a separate adv_thread_pool-dispatcher
+            // (or on the generic dispatcher for comparison).
             namespace disp = so_5::disp::adv_thread_pool;
             coop.make_agent_with_binder<a_device_manager_t>(
-                  disp::make_dispatcher(env, args.thread_pool_size_).
-                        binder(disp::bind_params_t{}),
+                  args.generic_dispatcher_ ?
+                        make_generic_device_dispatcher(env, args) :
+                        disp::make_dispatcher(env, args.thread_pool_size_).
+                              binder(disp::bind_params_t{}),
                   args,
-                  dashboard_mbox);
+                  dashboard_mbox,
+                  std::move(stats_collector));
          });
       });
 }
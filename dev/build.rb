@@ -21,4 +21,7 @@ MxxRu::Cpp::composite_target( MxxRu::BUILD_ROOT ) {
 
   required_prj 'adv_thread_pool_case/prj.rb'
   required_prj 'tricky_disp_case/prj.rb'
+  required_prj 'queue_bench/prj.rb'
+  required_prj 'disp_bench/prj.rb'
+  required_prj 'shutdown_test/prj.rb'
 }
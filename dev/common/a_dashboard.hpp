@@ -1,10 +1,23 @@
 #pragma once
 
+#include <common/args.hpp>
+#include <common/log_linear_histogram.hpp>
+#include <common/metrics_exporter.hpp>
+#include <common/stats_sink.hpp>
+
 #include <so_5/all.hpp>
 
 #include <fmt/ostream.h>
 
-#include <fstream>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 class a_dashboard_t final : public so_5::agent_t {
    struct show_stats_t final : public so_5::signal_t {};
@@ -20,6 +33,63 @@ public:
       return static_cast<std::size_t>(v);
    }
 
+   static constexpr std::size_t op_types_count =
+         static_cast<std::size_t>(op_type_t::reinit) + 1u;
+
+   // Accumulated delays for some period of time.
+   struct time_slot_data_t {
+      clock_t::duration total_time_{};
+      std::uint_fast64_t total_events_{};
+      // Distribution of values in microseconds.
+      // It has a fixed size, so recording doesn't allocate.
+      log_linear_histogram_t histogram_;
+
+      time_slot_data_t & operator+=(const clock_t::duration d) {
+         total_time_ += d;
+         total_events_ += 1;
+
+         const auto us = std::chrono::duration_cast<
+               std::chrono::microseconds>(d).count();
+         histogram_.record(us > 0 ? static_cast<std::uint64_t>(us) : 0u);
+         return *this;
+      }
+
+      time_slot_data_t & operator+=(const time_slot_data_t & o) {
+         total_time_ += o.total_time_;
+         total_events_ += o.total_events_;
+         histogram_.merge(o.histogram_);
+         return *this;
+      }
+
+      void reset() {
+         total_time_ = clock_t::duration::zero();
+         total_events_ = 0;
+         histogram_.reset();
+      }
+
+      clock_t::duration percentile(double p) const {
+         return std::chrono::microseconds{histogram_.percentile(p)};
+      }
+
+      clock_t::duration max() const {
+         return std::chrono::microseconds{histogram_.max()};
+      }
+
+      auto avg() const {
+         const auto calc = [&]{ return total_time_ / total_events_; };
+         decltype(calc()) r{};
+
+         if(total_events_)
+            r = calc();
+
+         return r;
+      }
+   };
+
+   // Accumulated delays for every type of operation.
+   using slot_data_array_t = std::array<time_slot_data_t, op_types_count>;
+
+
    // A message with information about the time spent during
    // the delivery of a message.
    struct delay_info_t final : public so_5::message_t {
@@ -31,56 +101,194 @@ public:
          {}
    };
 
-   a_dashboard_t(context_t ctx) : so_5::agent_t(std::move(ctx)) {
+   // Storage of delays that can be used instead of delay_info_t messages.
+   //
+   // Every thread records delays into its own shard, so there is no
+   // message per event and no contention between threads. The dashboard
+   // takes data from all shards on every show_stats_t tick.
+   //
+   // A shard has two slots: the owner thread records into the current one,
+   // take() switches the shard to the other slot and then takes the data
+   // from the previous one. So record() doesn't take locks, and take()
+   // waits only for a record() that is in progress at the switch.
+   //
+   // A shard is released when its thread exits and then it's reused by
+   // a new thread (the data that isn't taken yet stays in the shard).
+   class stats_collector_t {
+      struct shard_t {
+         // Does some thread own that shard?
+         std::atomic<bool> owned_{true};
+         // Is the owner inside record()?
+         std::atomic<bool> writing_{false};
+         // The index of the slot for record(). It's changed by take() only.
+         std::atomic<unsigned> current_{0u};
+         std::array<slot_data_array_t, 2u> slots_;
+      };
+
+      using shard_shptr_t = std::shared_ptr<shard_t>;
+
+      // Unique ID of the collector for thread-local caches of shards.
+      // The address of a collector can't be used because the address of
+      // a destroyed collector can be reused.
+      const std::uint64_t id_;
+
+      std::mutex shards_lock_;
+      std::vector<shard_shptr_t> shards_;
+
+      static std::uint64_t make_id() noexcept {
+         static std::atomic<std::uint64_t> last_id{0u};
+         return ++last_id;
+      }
+
+      shard_t & shard_for_current_thread() {
+         // NOTE: only the last used collector is cached. It's enough
+         // because there is only one collector in an example.
+         // NOTE: the shard is held by shared_ptr because the collector
+         // can be destroyed before the thread.
+         struct cache_t {
+            std::uint64_t owner_id_{};
+            shard_shptr_t shard_;
+
+            ~cache_t() { release(); }
+
+            void release() noexcept {
+               if(shard_)
+                  shard_->owned_.store(false, std::memory_order_release);
+               shard_.reset();
+            }
+         };
+         static thread_local cache_t cache;
+
+         if(cache.owner_id_ != id_) {
+            cache.release();
+            cache.shard_ = acquire_shard();
+            cache.owner_id_ = id_;
+         }
+
+         return *cache.shard_;
+      }
+
+      // Finds a shard released by an exited thread or creates a new one.
+      shard_shptr_t acquire_shard() {
+         std::lock_guard<std::mutex> lock{shards_lock_};
+         for(auto & shard : shards_) {
+            bool owned = false;
+            if(shard->owned_.compare_exchange_strong(owned, true,
+                  std::memory_order_acquire))
+               return shard;
+         }
+
+         shards_.push_back(std::make_shared<shard_t>());
+         return shards_.back();
+      }
+
+   public:
+      stats_collector_t() : id_{make_id()} {}
+
+      stats_collector_t(const stats_collector_t &) = delete;
+      stats_collector_t & operator=(const stats_collector_t &) = delete;
+
+      // Moves the data from all shards to to.
+      void take(slot_data_array_t & to) {
+         std::lock_guard<std::mutex> lock{shards_lock_};
+         for(auto & shard : shards_) {
+            // The switch and the check of writing_ are seq_cst (as
+            // the store to writing_ and the load of current_ in record()).
+            // So if the owner isn't seen inside record() then its next
+            // record() goes to the new slot.
+            const auto previous = shard->current_.load(std::memory_order_relaxed);
+            shard->current_.store(previous ^ 1u);
+            while(shard->writing_.load())
+               std::this_thread::yield();
+
+            auto & data = shard->slots_[previous];
+            for(std::size_t i = 0u; i != op_types_count; ++i) {
+               to[i] += data[i];
+               data[i].reset();
+            }
+         }
+      }
+
+      void record(op_type_t op_type, clock_t::duration pause) {
+         auto & shard = shard_for_current_thread();
+         shard.writing_.store(true);
+         auto & data = shard.slots_[shard.current_.load()];
+         data[to_size_t(op_type)] += pause;
+         shard.writing_.store(false, std::memory_order_release);
+      }
+   };
+
+   using stats_collector_shptr_t = std::shared_ptr<stats_collector_t>;
+
+   // Parameters of the output of stats.
+   struct params_t {
+      static constexpr std::chrono::milliseconds default_stats_interval{ 5000 };
+
+      // How often stats are shown and stored.
+      std::chrono::milliseconds stats_interval_{ default_stats_interval };
+      // Parameters of files with stats (there are no files if it's empty).
+      // If the base name isn't specified then the current time in
+      // milliseconds is used.
+      std::optional<stats_sink_t::params_t> sink_{ stats_sink_t::params_t{} };
+      // If it's not null then delays are published to it on every tick.
+      metrics_exporter_shptr_t exporter_{};
+   };
+
+   // If stats_collector is not null then delays are taken from it
+   // (delay_info_t messages are handled anyway).
+   a_dashboard_t(
+         context_t ctx,
+         stats_collector_shptr_t stats_collector = {})
+      :  a_dashboard_t(std::move(ctx), std::move(stats_collector), params_t{})
+   {}
+
+   a_dashboard_t(
+         context_t ctx,
+         stats_collector_shptr_t stats_collector,
+         params_t params)
+      :  so_5::agent_t(std::move(ctx))
+      ,  stats_collector_(std::move(stats_collector))
+      ,  params_(std::move(params)) {
       so_subscribe_self()
          .event(&a_dashboard_t::on_delay_info)
          .event(&a_dashboard_t::on_show_stats);
    }
 
    virtual void so_evt_start() override {
+      started_at_ = clock_t::now();
+
       // Initiate a periodic message for showing the current statistics.
       stats_timer_ = so_5::send_periodic<show_stats_t>(*this,
             std::chrono::milliseconds::zero(),
-            std::chrono::seconds{5});
+            params_.stats_interval_);
 
-      // Make a csv-file for storing the current values.
-      create_csv_file();
+      // Make a file for storing the current values.
+      create_stats_sink();
    }
 
 private:
-   struct time_slot_data_t {
-      clock_t::duration total_time_{};
-      std::uint_fast64_t total_events_{};
-
-      time_slot_data_t & operator+=(const clock_t::duration d) {
-         total_time_ += d;
-         total_events_ += 1;
-         return *this;
-      }
-
-      auto avg() const {
-         const auto calc = [&]{ return total_time_ / total_events_; };
-         decltype(calc()) r{};
-
-         if(total_events_)
-            r = calc();
-
-         return r;
-      }
-   };
+   // Percentiles to be shown.
+   static constexpr std::array<double, stats_record_t::percentiles_count>
+         percentiles{ 50.0, 90.0, 99.0, 99.9 };
 
    struct event_data_t {
       time_slot_data_t total_;
       time_slot_data_t last_slot_;
    };
 
-   std::array<event_data_t, static_cast<std::size_t>(op_type_t::reinit) + 1u> data_;
+   std::array<event_data_t, op_types_count> data_;
+
+   const stats_collector_shptr_t stats_collector_;
+   const params_t params_;
 
    so_5::timer_id_t stats_timer_;
    std::uint_fast64_t counter_{};
+   clock_t::time_point started_at_;
 
-   // A file for storing the current values in csv-format.
-   std::ofstream csv_file_;
+   // Files for storing the current values. Records are written by
+   // a background thread, so the dashboard doesn't wait for the disk.
+   std::unique_ptr<stats_sink_t> stats_sink_;
+   std::uint64_t reported_drops_{};
 
    void on_delay_info(mhood_t<delay_info_t> cmd) {
       auto & d = data_[to_size_t(cmd->op_type_)];
@@ -89,7 +297,12 @@ private:
    }
 
    void on_show_stats(mhood_t<show_stats_t>) {
-      store_current_data_to_csv_file();
+      if(stats_collector_)
+         take_data_from_stats_collector();
+
+      store_current_data_to_stats_sink();
+      if(params_.exporter_)
+         publish_metrics();
 
       fmt::print("### === -- {} -- === ###\n", counter_);
       handle_stats_for(data_[to_size_t(op_type_t::init)], "init");
@@ -100,19 +313,31 @@ private:
       ++counter_;
    }
 
-   void create_csv_file() {
-      // Create a csv-file for storing the current values.
-      // The current time in milliseconds will be used as the file name.
-      using namespace std::chrono;
+   void take_data_from_stats_collector() {
+      // NOTE: it is too big to be placed on the stack.
+      auto slot = std::make_unique<slot_data_array_t>();
+      stats_collector_->take(*slot);
+
+      for(std::size_t i = 0u; i != op_types_count; ++i) {
+         data_[i].total_ += (*slot)[i];
+         data_[i].last_slot_ += (*slot)[i];
+      }
+   }
+
+   void create_stats_sink() {
+      if(!params_.sink_)
+         return;
 
-      csv_file_.exceptions(std::ofstream::badbit | std::ofstream::failbit);
-      const auto file_name = fmt::format("{}.csv",
-            duration_cast<milliseconds>(
-                  steady_clock::now().time_since_epoch()).count());
-      csv_file_.open(file_name);
+      auto sink_params = *params_.sink_;
+      // The current time in milliseconds is used as the file name
+      // by default.
+      if(sink_params.base_name_.empty())
+         sink_params.base_name_ = fmt::format("{}",
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                     clock_t::now().time_since_epoch()).count());
 
-      csv_file_ << "Init-Avg;Init-Cnt;Reinit-Avg;Reinit-Cnt;IO-Avg;IO-Cnt"
-            << std::endl;
+      stats_sink_ = std::make_unique<stats_sink_t>(std::move(sink_params),
+            stats_layout_t{{"Init", "Reinit", "IO"}, percentiles});
    }
 
    template<typename T>
@@ -120,31 +345,118 @@ private:
       return std::chrono::duration_cast<std::chrono::milliseconds>(v).count();
    }
 
-   void store_current_data_to_csv_file() {
-      const auto & init = data_[to_size_t(op_type_t::init)];
-      const auto & reinit = data_[to_size_t(op_type_t::reinit)];
-      const auto & io_op = data_[to_size_t(op_type_t::io_op)];
+   template<typename T>
+   static std::uint64_t us(T v) {
+      const auto r = std::chrono::duration_cast<std::chrono::microseconds>(v).count();
+      return r > 0 ? static_cast<std::uint64_t>(r) : 0u;
+   }
 
-      fmt::print(csv_file_,
-            "{};{};{};{};{};{}\n",
-            ms(init.last_slot_.avg()), init.last_slot_.total_events_,
-            ms(reinit.last_slot_.avg()), reinit.last_slot_.total_events_,
-            ms(io_op.last_slot_.avg()), io_op.last_slot_.total_events_);
+   void store_current_data_to_stats_sink() {
+      if(!stats_sink_)
+         return;
+
+      stats_record_t record{};
+      record.tick_ = counter_;
+      record.uptime_ms_ = static_cast<std::uint64_t>(
+            ms(clock_t::now() - started_at_));
+
+      // The order of types is the same as in the layout.
+      std::size_t i = 0u;
+      for(const auto t : {op_type_t::init, op_type_t::reinit, op_type_t::io_op}) {
+         const auto & slot = data_[to_size_t(t)].last_slot_;
+         auto & op = record.ops_[i++];
+         op.avg_us_ = us(slot.avg());
+         op.events_ = slot.total_events_;
+         for(std::size_t p = 0u; p != percentiles.size(); ++p)
+            op.percentiles_us_[p] = us(slot.percentile(percentiles[p]));
+         op.max_us_ = us(slot.max());
+      }
 
-      csv_file_.flush();
+      stats_sink_->push(record);
+      // Every new loss of records is reported.
+      if(const auto drops = stats_sink_->dropped(); drops != reported_drops_) {
+         fmt::print("*** {} stats records are dropped{}\n", drops,
+               stats_sink_->failed() ? " (write error)" : "");
+         reported_drops_ = drops;
+      }
+   }
+
+   // Delays since the start in the Prometheus text format.
+   void publish_metrics() {
+      prometheus_text_t t;
+      t.family("so5_op_delay_seconds", "summary",
+            "Delay of messages of a_device_manager_t since the start");
+      for(const auto & [type, name] : {
+            std::make_pair(op_type_t::init, "init"),
+            std::make_pair(op_type_t::reinit, "reinit"),
+            std::make_pair(op_type_t::io_op, "io_op")}) {
+         const auto & total = data_[to_size_t(type)].total_;
+         t.summary_samples("so5_op_delay_seconds", "op", name,
+               total.histogram_, 1e-6);
+         t.sample("so5_op_delay_seconds_sum", {{"op", name}},
+               std::chrono::duration<double>(total.total_time_).count());
+      }
+
+      if(stats_sink_) {
+         t.family("so5_stats_records_dropped_total", "counter",
+               "Stats records that weren't written to files");
+         t.sample("so5_stats_records_dropped_total", {}, stats_sink_->dropped());
+      }
+
+      params_.exporter_->publish("dashboard", t.release());
+   }
+
+   // Make a string like "p50=1 p90=5 p99=10 p99.9=12 max=15".
+   static std::string percentiles_to_string(const time_slot_data_t & data) {
+      std::string result;
+      for(const auto p : percentiles)
+         result += fmt::format("p{}={} ", p, ms(data.percentile(p)));
+      result += fmt::format("max={}", ms(data.max()));
+      return result;
    }
 
    void handle_stats_for(
          event_data_t & data,
          const char * op_name) {
       fmt::print(
-            "{:7}: total(avg)={:6}ms (events={:5}) | last(avg)={:6}ms (events={:5})\n",
+            "{:7}: total(avg)={:6}ms (events={:5}) | last(avg)={:6}ms (events={:5})\n"
+            "{:7}  total(ms): {} | last(ms): {}\n",
             op_name,
             ms(data.total_.avg()), data.total_.total_events_,
-            ms(data.last_slot_.avg()), data.last_slot_.total_events_);
+            ms(data.last_slot_.avg()), data.last_slot_.total_events_,
+            "",
+            percentiles_to_string(data.total_),
+            percentiles_to_string(data.last_slot_));
 
       // Data for the last period should be dropped.
-      data.last_slot_ = time_slot_data_t{};
+      data.last_slot_.reset();
    }
 };
 
+// Helper function for making dashboard's params from the command line args.
+inline a_dashboard_t::params_t make_dashboard_params(
+      const args_t & args,
+      metrics_exporter_shptr_t exporter = {}) {
+   a_dashboard_t::params_t params;
+   params.stats_interval_ = args.stats_interval_;
+   params.exporter_ = std::move(exporter);
+
+   if("none" == args.stats_format_) {
+      params.sink_.reset();
+      return params;
+   }
+
+   auto & sink = *params.sink_;
+   if("csv" == args.stats_format_)
+      sink.format_ = stats_sink_t::format_t::csv;
+   else if("binary" == args.stats_format_)
+      sink.format_ = stats_sink_t::format_t::binary;
+   else
+      throw std::invalid_argument(
+            "unknown stats format: " + args.stats_format_);
+   sink.rotate_size_ = std::uint64_t{args.stats_rotate_size_mb_} * 1024u * 1024u;
+   sink.max_files_ = args.stats_max_files_;
+
+   return params;
+}
+
@@ -2,9 +2,20 @@
 
 #include <common/args.hpp>
 #include <common/a_dashboard.hpp>
-
+#include <common/demand_scheduler.hpp>
+#include <common/pooled_allocation.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <optional>
 #include <random>
 
+#if defined(__unix__) || defined(__APPLE__)
+   #include <sys/resource.h>
+#endif
+
 class a_device_manager_t final : public so_5::agent_t {
 public:
    using clock_t = a_dashboard_t::clock_t;
@@ -23,12 +34,21 @@ public:
       msg_base_t(clock_t::time_point expected_time)
          :  expected_time_(expected_time)
       {}
+
+      // The ID of the device the message is related to.
+      // It's used as the key for affinity routing of demands.
+      virtual std::optional<std::uint_fast64_t> device_id() const noexcept {
+         return std::nullopt;
+      }
    };
 
    // A description of one device.
    // An object of that type is created at the start and then is resent
    // inside device-related messages.
-   struct device_t final {
+   //
+   // Objects of that type and messages with devices are allocated from
+   // pools if pooled_allocation_enabled() is true.
+   struct device_t final : public pooled_allocation_t<device_t> {
       using id_t = std::uint_fast64_t;
       // The unique ID of a device.
       id_t id_;
@@ -58,20 +78,57 @@ public:
    // A message about necessity of initialization of a new device.
    struct init_device_t final : public msg_base_t {
       device_t::id_t id_;
+      // Is it the first init of the device at the start?
+      bool startup_{ false };
 
       init_device_t(device_t::id_t id) : id_(id) {}
+      init_device_t(device_t::id_t id, bool startup)
+         :  id_(id)
+         ,  startup_(startup)
+      {}
+      init_device_t(device_t::id_t id, clock_t::time_point expected_time)
+         :  msg_base_t(expected_time)
+         ,  id_(id)
+      {}
+      init_device_t(
+            device_t::id_t id,
+            bool startup,
+            clock_t::time_point expected_time)
+         :  msg_base_t(expected_time)
+         ,  id_(id)
+         ,  startup_(startup)
+      {}
+
+      std::optional<std::uint_fast64_t> device_id() const noexcept override {
+         return id_;
+      }
    };
 
    // A message about necessity of reinitialization of a device.
-   struct reinit_device_t final : public msg_base_t {
+   struct reinit_device_t final
+      :  public msg_base_t
+      ,  public pooled_allocation_t<reinit_device_t> {
       device_uptr_t device_;
 
       reinit_device_t(device_uptr_t device) : device_(std::move(device)) {}
+
+      std::optional<std::uint_fast64_t> device_id() const noexcept override {
+         return device_->id_;
+      }
    };
 
    // A message about necessity to perform an IO-op on a device.
-   struct perform_io_t final : public msg_base_t {
+   //
+   // NOTE: the same message is sent again for the next IO-op on the device
+   // (and for the completion of an IO-op in the asynchronous mode), so
+   // the steady-state IO loop of a device doesn't create new messages.
+   struct perform_io_t final
+      :  public msg_base_t
+      ,  public pooled_allocation_t<perform_io_t> {
       device_uptr_t device_;
+      // Is the IO-op started? It's true if the message is the completion
+      // of an asynchronous IO-op.
+      bool started_{ false };
 
       perform_io_t(
          device_uptr_t device,
@@ -79,36 +136,275 @@ public:
          :  msg_base_t(expected_time)
          ,  device_(std::move(device))
       {}
+
+      std::optional<std::uint_fast64_t> device_id() const noexcept override {
+         return device_->id_;
+      }
+   };
+
+   // A message about the completion of init or reinit of a device
+   // in the asynchronous mode (see args_t::async_io_).
+   //
+   // NOTE: the completion of an IO-op is delivered by perform_io_t itself.
+   struct op_completed_t final
+      :  public msg_base_t
+      ,  public pooled_allocation_t<op_completed_t> {
+      a_dashboard_t::op_type_t op_type_;
+      device_uptr_t device_;
+      // Is it the completion of the first init of the device at the start?
+      bool startup_;
+
+      op_completed_t(
+         a_dashboard_t::op_type_t op_type,
+         device_uptr_t device,
+         bool startup,
+         clock_t::time_point expected_time)
+         :  msg_base_t(expected_time)
+         ,  op_type_(op_type)
+         ,  device_(std::move(device))
+         ,  startup_(startup)
+      {}
+
+      std::optional<std::uint_fast64_t> device_id() const noexcept override {
+         return device_->id_;
+      }
    };
 
    a_device_manager_t(
          context_t ctx,
          const args_t & args,
-         so_5::mbox_t dashboard_mbox)
+         so_5::mbox_t dashboard_mbox,
+         // If it's not null then delays are recorded into it
+         // instead of sending delay_info_t messages to the dashboard.
+         a_dashboard_t::stats_collector_shptr_t stats_collector = {},
+         // If it's not null then IO-ops are scheduled via it instead
+         // of so_5::send_delayed.
+         demand_scheduler_shptr_t demand_scheduler = {})
          :  so_5::agent_t(std::move(ctx))
          ,  args_(args)
-         ,  dashboard_mbox_(std::move(dashboard_mbox)) {
+         ,  dashboard_mbox_(std::move(dashboard_mbox))
+         ,  stats_collector_(std::move(stats_collector))
+         ,  demand_scheduler_(std::move(demand_scheduler))
+         ,  ramp_shape_(to_ramp_shape(args.ramp_shape_)) {
       so_subscribe_self()
+         .event(&a_device_manager_t::on_ramp_tick, so_5::thread_safe)
          .event(&a_device_manager_t::on_init_device, so_5::thread_safe)
          .event(&a_device_manager_t::on_reinit_device, so_5::thread_safe)
-         .event(&a_device_manager_t::on_perform_io, so_5::thread_safe);
+         .event(&a_device_manager_t::on_perform_io, so_5::thread_safe)
+         .event(&a_device_manager_t::on_op_completed, so_5::thread_safe);
+   }
+
+   // Informs that a message for the device was rejected by a full lane
+   // of the dispatcher (see tricky_dispatcher_t::overflow_policy_t).
+   // The device is lost, so it will be created again after a delay.
+   // The delay grows while rejections continue and shrinks after
+   // successful inits, so the init rate slows down under overload.
+   //
+   // A rejected first init remains the first init (and it remains
+   // in-flight for the startup ramp).
+   //
+   // NOTE: it's called on the thread that pushes the rejected message,
+   // so it doesn't push messages to the dispatcher synchronously.
+   void device_rejected(device_t::id_t id, bool startup = false) const {
+      const auto backoff = std::min(
+            init_backoff_ms_.load(std::memory_order_relaxed) * 2,
+            max_init_backoff.count());
+      init_backoff_ms_.store(backoff, std::memory_order_relaxed);
+
+      // Retries are spread over [backoff, 2*backoff) to avoid bursts.
+      thread_local std::minstd_rand generator{std::random_device{}()};
+      std::uniform_int_distribution<std::chrono::milliseconds::rep> delay{
+            backoff, 2 * backoff - 1};
+      send_after<init_device_t>(
+            std::chrono::milliseconds{delay(generator)}, id, startup);
    }
 
    void so_evt_start() override {
+      startup_started_at_ = clock_t::now();
+
+      if(args_.init_rate_ || args_.max_inflight_inits_) {
+         // Messages for the creation of new devices are sent by portions
+         // on every tick of the ramp.
+         ramp_timer_ = so_5::send_periodic<ramp_tick_t>(
+               *this, std::chrono::milliseconds::zero(), ramp_tick);
+         return;
+      }
+
       // Send a bunch of messages for the creation of new devices.
       device_t::id_t id{};
       for(unsigned i = 0; i != args_.device_count_; ++i, ++id)
-         so_5::send<init_device_t>(*this, id);
+         so_5::send<init_device_t>(*this, id, true);
    }
 
 private:
+   // How the init rate grows at the start (see args_t::ramp_shape_).
+   enum class ramp_shape_t { step, linear, exponential };
+
+   // A signal for sending the next portion of inits at the start.
+   struct ramp_tick_t final : public so_5::signal_t {};
+
+   // The period of sending of inits at the start.
+   static constexpr std::chrono::milliseconds ramp_tick{ 10 };
+
+   // The exponential ramp starts from 1/1024 of the full rate
+   // and doubles the rate 10 times during the ramp time.
+   static constexpr double exponential_ramp_doublings = 10.0;
+
    const args_t args_;
    const so_5::mbox_t dashboard_mbox_;
+   const a_dashboard_t::stats_collector_shptr_t stats_collector_;
+   const demand_scheduler_shptr_t demand_scheduler_;
+
+   const ramp_shape_t ramp_shape_;
+   // The start of sending of inits.
+   clock_t::time_point startup_started_at_;
+   // NOTE: ticks are handled as thread-safe events (so adv_thread_pool
+   // doesn't wait for long inits before a tick), a late tick and the next
+   // one can be handled at the same time, so the state of the ramp is
+   // protected.
+   std::mutex ramp_lock_;
+   so_5::timer_id_t ramp_timer_;
+   // The count of sent first inits (it's the ID of the next device too).
+   // NOTE: it's protected by ramp_lock_.
+   std::uint64_t ramp_sent_{};
+   // The count of handled first inits.
+   mutable std::atomic<std::uint64_t> startup_inits_handled_{0u};
+   // Has the first IO-op been performed?
+   mutable std::atomic<bool> first_io_performed_{false};
+
+   // Limits of the delay before the next init of a rejected device.
+   static constexpr std::chrono::milliseconds min_init_backoff{ 10 };
+   static constexpr std::chrono::milliseconds max_init_backoff{ 5000 };
+
+   // The current delay for rejected devices (in milliseconds).
+   // NOTE: it's updated by handlers without synchronization, races make
+   // it a bit less precise, but it's not important.
+   mutable std::atomic<std::chrono::milliseconds::rep> init_backoff_ms_{
+         min_init_backoff.count() };
+
+   static ramp_shape_t to_ramp_shape(const std::string & shape) {
+      if("step" == shape)
+         return ramp_shape_t::step;
+      else if("linear" == shape)
+         return ramp_shape_t::linear;
+      else if("exponential" == shape)
+         return ramp_shape_t::exponential;
+      throw std::invalid_argument("unknown ramp shape: " + shape);
+   }
+
+   // The count of inits that have to be sent after the specified time
+   // since the start (an integral of the init rate over that time).
+   std::uint64_t ramp_target(clock_t::duration elapsed) const {
+      if(!args_.init_rate_)
+         return args_.device_count_;
+
+      const double rate = args_.init_rate_;
+      const double t = std::chrono::duration<double>(elapsed).count();
+      const double ramp = std::chrono::duration<double>(args_.ramp_time_).count();
+      double target = 0.0;
+      switch(ramp_shape_) {
+      case ramp_shape_t::step:
+         target = rate * t;
+      break;
+
+      case ramp_shape_t::linear:
+         // The rate grows from zero to the full rate during the ramp.
+         target = t < ramp ?
+               rate * t * t / (2.0 * ramp) :
+               rate * ramp / 2.0 + rate * (t - ramp);
+      break;
+
+      case ramp_shape_t::exponential: {
+         // The rate is rate*2^(k*(t/ramp - 1)) during the ramp.
+         const double k = exponential_ramp_doublings;
+         const double scale = ramp / (k * std::log(2.0));
+         const auto integral = [&](double x) {
+            return rate * scale * std::exp2(k * (x / ramp - 1.0));
+         };
+         target = t < ramp ?
+               integral(t) - integral(0.0) :
+               integral(ramp) - integral(0.0) + rate * (t - ramp);
+      }
+      break;
+      }
+
+      // The first init is sent immediately.
+      return std::min<std::uint64_t>(
+            static_cast<std::uint64_t>(target) + 1u, args_.device_count_);
+   }
+
+   void on_ramp_tick(mhood_t<ramp_tick_t>) {
+      // A tick that is late is skipped, the next one sends all
+      // inits that are due.
+      std::unique_lock<std::mutex> lock{ramp_lock_, std::try_to_lock};
+      if(!lock || ramp_sent_ == args_.device_count_)
+         return;
+
+      auto target = ramp_target(clock_t::now() - startup_started_at_);
+      if(args_.max_inflight_inits_)
+         target = std::min<std::uint64_t>(target,
+               startup_inits_handled_.load(std::memory_order_relaxed)
+                     + args_.max_inflight_inits_);
+
+      for(; ramp_sent_ < target; ++ramp_sent_)
+         so_5::send<init_device_t>(*this, ramp_sent_, true);
+
+      if(ramp_sent_ == args_.device_count_)
+         ramp_timer_.release();
+   }
+
+   // Updates the progress of the start after the handling of an init.
+   void startup_init_handled() const {
+      const auto handled = startup_inits_handled_.fetch_add(
+            1u, std::memory_order_relaxed) + 1u;
+      if(handled == args_.device_count_)
+         fmt::print("*** startup: {} devices are inited in {}ms, "
+               "peak RSS: {}MiB ***\n",
+               handled, ms_since_startup(), peak_rss_mib());
+   }
+
+   // Reports the time to the first IO-op.
+   void note_io_performed() const {
+      if(!first_io_performed_.load(std::memory_order_relaxed) &&
+            !first_io_performed_.exchange(true, std::memory_order_relaxed))
+         fmt::print("*** startup: the first IO-op after {}ms ***\n",
+               ms_since_startup());
+   }
+
+   long long ms_since_startup() const {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+            clock_t::now() - startup_started_at_).count();
+   }
+
+   // The peak resident set size of the process (-1 if it's unknown).
+   static long long peak_rss_mib() noexcept {
+#if defined(__APPLE__)
+      rusage usage{};
+      // ru_maxrss is in bytes on macOS.
+      return 0 == ::getrusage(RUSAGE_SELF, &usage) ?
+            static_cast<long long>(usage.ru_maxrss) / (1024 * 1024) : -1;
+#elif defined(__unix__)
+      rusage usage{};
+      // ru_maxrss is in KiB on Linux.
+      return 0 == ::getrusage(RUSAGE_SELF, &usage) ?
+            static_cast<long long>(usage.ru_maxrss) / 1024 : -1;
+#else
+      return -1;
+#endif
+   }
 
    void on_init_device(mhood_t<init_device_t> cmd) const {
       // Update the stats for that op.
       handle_msg_delay(a_dashboard_t::op_type_t::init, *cmd);
 
+      // The lane accepted that init, so the delay for rejected devices
+      // can be decreased.
+      const auto backoff = init_backoff_ms_.load(std::memory_order_relaxed);
+      if(backoff > min_init_backoff.count())
+         init_backoff_ms_.store(
+               std::max(backoff / 2, min_init_backoff.count()),
+               std::memory_order_relaxed);
+
       // A new device should be created.
       // We should imitate a pause related to the device initialization.
       auto dev = std::make_unique<device_t>(cmd->id_,
@@ -116,7 +412,17 @@ private:
             calculate_io_ops_before_reinit(),
             calculate_reinits_before_recreate());
 
+      if(args_.async_io_) {
+         // The worker thread isn't blocked, the completion will arrive later.
+         // NOTE: an init is in-flight until the completion.
+         send_completion_msg(a_dashboard_t::op_type_t::init, std::move(dev),
+               args_.device_init_time_, cmd->startup_);
+         return;
+      }
+
       std::this_thread::sleep_for(args_.device_init_time_);
+      if(cmd->startup_)
+         startup_init_handled();
 
       // Send a message for the first IO-op on that device.
       send_perform_io_msg(std::move(dev));
@@ -133,41 +439,80 @@ private:
 
       // Simulate a pause of reinitializing the device.
       // Reinitialization takes 2/3 from init's time.
-      std::this_thread::sleep_for((args_.device_init_time_/3)*2);
+      const auto reinit_time = (args_.device_init_time_/3)*2;
+      if(args_.async_io_) {
+         send_completion_msg(a_dashboard_t::op_type_t::reinit,
+               std::move(cmd->device_), reinit_time);
+         return;
+      }
+
+      std::this_thread::sleep_for(reinit_time);
 
       // Continue to do IO-op on that device.
       send_perform_io_msg(std::move(cmd->device_));
    }
 
    void on_perform_io(mutable_mhood_t<perform_io_t> cmd) const {
+      if(cmd->started_) {
+         // The asynchronous IO-op is completed.
+         cmd->started_ = false;
+         complete_io(cmd);
+         return;
+      }
+
       // Update the stats for that op.
       handle_msg_delay(a_dashboard_t::op_type_t::io_op, *cmd);
+      note_io_performed();
+
+      if(args_.async_io_) {
+         // The worker thread isn't blocked, the same message comes back
+         // as the completion.
+         cmd->started_ = true;
+         resend_after(args_.io_op_time_, cmd);
+         return;
+      }
 
       // Simulate a pause for IO-op.
       std::this_thread::sleep_for(args_.io_op_time_);
 
+      complete_io(cmd);
+   }
+
+   void on_op_completed(mutable_mhood_t<op_completed_t> cmd) const {
+      if(cmd->startup_)
+         startup_init_handled();
+      // The device is ready after init or reinit.
+      send_perform_io_msg(std::move(cmd->device_));
+   }
+
+   void complete_io(mutable_mhood_t<perform_io_t> & cmd) const {
+      auto & dev = cmd->device_;
       // The remaining count of IO-ops should be decremented.
-      cmd->device_->remaining_io_ops_ -= 1;
+      dev->remaining_io_ops_ -= 1;
       // Maybe it is time to reinit or recreate the device?
-      if(0 == cmd->device_->remaining_io_ops_) {
-         if(0 == cmd->device_->remaining_reinits_)
+      if(0 == dev->remaining_io_ops_) {
+         if(0 == dev->remaining_reinits_)
             // The device should recreated. Using the same ID.
-            so_5::send<init_device_t>(*this, cmd->device_->id_);
+            so_5::send<init_device_t>(*this, dev->id_);
          else
             // There are remaining reinit attempts.
-            so_5::send<so_5::mutable_msg<reinit_device_t>>(*this, std::move(cmd->device_));
+            so_5::send<so_5::mutable_msg<reinit_device_t>>(*this, std::move(dev));
       }
       else
-         // It isn't time for reinit yet. Continue IO-operations.
-         send_perform_io_msg(std::move(cmd->device_));
+         // It isn't time for reinit yet. Continue IO-operations
+         // with the same message.
+         resend_after(dev->io_period_, cmd);
    }
 
    void handle_msg_delay(
          a_dashboard_t::op_type_t op_type,
          const msg_base_t & msg ) const {
       const auto delta = clock_t::now() - msg.expected_time_;
-      so_5::send<a_dashboard_t::delay_info_t>(
-            dashboard_mbox_, op_type, delta);
+      if(stats_collector_)
+         stats_collector_->record(op_type, delta);
+      else
+         so_5::send<a_dashboard_t::delay_info_t>(
+               dashboard_mbox_, op_type, delta);
    }
 
    std::chrono::milliseconds calculate_io_period() const {
@@ -194,11 +539,51 @@ private:
       return rd_seq(rd_dev);
    }
 
+   // Sends a message to itself after the period. The expected time is
+   // passed to the constructor of the message as the last argument.
+   template<typename Msg, typename... Args>
+   void send_after(std::chrono::milliseconds period, Args &&... args) const {
+      const auto expected_time = clock_t::now() + period;
+      if(demand_scheduler_)
+         schedule_message<Msg>(
+               *demand_scheduler_, *this, expected_time,
+               std::forward<Args>(args)..., expected_time);
+      else
+         so_5::send_delayed<Msg>(
+               *this, period, std::forward<Args>(args)..., expected_time);
+   }
+
+   // Sends the message being handled to itself again after the period.
+   // The message isn't created again, only the expected time is updated.
+   template<typename Msg>
+   void resend_after(
+         std::chrono::milliseconds period,
+         mutable_mhood_t<Msg> & cmd) const {
+      const auto expected_time = clock_t::now() + period;
+      cmd->expected_time_ = expected_time;
+      if(demand_scheduler_)
+         schedule_message(
+               *demand_scheduler_, *this, expected_time, cmd.make_holder());
+      else
+         so_5::send_delayed(*this, period, cmd.make_holder());
+   }
+
    void send_perform_io_msg(device_uptr_t dev) const {
       const auto period = dev->io_period_;
-      const auto expected_time = clock_t::now() + period;
-      so_5::send_delayed<so_5::mutable_msg<perform_io_t>>(
-            *this, period, std::move(dev), expected_time);
+      send_after<so_5::mutable_msg<perform_io_t>>(period, std::move(dev));
+   }
+
+   // Imitates the completion of an asynchronous operation after
+   // the duration of the operation. The completion is delivered the same
+   // way as IO-ops (via the dispatcher's timer or via the SObjectizer's
+   // timer), so a real driver would push it from its own reactor.
+   void send_completion_msg(
+         a_dashboard_t::op_type_t op_type,
+         device_uptr_t dev,
+         std::chrono::milliseconds duration,
+         bool startup = false) const {
+      send_after<so_5::mutable_msg<op_completed_t>>(
+            duration, op_type, std::move(dev), startup);
    }
 };
 
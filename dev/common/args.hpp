@@ -2,6 +2,7 @@
 
 #include <chrono>
 #include <iostream>
+#include <string>
 
 // The range for valus of IO-operation frequence.
 struct io_ops_period_range_t {
@@ -21,6 +22,17 @@ struct args_t {
    static constexpr std::chrono::milliseconds default_device_init_time{ 1250 };
    static constexpr std::chrono::milliseconds default_io_op_time{ 50 };
 
+   static constexpr unsigned default_lock_free_queue_capacity = 65536u;
+   static constexpr std::chrono::milliseconds default_rebalance_wait_threshold{ 100 };
+   static constexpr std::chrono::milliseconds default_idle_timeout{ 10000 };
+   static constexpr std::chrono::milliseconds default_block_timeout{ 100 };
+   static constexpr std::chrono::milliseconds default_stats_interval{ 5000 };
+   static constexpr std::chrono::seconds default_trace_after{ 60 };
+   static constexpr std::chrono::milliseconds default_ramp_time{ 10000 };
+   static constexpr std::chrono::milliseconds default_heavy_threshold{ 200 };
+   static constexpr std::chrono::milliseconds default_light_threshold{ 100 };
+   static constexpr unsigned default_classify_window = 16u;
+
    // The count of simulating devices.
    unsigned device_count_{ default_device_count };
 
@@ -39,6 +51,140 @@ struct args_t {
    std::chrono::milliseconds device_init_time_{ default_device_init_time };
    // The duration of an IO-operation.
    std::chrono::milliseconds io_op_time_{ default_io_op_time };
+
+   // The type of demand queues: mchain, lock-free or work-stealing
+   // (tricky_disp_case only).
+   std::string queue_backend_{ "mchain" };
+   // The capacity of a lock-free queue (tricky_disp_case only).
+   unsigned lock_free_queue_capacity_{ default_lock_free_queue_capacity };
+   // The max count of demands extracted by a worker at once
+   // (tricky_disp_case only).
+   unsigned batch_size_{ 1u };
+
+   // Change types of threads at runtime (tricky_disp_case only).
+   bool adaptive_split_{ false };
+   // The wait time threshold for changing types of threads
+   // (tricky_disp_case only).
+   std::chrono::milliseconds rebalance_wait_threshold_{
+         default_rebalance_wait_threshold };
+
+   // Serve demands in the order of their expected time instead of
+   // the FIFO order (tricky_disp_case only).
+   bool edf_{ false };
+
+   // Collect and show metrics of the dispatcher (tricky_disp_case only).
+   bool metrics_{ false };
+
+   // Record delays into per-thread storages instead of sending
+   // a message to the dashboard for every event.
+   bool thread_local_stats_{ false };
+
+   // Schedule IO-ops via the timer of the dispatcher instead of
+   // so_5::send_delayed (tricky_disp_case only).
+   bool timer_wheel_{ false };
+
+   // Allocate devices and messages with devices from pools.
+   bool pooled_alloc_{ false };
+
+   // Pinning of worker threads: none, core or core-set
+   // (tricky_disp_case only).
+   std::string pinning_{ "none" };
+   // CPUs for threads of the first and the second type: a list like
+   // "0-3,8" or "node:N" for CPUs of a NUMA node (tricky_disp_case only).
+   std::string first_type_cpus_;
+   std::string second_type_cpus_;
+
+   // How idle workers wait: blocking or spin-then-park
+   // (tricky_disp_case only).
+   std::string wait_strategy_{ "blocking" };
+   // The max time of spinning for spin-then-park, in microseconds.
+   unsigned max_spin_us_{ 50u };
+
+   // The max size of the elastic thread pool, zero means the fixed pool
+   // (tricky_disp_case only).
+   unsigned max_thread_pool_size_{ 0u };
+   // Threads above thread_pool_size_ retire after that idle time.
+   std::chrono::milliseconds idle_timeout_{ default_idle_timeout };
+
+   // Should device operations be asynchronous? A handler starts an
+   // operation and returns, the completion arrives as a message.
+   bool async_io_{ false };
+
+   // Should demands for the same device go to the same worker?
+   // Requires work-stealing queues (tricky_disp_case only).
+   bool affinity_{ false };
+   // Demands are stolen from the preferred worker only if it has
+   // at least that count of demands.
+   unsigned affinity_steal_threshold_{ 4u };
+
+   // Capacities of the init/reinit lane and the lane for other demands
+   // (tricky_disp_case only). Zero means an unbounded lane.
+   unsigned init_lane_capacity_{};
+   unsigned other_lane_capacity_{};
+   // What happens with a demand for a full lane:
+   // "block", "drop-oldest", "drop-newest" or "reject".
+   std::string overflow_policy_{ "reject" };
+   // The max wait time of a producer for the "block" policy.
+   std::chrono::milliseconds block_timeout_{ default_block_timeout };
+
+   // How often the dashboard shows and stores stats.
+   std::chrono::milliseconds stats_interval_{ default_stats_interval };
+   // The format of files with stats: "csv", "binary" or "none".
+   std::string stats_format_{ "csv" };
+   // A new file with stats is started when the current one becomes
+   // greater than that size (in MiB). Zero means a single file.
+   unsigned stats_rotate_size_mb_{};
+   // The max count of files with stats (the oldest ones are removed).
+   // Zero means that all files are kept.
+   unsigned stats_max_files_{};
+
+   // The address of the endpoint for scraping of metrics in
+   // the Prometheus format: a port of 127.0.0.1 or "unix:PATH".
+   // Empty string means that there is no endpoint.
+   std::string metrics_listen_;
+
+   // The count of the last handled demands to be kept in the trace
+   // of every worker thread. Zero means that there is no tracing.
+   unsigned trace_capacity_{};
+   // The file for the trace in the Chrome trace-event format.
+   std::string trace_file_{ "trace.json" };
+   // When the trace is written (since the start).
+   std::chrono::seconds trace_after_{ default_trace_after };
+
+   // The max rate of inits of devices at the start (inits per second).
+   // Zero means no limit.
+   unsigned init_rate_{};
+   // How the init rate grows at the start: "step" (the full rate from
+   // the beginning), "linear" or "exponential" (the full rate is reached
+   // after ramp_time_).
+   std::string ramp_shape_{ "step" };
+   std::chrono::milliseconds ramp_time_{ default_ramp_time };
+   // The max count of inits of devices at the start that are sent but
+   // not handled yet. Zero means no limit.
+   unsigned max_inflight_inits_{};
+
+   // How worker threads choose between lanes: "strict" (the init_reinit
+   // lane has the priority) or "weighted" (the time of threads is shared
+   // in proportion to weights of lanes).
+   std::string lane_scheduling_{ "strict" };
+   unsigned init_lane_weight_{ 1u };
+   unsigned other_lane_weight_{ 1u };
+
+   // Should tricky_dispatcher route message types to the heavy and light
+   // lanes by the measured time of their handling?
+   bool auto_classify_{ false };
+   // A type becomes heavy when its average time of handling reaches
+   // heavy_threshold_ and becomes light again when the average falls
+   // below light_threshold_.
+   std::chrono::milliseconds heavy_threshold_{ default_heavy_threshold };
+   std::chrono::milliseconds light_threshold_{ default_light_threshold };
+   // The count of measurements that mostly form the average.
+   unsigned classify_window_{ default_classify_window };
+
+   // Should the device manager work on generic_dispatcher_t instead of
+   // the dispatcher of the example (tricky_disp_case and
+   // adv_thread_pool_case)?
+   bool generic_dispatcher_{ false };
 };
 
 inline void print_args(const args_t & a) {
@@ -49,7 +195,51 @@ inline void print_args(const args_t & a) {
       << "io_ops_period: [" << a.io_ops_period_.left_.count()
          << "," << a.io_ops_period_.right_.count() << "]\n"
       << "device_init_time: " << a.device_init_time_.count() << "ms\n"
-      << "io_op_time: " << a.io_op_time_.count() << "ms"
+      << "io_op_time: " << a.io_op_time_.count() << "ms\n"
+      << "queue_backend: " << a.queue_backend_ << "\n"
+      << "lock_free_queue_capacity: " << a.lock_free_queue_capacity_ << "\n"
+      << "batch_size: " << a.batch_size_ << "\n"
+      << "adaptive_split: " << a.adaptive_split_ << "\n"
+      << "rebalance_wait_threshold: " << a.rebalance_wait_threshold_.count() << "ms\n"
+      << "edf: " << a.edf_ << "\n"
+      << "metrics: " << a.metrics_ << "\n"
+      << "thread_local_stats: " << a.thread_local_stats_ << "\n"
+      << "timer_wheel: " << a.timer_wheel_ << "\n"
+      << "pooled_alloc: " << a.pooled_alloc_ << "\n"
+      << "pinning: " << a.pinning_ << "\n"
+      << "first_type_cpus: " << a.first_type_cpus_ << "\n"
+      << "second_type_cpus: " << a.second_type_cpus_ << "\n"
+      << "wait_strategy: " << a.wait_strategy_ << "\n"
+      << "max_spin_us: " << a.max_spin_us_ << "\n"
+      << "max_thread_pool_size: " << a.max_thread_pool_size_ << "\n"
+      << "idle_timeout: " << a.idle_timeout_.count() << "ms\n"
+      << "async_io: " << a.async_io_ << "\n"
+      << "affinity: " << a.affinity_ << "\n"
+      << "affinity_steal_threshold: " << a.affinity_steal_threshold_ << "\n"
+      << "init_lane_capacity: " << a.init_lane_capacity_ << "\n"
+      << "other_lane_capacity: " << a.other_lane_capacity_ << "\n"
+      << "overflow_policy: " << a.overflow_policy_ << "\n"
+      << "block_timeout: " << a.block_timeout_.count() << "ms\n"
+      << "stats_interval: " << a.stats_interval_.count() << "ms\n"
+      << "stats_format: " << a.stats_format_ << "\n"
+      << "stats_rotate_size: " << a.stats_rotate_size_mb_ << "MiB\n"
+      << "stats_max_files: " << a.stats_max_files_ << "\n"
+      << "metrics_listen: " << a.metrics_listen_ << "\n"
+      << "trace_capacity: " << a.trace_capacity_ << "\n"
+      << "trace_file: " << a.trace_file_ << "\n"
+      << "trace_after: " << a.trace_after_.count() << "s\n"
+      << "init_rate: " << a.init_rate_ << "\n"
+      << "ramp_shape: " << a.ramp_shape_ << "\n"
+      << "ramp_time: " << a.ramp_time_.count() << "ms\n"
+      << "max_inflight_inits: " << a.max_inflight_inits_ << "\n"
+      << "lane_scheduling: " << a.lane_scheduling_ << "\n"
+      << "init_lane_weight: " << a.init_lane_weight_ << "\n"
+      << "other_lane_weight: " << a.other_lane_weight_ << "\n"
+      << "auto_classify: " << a.auto_classify_ << "\n"
+      << "heavy_threshold: " << a.heavy_threshold_.count() << "ms\n"
+      << "light_threshold: " << a.light_threshold_.count() << "ms\n"
+      << "classify_window: " << a.classify_window_ << "\n"
+      << "generic_dispatcher: " << a.generic_dispatcher_
       << std::endl;
 };
 
@@ -23,6 +23,66 @@ parse_args(int argc, char ** argv) {
    auto device_init_time = args_t::default_device_init_time.count();
    auto io_op_time = args_t::default_io_op_time.count();
 
+   std::string queue_backend{ "mchain" };
+   auto lock_free_queue_capacity = args_t::default_lock_free_queue_capacity;
+   unsigned batch_size = 1u;
+
+   bool adaptive_split = false;
+   auto rebalance_wait_threshold = args_t::default_rebalance_wait_threshold.count();
+
+   bool edf = false;
+   bool metrics = false;
+   bool thread_local_stats = false;
+   bool timer_wheel = false;
+   bool pooled_alloc = false;
+
+   std::string pinning{ "none" };
+   std::string first_type_cpus;
+   std::string second_type_cpus;
+
+   std::string wait_strategy{ "blocking" };
+   unsigned max_spin_us{ 50u };
+
+   unsigned max_thread_pool_size{ 0u };
+   auto idle_timeout = args_t::default_idle_timeout.count();
+
+   bool async_io = false;
+
+   bool affinity = false;
+   unsigned affinity_steal_threshold{ 4u };
+
+   unsigned init_lane_capacity{ 0u };
+   unsigned other_lane_capacity{ 0u };
+   std::string overflow_policy{ "reject" };
+   auto block_timeout = args_t::default_block_timeout.count();
+
+   auto stats_interval = args_t::default_stats_interval.count();
+   std::string stats_format{ "csv" };
+   unsigned stats_rotate_size_mb{ 0u };
+   unsigned stats_max_files{ 0u };
+
+   std::string metrics_listen;
+
+   unsigned trace_capacity{ 0u };
+   std::string trace_file{ "trace.json" };
+   auto trace_after = args_t::default_trace_after.count();
+
+   unsigned init_rate{ 0u };
+   std::string ramp_shape{ "step" };
+   auto ramp_time = args_t::default_ramp_time.count();
+   unsigned max_inflight_inits{ 0u };
+
+   std::string lane_scheduling{ "strict" };
+   unsigned init_lane_weight{ 1u };
+   unsigned other_lane_weight{ 1u };
+
+   bool auto_classify = false;
+   auto heavy_threshold = args_t::default_heavy_threshold.count();
+   auto light_threshold = args_t::default_light_threshold.count();
+   unsigned classify_window{ args_t::default_classify_window };
+
+   bool generic_dispatcher = false;
+
    bool help_requested = false;
 
    // Prepare the command-line parser.
@@ -57,6 +117,191 @@ parse_args(int argc, char ** argv) {
             ["-o"]["--io-op-time"]
             (fmt::format("device IO-operation time (milliseconds), default: {}",
                io_op_time))
+      | Opt(queue_backend, "mchain|lock-free|work-stealing")
+            ["-q"]["--queue-backend"]
+            (fmt::format("type of demand queues (tricky_disp_case only), "
+               "default: {}", queue_backend))
+      | Opt(lock_free_queue_capacity, "capacity")
+            ["--lock-free-capacity"]
+            (fmt::format("capacity of a lock-free queue, default: {}",
+               lock_free_queue_capacity))
+      | Opt(batch_size, "count")
+            ["--batch-size"]
+            (fmt::format("max count of demands extracted by a worker at once, "
+               "requires lock-free or work-stealing queues "
+               "(tricky_disp_case only), default: {}", batch_size))
+      | Opt(adaptive_split)
+            ["--adaptive-split"]
+            ("change types of threads at runtime, requires lock-free queues "
+               "(tricky_disp_case only)")
+      | Opt(rebalance_wait_threshold, "ms")
+            ["--rebalance-threshold"]
+            (fmt::format("wait time threshold for changing types of threads "
+               "(milliseconds), default: {}", rebalance_wait_threshold))
+      | Opt(edf)
+            ["--edf"]
+            ("serve demands with the earliest expected time first, requires "
+               "lock-free or work-stealing queues (tricky_disp_case only)")
+      | Opt(metrics)
+            ["--metrics"]
+            ("collect and show metrics of the dispatcher (tricky_disp_case only)")
+      | Opt(thread_local_stats)
+            ["--thread-local-stats"]
+            ("record delays into per-thread storages instead of sending "
+               "a message for every event")
+      | Opt(timer_wheel)
+            ["--timer-wheel"]
+            ("schedule IO-ops via the timer of the dispatcher instead of "
+               "the timer of SObjectizer (tricky_disp_case only)")
+      | Opt(pooled_alloc)
+            ["--pooled-alloc"]
+            ("allocate devices and messages with devices from pools")
+      | Opt(pinning, "none|core|core-set")
+            ["--pinning"]
+            (fmt::format("pinning of worker threads to CPUs "
+               "(tricky_disp_case only), default: {}", pinning))
+      | Opt(first_type_cpus, "cpus")
+            ["--first-type-cpus"]
+            ("CPUs for threads of the first type, like 0-3,8 or node:0 "
+               "(tricky_disp_case only)")
+      | Opt(second_type_cpus, "cpus")
+            ["--second-type-cpus"]
+            ("CPUs for threads of the second type, like 4-7 or node:1 "
+               "(tricky_disp_case only)")
+      | Opt(wait_strategy, "blocking|spin-then-park")
+            ["--wait-strategy"]
+            (fmt::format("how idle worker threads wait for demands "
+               "(tricky_disp_case and generic dispatcher only), default: {}",
+               wait_strategy))
+      | Opt(max_spin_us, "us")
+            ["--max-spin-us"]
+            (fmt::format("max time of spinning for spin-then-park "
+               "in microseconds, default: {}", max_spin_us))
+      | Opt(max_thread_pool_size, "size")
+            ["--max-thread-pool-size"]
+            ("max size of the elastic thread pool, threads are added when "
+               "demands wait longer than the rebalance threshold "
+               "(tricky_disp_case only), default: the fixed pool")
+      | Opt(idle_timeout, "ms")
+            ["--idle-timeout"]
+            (fmt::format("idle time before the retirement of an extra thread "
+               "of the elastic pool (milliseconds), default: {}", idle_timeout))
+      | Opt(async_io)
+            ["--async-io"]
+            ("don't block worker threads during device operations, "
+               "completions arrive as messages")
+      | Opt(affinity)
+            ["--affinity"]
+            ("handle demands for the same device on the same worker, "
+               "requires work-stealing queues (tricky_disp_case only)")
+      | Opt(affinity_steal_threshold, "count")
+            ["--affinity-steal-threshold"]
+            (fmt::format("min count of demands in the queue of a worker "
+               "for stealing from it with --affinity, default: {}",
+               affinity_steal_threshold))
+      | Opt(init_lane_capacity, "count")
+            ["--init-lane-capacity"]
+            ("max count of demands in the init/reinit lane "
+               "(tricky_disp_case only), default: unbounded")
+      | Opt(other_lane_capacity, "count")
+            ["--other-lane-capacity"]
+            ("max count of demands in the lane for other demands "
+               "(tricky_disp_case only), default: unbounded")
+      | Opt(overflow_policy, "block|drop-oldest|drop-newest|reject")
+            ["--overflow-policy"]
+            (fmt::format("what happens with a demand for a full lane, "
+               "rejected devices are created again later, default: {}",
+               overflow_policy))
+      | Opt(block_timeout, "ms")
+            ["--block-timeout"]
+            (fmt::format("max wait time of a producer for a full lane "
+               "with the block policy (milliseconds), default: {}",
+               block_timeout))
+      | Opt(stats_interval, "ms")
+            ["--stats-interval"]
+            (fmt::format("how often stats are shown and stored "
+               "(milliseconds), default: {}", stats_interval))
+      | Opt(stats_format, "csv|binary|none")
+            ["--stats-format"]
+            (fmt::format("format of files with stats, files are written "
+               "by a background thread, default: {}", stats_format))
+      | Opt(stats_rotate_size_mb, "MiB")
+            ["--stats-rotate-size"]
+            ("start a new file with stats when the current one becomes "
+               "greater than that size, default: a single file")
+      | Opt(stats_max_files, "count")
+            ["--stats-max-files"]
+            ("max count of files with stats, the oldest ones are removed, "
+               "default: all files are kept")
+      | Opt(metrics_listen, "port|unix:path")
+            ["--metrics-listen"]
+            ("serve metrics in the Prometheus text format on the port "
+               "of 127.0.0.1 or on the Unix domain socket, default: no")
+      | Opt(trace_capacity, "count")
+            ["--trace"]
+            ("trace the specified count of the last handled demands "
+               "of every thread of tricky_dispatcher, default: no")
+      | Opt(trace_file, "path")
+            ["--trace-file"]
+            (fmt::format("file for the trace in the Chrome trace-event "
+               "format, default: {}", trace_file))
+      | Opt(trace_after, "sec")
+            ["--trace-after"]
+            (fmt::format("when the trace is written (seconds since "
+               "the start), default: {}", trace_after))
+      | Opt(init_rate, "inits/sec")
+            ["--init-rate"]
+            ("max rate of inits of devices at the start, "
+               "default: all devices are inited at once")
+      | Opt(ramp_shape, "step|linear|exponential")
+            ["--ramp-shape"]
+            (fmt::format("how the init rate grows at the start, "
+               "default: {}", ramp_shape))
+      | Opt(ramp_time, "ms")
+            ["--ramp-time"]
+            (fmt::format("time for reaching the full init rate "
+               "for linear and exponential ramps (milliseconds), "
+               "default: {}", ramp_time))
+      | Opt(max_inflight_inits, "count")
+            ["--max-inflight-inits"]
+            ("max count of inits of devices at the start that are sent "
+               "but not handled yet, default: no limit")
+      | Opt(lane_scheduling, "strict|weighted")
+            ["--lane-scheduling"]
+            (fmt::format("how threads choose between lanes, "
+               "default: {}", lane_scheduling))
+      | Opt(init_lane_weight, "weight")
+            ["--init-lane-weight"]
+            (fmt::format("weight of the lane for init/reinit demands "
+               "(for weighted lane scheduling), default: {}",
+               init_lane_weight))
+      | Opt(other_lane_weight, "weight")
+            ["--other-lane-weight"]
+            (fmt::format("weight of the lane for other demands "
+               "(for weighted lane scheduling), default: {}",
+               other_lane_weight))
+      | Opt(auto_classify)
+            ["--auto-classify"]
+            ("route message types to heavy and light lanes by the measured "
+               "time of their handling (tricky_disp_case only)")
+      | Opt(heavy_threshold, "ms")
+            ["--heavy-threshold"]
+            (fmt::format("a type becomes heavy when its average time of "
+               "handling reaches that value (milliseconds), default: {}",
+               heavy_threshold))
+      | Opt(light_threshold, "ms")
+            ["--light-threshold"]
+            (fmt::format("a heavy type becomes light when its average time "
+               "of handling falls below that value (milliseconds), "
+               "default: {}", light_threshold))
+      | Opt(classify_window, "count")
+            ["--classify-window"]
+            (fmt::format("count of measurements that mostly form the average "
+               "time of handling of a type, default: {}", classify_window))
+      | Opt(generic_dispatcher)
+            ["--generic-dispatcher"]
+            ("run the device manager on generic_dispatcher_t with lock-free "
+               "lanes (tricky_disp_case and adv_thread_pool_case)")
       | Help(help_requested);
 
    // Perform the parsing...
@@ -93,6 +338,27 @@ parse_args(int argc, char ** argv) {
 
       min_value_checker(device_init_time, 10, "device_init_time");
       min_value_checker(io_op_time, 10, "io_op_time");
+
+      min_value_checker(lock_free_queue_capacity, 2, "lock_free_queue_capacity");
+      min_value_checker(batch_size, 1, "batch_size");
+      min_value_checker(rebalance_wait_threshold, 1, "rebalance_wait_threshold");
+      min_value_checker(idle_timeout, 1, "idle_timeout");
+      min_value_checker(affinity_steal_threshold, 1, "affinity_steal_threshold");
+      min_value_checker(block_timeout, 1, "block_timeout");
+      min_value_checker(stats_interval, 100, "stats_interval");
+      min_value_checker(trace_after, 1, "trace_after");
+      min_value_checker(ramp_time, 1, "ramp_time");
+      if("step" != ramp_shape && "linear" != ramp_shape &&
+            "exponential" != ramp_shape)
+         throw std::invalid_argument("unknown ramp shape: " + ramp_shape);
+      if("strict" != lane_scheduling && "weighted" != lane_scheduling)
+         throw std::invalid_argument(
+               "unknown lane scheduling: " + lane_scheduling);
+      min_value_checker(init_lane_weight, 1, "init_lane_weight");
+      min_value_checker(other_lane_weight, 1, "other_lane_weight");
+      min_value_checker(light_threshold, 0, "light_threshold");
+      min_value_checker(heavy_threshold, light_threshold, "heavy_threshold");
+      min_value_checker(classify_window, 1, "classify_window");
    }
 
    return args_t{
@@ -104,6 +370,50 @@ parse_args(int argc, char ** argv) {
             std::chrono::milliseconds{io_ops_period_left},
             std::chrono::milliseconds{io_ops_period_right} },
          std::chrono::milliseconds{device_init_time},
-         std::chrono::milliseconds{io_op_time} };
+         std::chrono::milliseconds{io_op_time},
+         queue_backend,
+         lock_free_queue_capacity,
+         batch_size,
+         adaptive_split,
+         std::chrono::milliseconds{rebalance_wait_threshold},
+         edf,
+         metrics,
+         thread_local_stats,
+         timer_wheel,
+         pooled_alloc,
+         pinning,
+         first_type_cpus,
+         second_type_cpus,
+         wait_strategy,
+         max_spin_us,
+         max_thread_pool_size,
+         std::chrono::milliseconds{idle_timeout},
+         async_io,
+         affinity,
+         affinity_steal_threshold,
+         init_lane_capacity,
+         other_lane_capacity,
+         overflow_policy,
+         std::chrono::milliseconds{block_timeout},
+         std::chrono::milliseconds{stats_interval},
+         stats_format,
+         stats_rotate_size_mb,
+         stats_max_files,
+         metrics_listen,
+         trace_capacity,
+         trace_file,
+         std::chrono::seconds{trace_after},
+         init_rate,
+         ramp_shape,
+         std::chrono::milliseconds{ramp_time},
+         max_inflight_inits,
+         lane_scheduling,
+         init_lane_weight,
+         other_lane_weight,
+         auto_classify,
+         std::chrono::milliseconds{heavy_threshold},
+         std::chrono::milliseconds{light_threshold},
+         classify_window,
+         generic_dispatcher };
 }
 
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// A bounded lock-free multi-producer/multi-consumer queue.
+//
+// It's the well known ring buffer by Dmitry Vyukov:
+//
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+//
+// Every cell has its own sequence number, so producers and consumers
+// synchronize via a single CAS on enqueue_pos_/dequeue_pos_ and never
+// take a lock.
+//
+// NOTE: T has to be default constructible and move assignable.
+template<typename T>
+class bounded_mpmc_queue_t {
+   // Size of cache line for separation of producers' and consumers' data.
+   static constexpr std::size_t cache_line_size = 64u;
+
+   struct cell_t {
+      std::atomic<std::size_t> sequence_;
+      T value_;
+   };
+
+   // Capacity is always a power of two, so mask_ can be used
+   // instead of the division.
+   const std::size_t mask_;
+   const std::unique_ptr<cell_t[]> cells_;
+
+   alignas(cache_line_size) std::atomic<std::size_t> enqueue_pos_{0u};
+   alignas(cache_line_size) std::atomic<std::size_t> dequeue_pos_{0u};
+
+   static std::size_t round_up_capacity(std::size_t capacity) noexcept {
+      std::size_t r = 2u;
+      while(r < capacity)
+         r <<= 1u;
+      return r;
+   }
+
+public:
+   explicit bounded_mpmc_queue_t(std::size_t capacity)
+      :  mask_{round_up_capacity(capacity) - 1u}
+      ,  cells_{new cell_t[mask_ + 1u]} {
+      for(std::size_t i = 0u; i <= mask_; ++i)
+         cells_[i].sequence_.store(i, std::memory_order_relaxed);
+   }
+
+   bounded_mpmc_queue_t(const bounded_mpmc_queue_t &) = delete;
+   bounded_mpmc_queue_t & operator=(const bounded_mpmc_queue_t &) = delete;
+
+   // Returns false if the queue is full.
+   // NOTE: v is moved only if the push is successful.
+   [[nodiscard]]
+   bool try_push(T && v) {
+      cell_t * cell;
+      auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+      for(;;) {
+         cell = &cells_[pos & mask_];
+         const auto seq = cell->sequence_.load(std::memory_order_acquire);
+         const auto diff = static_cast<std::ptrdiff_t>(seq) -
+               static_cast<std::ptrdiff_t>(pos);
+         if(0 == diff) {
+            if(enqueue_pos_.compare_exchange_weak(
+                  pos, pos + 1u, std::memory_order_relaxed))
+               break;
+         }
+         else if(diff < 0)
+            // The queue is full.
+            return false;
+         else
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+
+      cell->value_ = std::move(v);
+      cell->sequence_.store(pos + 1u, std::memory_order_release);
+      return true;
+   }
+
+   // Returns false if the queue is empty.
+   [[nodiscard]]
+   bool try_pop(T & v) {
+      cell_t * cell;
+      auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+      for(;;) {
+         cell = &cells_[pos & mask_];
+         const auto seq = cell->sequence_.load(std::memory_order_acquire);
+         const auto diff = static_cast<std::ptrdiff_t>(seq) -
+               static_cast<std::ptrdiff_t>(pos + 1u);
+         if(0 == diff) {
+            if(dequeue_pos_.compare_exchange_weak(
+                  pos, pos + 1u, std::memory_order_relaxed))
+               break;
+         }
+         else if(diff < 0)
+            // The queue is empty.
+            return false;
+         else
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+
+      v = std::move(cell->value_);
+      // The old value should be destroyed right now, not when the cell
+      // is reused (it can hold a reference to a message).
+      cell->value_ = T{};
+      cell->sequence_.store(pos + mask_ + 1u, std::memory_order_release);
+      return true;
+   }
+
+   // Extracts up to max items by a single CAS on dequeue_pos_.
+   // Every extracted item is passed to f as rvalue.
+   // Returns the count of extracted items (0 if the queue is empty).
+   template<typename F>
+   std::size_t try_pop_bulk(std::size_t max, F && f) {
+      std::size_t count;
+      auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+      for(;;) {
+         // Count cells that are already filled for the current lap.
+         count = 0u;
+         while(count < max &&
+               cells_[(pos + count) & mask_].sequence_.load(
+                     std::memory_order_acquire) == pos + count + 1u)
+            ++count;
+
+         if(count) {
+            if(dequeue_pos_.compare_exchange_weak(
+                  pos, pos + count, std::memory_order_relaxed))
+               break;
+         }
+         else {
+            const auto seq = cells_[pos & mask_].sequence_.load(
+                  std::memory_order_acquire);
+            if(static_cast<std::ptrdiff_t>(seq) -
+                  static_cast<std::ptrdiff_t>(pos + 1u) < 0)
+               // The queue is empty.
+               return 0u;
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+         }
+      }
+
+      // Cells [pos, pos+count) belong to us now.
+      for(std::size_t i = 0u; i != count; ++i) {
+         auto & cell = cells_[(pos + i) & mask_];
+         T v = std::move(cell.value_);
+         cell.value_ = T{};
+         cell.sequence_.store(pos + i + mask_ + 1u, std::memory_order_release);
+         f(std::move(v));
+      }
+      return count;
+   }
+
+   std::size_t capacity() const noexcept { return mask_ + 1u; }
+
+   // NOTE: it's just an estimation if there are concurrent pushes/pops.
+   std::size_t approx_size() const noexcept {
+      const auto enq = enqueue_pos_.load(std::memory_order_relaxed);
+      const auto deq = dequeue_pos_.load(std::memory_order_relaxed);
+      return enq > deq ? enq - deq : 0u;
+   }
+};
+
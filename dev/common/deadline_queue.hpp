@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// A thread-safe queue that returns items in the order of their deadlines
+// (the earliest deadline first). Items with the same deadline are returned
+// in the order of their pushing.
+//
+// It's a binary heap under a mutex. Every push/pop is O(log n), but
+// consumers don't take the lock if the queue is empty.
+//
+// NOTE: T has to be default constructible and move assignable.
+template<typename T, typename Time_Point>
+class deadline_queue_t {
+   struct item_t {
+      Time_Point deadline_;
+      // Sequence number of the push for the FIFO order of items
+      // with the same deadline.
+      std::uint64_t seq_;
+      T value_;
+   };
+
+   // The comparator for std::push_heap/pop_heap.
+   // The item with the earliest deadline has to be on the top.
+   struct later_t {
+      bool operator()(const item_t & a, const item_t & b) const noexcept {
+         return a.deadline_ > b.deadline_ ||
+               (a.deadline_ == b.deadline_ && a.seq_ > b.seq_);
+      }
+   };
+
+   std::mutex lock_;
+   std::vector<item_t> heap_;
+   std::uint64_t next_seq_{};
+   // The size of heap_ for checks without taking the lock.
+   std::atomic<std::size_t> size_{0u};
+
+public:
+   deadline_queue_t() = default;
+   deadline_queue_t(const deadline_queue_t &) = delete;
+   deadline_queue_t & operator=(const deadline_queue_t &) = delete;
+
+   void push(Time_Point deadline, T && v) {
+      std::lock_guard<std::mutex> lock{lock_};
+      heap_.push_back(item_t{deadline, next_seq_++, std::move(v)});
+      std::push_heap(heap_.begin(), heap_.end(), later_t{});
+      size_.store(heap_.size(), std::memory_order_relaxed);
+   }
+
+   // Preallocates the storage for n items.
+   void reserve(std::size_t n) {
+      std::lock_guard<std::mutex> lock{lock_};
+      heap_.reserve(n);
+   }
+
+   // Returns false if the queue is empty.
+   [[nodiscard]]
+   bool try_pop(T & v) {
+      if(!size_.load(std::memory_order_relaxed))
+         return false;
+
+      std::lock_guard<std::mutex> lock{lock_};
+      if(heap_.empty())
+         return false;
+
+      std::pop_heap(heap_.begin(), heap_.end(), later_t{});
+      v = std::move(heap_.back().value_);
+      heap_.pop_back();
+      size_.store(heap_.size(), std::memory_order_relaxed);
+      return true;
+   }
+
+   // Extracts up to max items under a single lock.
+   // Every extracted item is passed to f as rvalue.
+   // Returns the count of extracted items (0 if the queue is empty).
+   //
+   // NOTE: f is called under the lock, so it should be as cheap as possible.
+   template<typename F>
+   std::size_t try_pop_bulk(std::size_t max, F && f) {
+      if(!size_.load(std::memory_order_relaxed))
+         return 0u;
+
+      std::lock_guard<std::mutex> lock{lock_};
+      std::size_t count = 0u;
+      for(; count != max && !heap_.empty(); ++count) {
+         std::pop_heap(heap_.begin(), heap_.end(), later_t{});
+         f(std::move(heap_.back().value_));
+         heap_.pop_back();
+      }
+      size_.store(heap_.size(), std::memory_order_relaxed);
+      return count;
+   }
+
+   // Extracts the item with the latest deadline (the last pushed one
+   // among items with the same deadline), i.e. the least urgent item.
+   // Returns false if the queue is empty.
+   //
+   // NOTE: it's O(n), so it's intended for rare cases like the overflow.
+   [[nodiscard]]
+   bool try_pop_latest(T & v) {
+      if(!size_.load(std::memory_order_relaxed))
+         return false;
+
+      std::lock_guard<std::mutex> lock{lock_};
+      if(heap_.empty())
+         return false;
+
+      // The latest item is one of leaves.
+      const auto leaves = heap_.begin() +
+            static_cast<std::ptrdiff_t>(heap_.size() / 2u);
+      const auto latest = std::min_element(leaves, heap_.end(), later_t{});
+      v = std::move(latest->value_);
+
+      // The last item takes the place of the removed one and goes up
+      // (the prefix of a heap is a heap too).
+      const auto last = heap_.end() - 1;
+      if(latest != last) {
+         *latest = std::move(*last);
+         heap_.pop_back();
+         std::push_heap(heap_.begin(), latest + 1, later_t{});
+      }
+      else
+         heap_.pop_back();
+      size_.store(heap_.size(), std::memory_order_relaxed);
+      return true;
+   }
+
+   // NOTE: it's just an estimation if there are concurrent pushes/pops.
+   std::size_t approx_size() const noexcept {
+      return size_.load(std::memory_order_relaxed);
+   }
+};
+
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <common/pooled_allocation.hpp>
+
+#include <so_5/all.hpp>
+
+#include <chrono>
+#include <memory>
+#include <utility>
+
+// A message that has to be sent at some time in the future.
+//
+// The message is sent via the public so_5::send(), so it goes through
+// the mbox with its delivery filters and message limits like any other
+// message.
+class scheduled_message_t {
+public:
+   virtual ~scheduled_message_t() noexcept = default;
+
+   // Sends the message. It's called only once.
+   virtual void send() = 0;
+};
+
+using scheduled_message_uptr_t = std::unique_ptr<scheduled_message_t>;
+
+// An interface of a dispatcher that can send messages at the specified
+// time via its own timer.
+//
+// It's an alternative to so_5::send_delayed: there is no global timer
+// thread of SObjectizer and no timer demand for every message.
+class demand_scheduler_t {
+public:
+   // Type to be used for time counting.
+   using clock_t = std::chrono::steady_clock;
+
+   virtual ~demand_scheduler_t() noexcept = default;
+
+   // The message will be sent at the specified time (or as soon as
+   // possible if that time has passed).
+   virtual void schedule(
+         clock_t::time_point at,
+         scheduled_message_uptr_t msg) = 0;
+};
+
+using demand_scheduler_shptr_t = std::shared_ptr<demand_scheduler_t>;
+
+// The implementation of scheduled_message_t for a message of type Msg.
+// Instances are allocated from the pool if pooled allocation is on.
+template<typename Msg>
+class scheduled_message_holder_t final
+      : public scheduled_message_t
+      , public pooled_allocation_t<scheduled_message_holder_t<Msg>> {
+   const so_5::mbox_t to_;
+   so_5::message_holder_t<Msg> msg_;
+
+public:
+   scheduled_message_holder_t(so_5::mbox_t to, so_5::message_holder_t<Msg> msg)
+      :  to_{std::move(to)}
+      ,  msg_{std::move(msg)}
+   {}
+
+   void send() override {
+      so_5::send(to_, std::move(msg_));
+   }
+};
+
+// Helper function for scheduling a message to the direct mbox of an agent.
+//
+// Usage:
+//
+//    schedule_message<so_5::mutable_msg<perform_io_t>>(
+//          scheduler, *this, expected_time, std::move(dev), expected_time);
+template<typename Msg, typename... Args>
+void schedule_message(
+      demand_scheduler_t & scheduler,
+      const so_5::agent_t & receiver,
+      demand_scheduler_t::clock_t::time_point at,
+      Args &&... args) {
+   scheduler.schedule(at, std::make_unique<scheduled_message_holder_t<Msg>>(
+         receiver.so_direct_mbox(),
+         so_5::message_holder_t<Msg>::make(std::forward<Args>(args)...)));
+}
+
+// Helper function for scheduling an existing message (for example,
+// a mutable message that is sent again by its receiver).
+template<typename Msg>
+void schedule_message(
+      demand_scheduler_t & scheduler,
+      const so_5::agent_t & receiver,
+      demand_scheduler_t::clock_t::time_point at,
+      so_5::message_holder_t<Msg> msg) {
+   scheduler.schedule(at, std::make_unique<scheduled_message_holder_t<Msg>>(
+         receiver.so_direct_mbox(), std::move(msg)));
+}
+
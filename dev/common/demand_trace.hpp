@@ -0,0 +1,223 @@
+#pragma once
+
+#include <fmt/ostream.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__has_include)
+   #if __has_include(<cxxabi.h>)
+      #include <cxxabi.h>
+      #define DEMAND_TRACE_HAS_CXXABI
+   #endif
+#endif
+
+// A record about the handling of one demand.
+// Times are in nanoseconds since some moment (the start of the dispatcher).
+struct demand_trace_event_t {
+   std::uint64_t pushed_ns_;
+   std::uint64_t dequeued_ns_;
+   std::uint64_t started_ns_;
+   std::uint64_t finished_ns_;
+   // The name of the message type from std::type_index::name().
+   // It has the static storage duration, so only the pointer is kept.
+   const char * msg_type_;
+   std::uint32_t lane_;
+};
+
+// A ring buffer with the last events of one thread.
+//
+// There is only one writer, and it never waits: the oldest events are
+// overwritten. Readers can collect events at any time, every slot has
+// a sequence number (like a seqlock), so slots that are being overwritten
+// are just skipped.
+class demand_trace_ring_t {
+   struct slot_t {
+      // 2*n+1 while the n-th event is being written, 2*n+2 after that.
+      std::atomic<std::uint64_t> seq_{0u};
+      std::atomic<std::uint64_t> pushed_ns_{0u};
+      std::atomic<std::uint64_t> dequeued_ns_{0u};
+      std::atomic<std::uint64_t> started_ns_{0u};
+      std::atomic<std::uint64_t> finished_ns_{0u};
+      std::atomic<const char *> msg_type_{nullptr};
+      std::atomic<std::uint32_t> lane_{0u};
+   };
+
+   const std::size_t mask_;
+   const std::unique_ptr<slot_t[]> slots_;
+   // The count of recorded events.
+   std::atomic<std::uint64_t> recorded_{0u};
+
+   static std::size_t round_up_capacity(std::size_t capacity) noexcept {
+      std::size_t r = 2u;
+      while(r < capacity)
+         r <<= 1u;
+      return r;
+   }
+
+public:
+   explicit demand_trace_ring_t(std::size_t capacity)
+      :  mask_{round_up_capacity(capacity) - 1u}
+      ,  slots_{new slot_t[mask_ + 1u]}
+   {}
+
+   demand_trace_ring_t(const demand_trace_ring_t &) = delete;
+   demand_trace_ring_t & operator=(const demand_trace_ring_t &) = delete;
+
+   // NOTE: it has to be called by the owner thread only.
+   void record(const demand_trace_event_t & e) noexcept {
+      const auto n = recorded_.load(std::memory_order_relaxed);
+      auto & slot = slots_[n & mask_];
+
+      slot.seq_.store(2u * n + 1u, std::memory_order_relaxed);
+      // Readers have to see the odd sequence before new values.
+      std::atomic_thread_fence(std::memory_order_release);
+      slot.pushed_ns_.store(e.pushed_ns_, std::memory_order_relaxed);
+      slot.dequeued_ns_.store(e.dequeued_ns_, std::memory_order_relaxed);
+      slot.started_ns_.store(e.started_ns_, std::memory_order_relaxed);
+      slot.finished_ns_.store(e.finished_ns_, std::memory_order_relaxed);
+      slot.msg_type_.store(e.msg_type_, std::memory_order_relaxed);
+      slot.lane_.store(e.lane_, std::memory_order_relaxed);
+      slot.seq_.store(2u * n + 2u, std::memory_order_release);
+
+      recorded_.store(n + 1u, std::memory_order_release);
+   }
+
+   // Appends available events to to (the oldest go first).
+   void collect(std::vector<demand_trace_event_t> & to) const {
+      const auto recorded = recorded_.load(std::memory_order_acquire);
+      const auto capacity = static_cast<std::uint64_t>(mask_ + 1u);
+      for(auto n = recorded > capacity ? recorded - capacity : 0u;
+            n != recorded; ++n) {
+         const auto & slot = slots_[n & mask_];
+         const auto seq = slot.seq_.load(std::memory_order_acquire);
+         if(2u * n + 2u != seq)
+            // The slot is being overwritten or is already overwritten.
+            continue;
+
+         demand_trace_event_t e{
+               slot.pushed_ns_.load(std::memory_order_relaxed),
+               slot.dequeued_ns_.load(std::memory_order_relaxed),
+               slot.started_ns_.load(std::memory_order_relaxed),
+               slot.finished_ns_.load(std::memory_order_relaxed),
+               slot.msg_type_.load(std::memory_order_relaxed),
+               slot.lane_.load(std::memory_order_relaxed) };
+
+         // Values mustn't be read after the second check of the sequence.
+         std::atomic_thread_fence(std::memory_order_acquire);
+         if(seq == slot.seq_.load(std::memory_order_relaxed))
+            to.push_back(e);
+      }
+   }
+
+   std::uint64_t recorded() const noexcept {
+      return recorded_.load(std::memory_order_relaxed);
+   }
+};
+
+// Writer of events in the Chrome trace-event format (JSON), it can be
+// opened by chrome://tracing and https://ui.perfetto.dev.
+//
+// The handling of a demand is shown as a slice on the track of its worker
+// thread. The wait of a demand (from the push to the start of handling)
+// is shown as an async slice on the track of its lane.
+class chrome_trace_writer_t {
+   std::ostream & to_;
+   const char * separator_ = "\n";
+   std::uint64_t next_id_{};
+
+   static std::string escaped(const std::string & s) {
+      std::string r;
+      for(const auto ch : s) {
+         if('"' == ch || '\\' == ch)
+            r += '\\';
+         if(static_cast<unsigned char>(ch) < 0x20u)
+            r += fmt::format("\\u{:04x}", static_cast<unsigned>(ch));
+         else
+            r += ch;
+      }
+      return r;
+   }
+
+   static double us(std::uint64_t ns) noexcept {
+      return static_cast<double>(ns) / 1000.0;
+   }
+
+   // Starts the next event in the array.
+   std::ostream & next() {
+      to_ << separator_;
+      separator_ = ",\n";
+      return to_;
+   }
+
+public:
+   // Process IDs for tracks of workers and lanes.
+   static constexpr int workers_pid = 1;
+   static constexpr int lanes_pid = 2;
+
+   explicit chrome_trace_writer_t(std::ostream & to) : to_{to} {
+      to_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+      fmt::print(next(), R"({{"ph":"M","pid":{},"name":"process_name","args":{{"name":"workers"}}}})",
+            workers_pid);
+      fmt::print(next(), R"({{"ph":"M","pid":{},"name":"process_name","args":{{"name":"lanes"}}}})",
+            lanes_pid);
+   }
+
+   chrome_trace_writer_t(const chrome_trace_writer_t &) = delete;
+   chrome_trace_writer_t & operator=(const chrome_trace_writer_t &) = delete;
+
+   ~chrome_trace_writer_t() noexcept {
+      try {
+         to_ << "\n]}\n";
+      }
+      catch(...) {}
+   }
+
+   // The demangled name of the type (if it's possible).
+   static std::string type_name(const char * name) {
+      if(!name)
+         return "unknown";
+#if defined(DEMAND_TRACE_HAS_CXXABI)
+      int status = 0;
+      std::unique_ptr<char, void (*)(void *)> demangled{
+            abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free};
+      if(0 == status && demangled)
+         return demangled.get();
+#endif
+      return name;
+   }
+
+   void thread_name(int pid, unsigned tid, const std::string & name) {
+      fmt::print(next(), R"({{"ph":"M","pid":{},"tid":{},"name":"thread_name","args":{{"name":"{}"}}}})",
+            pid, tid, escaped(name));
+   }
+
+   void demand(
+         unsigned worker,
+         const std::string & lane,
+         const std::string & msg_type,
+         const demand_trace_event_t & e) {
+      fmt::print(next(), R"({{"ph":"X","pid":{},"tid":{},"ts":{:.3f},"dur":{:.3f},)"
+               R"("name":"{}","cat":"{}","args":{{"queued_us":{:.3f},)"
+               R"("dequeued_to_start_us":{:.3f}}}}})",
+            workers_pid, worker, us(e.started_ns_),
+            us(e.finished_ns_ - e.started_ns_),
+            escaped(msg_type), escaped(lane),
+            us(e.dequeued_ns_ - e.pushed_ns_),
+            us(e.started_ns_ - e.dequeued_ns_));
+
+      const auto id = next_id_++;
+      fmt::print(next(), R"({{"ph":"b","pid":{},"tid":{},"ts":{:.3f},"id":{},)"
+               R"("name":"{}","cat":"wait"}})",
+            lanes_pid, e.lane_, us(e.pushed_ns_), id, escaped(msg_type));
+      fmt::print(next(), R"({{"ph":"e","pid":{},"tid":{},"ts":{:.3f},"id":{},)"
+               R"("name":"{}","cat":"wait"}})",
+            lanes_pid, e.lane_, us(e.started_ns_), id, escaped(msg_type));
+   }
+};
+
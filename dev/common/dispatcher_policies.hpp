@@ -0,0 +1,197 @@
+#pragma once
+
+#include <common/spilling_mpmc_queue.hpp>
+#include <common/spin_wait.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+// Policies for generic_dispatcher_t (see generic_dispatcher.hpp).
+//
+// Queues, the wait strategy and the split of the pool are the same
+// for tricky_dispatcher_t, it uses these policies with the runtime
+// selection.
+
+//
+// Queue backends.
+//
+// A backend has a nested template queue_t<T> with:
+//
+//    explicit queue_t(std::size_t capacity);
+//    bool try_push(T && v); // Returns false if the queue is full.
+//    bool try_pop(T & v);   // Returns false if the queue is empty.
+//
+// Lanes are expected to be unbounded like mchains: push() throws if
+// try_push() fails, and the demand is lost. Both backends below never
+// fail, the capacity is just a hint.
+//
+
+// std::deque under a mutex. The capacity isn't limited.
+struct mutex_queue_backend_t {
+   template<typename T>
+   class queue_t {
+      std::mutex lock_;
+      std::deque<T> items_;
+
+   public:
+      explicit queue_t(std::size_t /*capacity*/) {}
+
+      bool try_push(T && v) {
+         std::lock_guard<std::mutex> lock{lock_};
+         items_.push_back(std::move(v));
+         return true;
+      }
+
+      bool try_pop(T & v) {
+         std::lock_guard<std::mutex> lock{lock_};
+         if(items_.empty())
+            return false;
+         v = std::move(items_.front());
+         items_.pop_front();
+         return true;
+      }
+   };
+};
+
+// The bounded lock-free MPMC queue with the spill list
+// (see spilling_mpmc_queue_t). The capacity is the size of the ring.
+struct lock_free_queue_backend_t {
+   template<typename T>
+   using queue_t = spilling_mpmc_queue_t<T>;
+};
+
+//
+// Routing of demands to lanes.
+//
+// A routing has:
+//
+//    static constexpr std::size_t lanes; // The count of lanes.
+//    static std::size_t lane_for(const std::type_index & msg_type) noexcept;
+//
+// Lanes with lower indexes have higher priority.
+//
+
+// A list of message types for a lane.
+template<typename... Msgs>
+struct lane_types_t {};
+
+// Lanes for the listed types go first (in the order of listing),
+// all other types go to the last lane.
+//
+// Types are compared one by one (the comparison is unrolled at
+// compile time), so lists are expected to be short.
+template<typename... Lanes>
+struct type_list_routing_t {
+   static constexpr std::size_t lanes = sizeof...(Lanes) + 1u;
+
+   static std::size_t lane_for(const std::type_index & msg_type) noexcept {
+      std::size_t lane = 0u;
+      const bool found = (... || (contains(Lanes{}, msg_type) || (++lane, false)));
+      return found ? lane : lanes - 1u;
+   }
+
+private:
+   template<typename... Msgs>
+   static bool contains(lane_types_t<Msgs...>, const std::type_index & msg_type) noexcept {
+      return (... || (std::type_index{typeid(Msgs)} == msg_type));
+   }
+};
+
+//
+// Wait strategies of idle threads.
+//
+// A strategy has a nested class waiter_t (an object for every thread)
+// with:
+//
+//    // Returns true if ready() returned true before parking.
+//    template<typename F> bool spin(F && ready);
+//    // Informs that the thread was parked after the last spin().
+//    void parked_until_now() noexcept;
+//
+
+// Threads are parked immediately.
+struct blocking_wait_t {
+   struct waiter_t {
+      template<typename F>
+      bool spin(F &&) noexcept { return false; }
+
+      void parked_until_now() noexcept {}
+   };
+};
+
+// Threads spin before parking (see adaptive_spin_wait_t),
+// no longer than Max_Spin_Us microseconds.
+template<unsigned Max_Spin_Us = 50u>
+struct spin_then_park_wait_t {
+   class waiter_t {
+      adaptive_spin_wait_t spinner_{ make_params() };
+
+      static adaptive_spin_wait_t::params_t make_params() noexcept {
+         adaptive_spin_wait_t::params_t params;
+         params.max_spin_ = std::chrono::microseconds{Max_Spin_Us};
+         params.min_spin_ = std::min(params.min_spin_, params.max_spin_);
+         return params;
+      }
+
+   public:
+      template<typename F>
+      bool spin(F && ready) { return spinner_.spin(std::forward<F>(ready)); }
+
+      void parked_until_now() noexcept { spinner_.parked_until_now(); }
+   };
+};
+
+//
+// Sizing of groups of threads.
+//
+// A pool policy has:
+//
+//    // The first lane for every thread, a thread serves lanes
+//    // [first_lane, lanes) in the order of priority.
+//    static std::vector<std::size_t> first_lanes(
+//          unsigned pool_size, std::size_t lanes);
+//
+// The thread with index 0 is the leader, it has to serve all lanes.
+//
+
+// All threads serve all lanes.
+struct shared_pool_t {
+   static std::vector<std::size_t> first_lanes(
+         unsigned pool_size, std::size_t /*lanes*/) {
+      return std::vector<std::size_t>(pool_size, 0u);
+   }
+};
+
+// The split of tricky_dispatcher_t: 3/4 of threads serve all lanes,
+// other threads don't serve the first lane (one thread of each type
+// for a pool of two threads).
+struct split_pool_t {
+   // Counts of threads of the first and the second type.
+   static std::pair<unsigned, unsigned> sizes(unsigned pool_size) noexcept {
+      if(2u == pool_size)
+         // Only two thread in the pool. Use one thread for each sub-pool.
+         return {1u, 1u};
+
+      // Threads of the first type will be 3/4 of the total count of threads.
+      const auto first_pool_size = (pool_size/4u)*3u;
+      return {first_pool_size, pool_size - first_pool_size};
+   }
+
+   static std::vector<std::size_t> first_lanes(
+         unsigned pool_size, std::size_t lanes) {
+      const auto first_type_count = sizes(pool_size).first;
+      std::vector<std::size_t> result(pool_size, 0u);
+      if(lanes > 1u)
+         std::fill(
+               result.begin() + std::max(first_type_count, 1u), result.end(),
+               std::size_t{1u});
+      return result;
+   }
+};
+
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// A simple eventcount for parking consumers of lock-free queues.
+//
+// A consumer has to call prepare_wait(), then re-check the queue,
+// then call either cancel_wait() (if something was found) or wait().
+// A producer has to call notify_one() after every push. The notification
+// is just an atomic load if there are no waiting consumers, so the
+// hot path doesn't touch the mutex at all.
+class event_count_t {
+   std::mutex lock_;
+   std::condition_variable wakeup_cv_;
+
+   std::atomic<unsigned> waiters_{0u};
+   std::atomic<std::uint64_t> epoch_{0u};
+
+   void advance_epoch() {
+      std::lock_guard<std::mutex> lock{lock_};
+      epoch_.fetch_add(1u, std::memory_order_relaxed);
+   }
+
+public:
+   using ticket_t = std::uint64_t;
+
+   event_count_t() = default;
+   event_count_t(const event_count_t &) = delete;
+   event_count_t & operator=(const event_count_t &) = delete;
+
+   [[nodiscard]]
+   ticket_t prepare_wait() noexcept {
+      waiters_.fetch_add(1u, std::memory_order_relaxed);
+      // The increment of waiters_ has to be visible before
+      // the re-check of the queue.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      return epoch_.load(std::memory_order_relaxed);
+   }
+
+   void cancel_wait() noexcept {
+      waiters_.fetch_sub(1u, std::memory_order_relaxed);
+   }
+
+   void wait(ticket_t ticket) {
+      {
+         std::unique_lock<std::mutex> lock{lock_};
+         wakeup_cv_.wait(lock, [&]{
+               return ticket != epoch_.load(std::memory_order_relaxed);
+            });
+      }
+      waiters_.fetch_sub(1u, std::memory_order_relaxed);
+   }
+
+   // The same as wait(), but no longer than timeout.
+   // Returns false if there was no notification during that time.
+   template<typename Rep, typename Period>
+   bool wait_for(ticket_t ticket, std::chrono::duration<Rep, Period> timeout) {
+      bool notified;
+      {
+         std::unique_lock<std::mutex> lock{lock_};
+         notified = wakeup_cv_.wait_for(lock, timeout, [&]{
+               return ticket != epoch_.load(std::memory_order_relaxed);
+            });
+      }
+      waiters_.fetch_sub(1u, std::memory_order_relaxed);
+      return notified;
+   }
+
+   // Returns true if there was a waiting consumer.
+   bool notify_one() {
+      // The push into the queue has to be visible before
+      // the check for waiters.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(!waiters_.load(std::memory_order_relaxed))
+         return false;
+
+      advance_epoch();
+      wakeup_cv_.notify_one();
+      return true;
+   }
+
+   void notify_all() {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      advance_epoch();
+      wakeup_cv_.notify_all();
+   }
+};
+
+// The result of park_until_work().
+enum class park_result_t {
+   // Work was found after the registration as a waiter.
+   work_found,
+   // Queues are closed, and there is no work.
+   closed,
+   // The thread was parked and then notified.
+   notified,
+   // The thread was parked, but there was no notification in time.
+   timed_out
+};
+
+// Parks the current thread by the protocol of event_count_t: the thread
+// is registered as a waiter, then try_pop() re-checks queues, and the
+// thread sleeps only if there is nothing to do and queues aren't closed.
+//
+// NOTE: closed() is called right after the registration. If queues are
+// closed before that then the thread sees it, otherwise the ticket
+// includes the notification from the closing, so the thread can't
+// sleep forever.
+//
+// A zero timeout means the wait without the timeout.
+template<typename Try_Pop, typename Closed>
+park_result_t park_until_work(
+      event_count_t & waiters,
+      Try_Pop && try_pop,
+      Closed && closed,
+      std::chrono::steady_clock::duration timeout =
+            std::chrono::steady_clock::duration::zero()) {
+   const auto ticket = waiters.prepare_wait();
+   const bool queues_closed = closed();
+   if(try_pop()) {
+      waiters.cancel_wait();
+      return park_result_t::work_found;
+   }
+   if(queues_closed) {
+      waiters.cancel_wait();
+      return park_result_t::closed;
+   }
+
+   if(timeout == std::chrono::steady_clock::duration::zero()) {
+      waiters.wait(ticket);
+      return park_result_t::notified;
+   }
+   return waiters.wait_for(ticket, timeout) ?
+         park_result_t::notified : park_result_t::timed_out;
+}
+
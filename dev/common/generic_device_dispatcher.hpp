@@ -0,0 +1,42 @@
+#pragma once
+
+#include <common/a_device_manager.hpp>
+#include <common/args.hpp>
+#include <common/generic_dispatcher.hpp>
+
+#include <so_5/all.hpp>
+
+// The generic dispatcher with lanes of tricky dispatcher: init/reinit
+// demands and all other demands.
+using device_routing_t = type_list_routing_t<
+      lane_types_t<
+            a_device_manager_t::init_device_t,
+            so_5::mutable_msg<a_device_manager_t::reinit_device_t>>>;
+
+template<typename Wait_Strategy>
+using generic_device_dispatcher_t = generic_dispatcher_t<
+      lock_free_queue_backend_t,
+      device_routing_t,
+      Wait_Strategy,
+      split_pool_t>;
+
+// Makes the generic dispatcher for a_device_manager_t.
+//
+// NOTE: the wait strategy is selected at compile time,
+// --max-spin-us isn't used.
+[[nodiscard]]
+inline so_5::disp_binder_shptr_t
+make_generic_device_dispatcher(
+      so_5::environment_t & env,
+      const args_t & args) {
+   if("spin-then-park" == args.wait_strategy_) {
+      using disp_t = generic_device_dispatcher_t<spin_then_park_wait_t<>>;
+      return disp_t::make(env, disp_t::params_t{
+            args.thread_pool_size_, args.lock_free_queue_capacity_});
+   }
+
+   using disp_t = generic_device_dispatcher_t<blocking_wait_t>;
+   return disp_t::make(env, disp_t::params_t{
+         args.thread_pool_size_, args.lock_free_queue_capacity_});
+}
+
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <common/dispatcher_policies.hpp>
+#include <common/event_count.hpp>
+#include <common/push_gate.hpp>
+#include <common/rundown_latch.hpp>
+
+#include <so_5/all.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A header-only dispatcher with the configuration at compile time.
+//
+// It's the core of tricky_dispatcher_t (lanes of demands, groups of
+// threads that serve lanes in the order of priority, parking of idle
+// threads) without the runtime configuration. Every part is specified
+// by a policy type:
+//
+// - a queue backend (mutex_queue_backend_t or lock_free_queue_backend_t);
+// - a routing of message types to lanes (type_list_routing_t);
+// - a wait strategy of idle threads (blocking_wait_t or spin_then_park_wait_t);
+// - a sizing of groups of threads (split_pool_t or shared_pool_t).
+//
+// Policies are in dispatcher_policies.hpp. tricky_dispatcher_t uses
+// the same queues, parking and split, so both dispatchers behave
+// the same way for the same configuration.
+//
+// So push and pop paths of a configuration are inlined and have no
+// virtual calls and no checks of the configuration.
+//
+// Usage:
+//
+//    using my_dispatcher_t = generic_dispatcher_t<
+//          lock_free_queue_backend_t,
+//          type_list_routing_t<lane_types_t<init_t, reinit_t>>,
+//          spin_then_park_wait_t<50>,
+//          split_pool_t>;
+//
+//    auto disp = my_dispatcher_t::make(env, my_dispatcher_t::params_t{8});
+//
+// NOTE: it doesn't have metrics, timers, elastic pools and other
+// runtime features of tricky_dispatcher_t.
+
+// The dispatcher itself.
+template<
+   typename Queue_Backend,
+   typename Routing,
+   typename Wait_Strategy,
+   typename Pool_Sizing>
+class generic_dispatcher_t final
+      : public so_5::disp_binder_t
+      , public so_5::event_queue_t {
+public:
+   static constexpr std::size_t lanes = Routing::lanes;
+   static_assert(lanes > 0u, "there has to be at least one lane");
+
+   static constexpr std::size_t default_queue_capacity = 1u << 16;
+
+   struct params_t {
+      // The count of threads.
+      unsigned pool_size_;
+      // The capacity of the queue of every lane (for bounded queues).
+      std::size_t queue_capacity_{ default_queue_capacity };
+   };
+
+private:
+   using queue_t =
+         typename Queue_Backend::template queue_t<so_5::execution_demand_t>;
+   using waiter_t = typename Wait_Strategy::waiter_t;
+
+   // Threads with the same first lane.
+   struct group_t {
+      const std::size_t first_lane_;
+      // Idle threads of the group wait here.
+      event_count_t waiters_;
+
+      explicit group_t(std::size_t first_lane) : first_lane_{first_lane} {}
+   };
+
+   struct worker_t {
+      group_t & group_;
+      waiter_t waiter_;
+
+      explicit worker_t(group_t & group) : group_{group} {}
+   };
+
+   // The channel for evt_start and evt_finish.
+   so_5::mchain_t start_finish_ch_;
+
+   // Lanes, groups (with dedicated groups first) and workers.
+   std::vector<std::unique_ptr<queue_t>> lanes_;
+   std::vector<std::unique_ptr<group_t>> groups_;
+   std::vector<std::unique_ptr<worker_t>> workers_;
+
+   // Producers pass this gate. The leader waits for pushes that started
+   // before the closing of lanes, otherwise a demand can land in a lane
+   // after all workers have finished.
+   push_gate_t push_gate_;
+
+   std::vector<std::thread> work_threads_;
+
+   // Synchronization objects for starting and finishing
+   // (see tricky_dispatcher_t for details).
+   rundown_latch_t launch_room_;
+   rundown_latch_t start_room_;
+   rundown_latch_t finish_room_;
+
+   static void exec_demand_handler(so_5::execution_demand_t d) {
+      d.call_handler(so_5::null_current_thread_id());
+   }
+
+   void make_lanes_and_workers(const params_t & params) {
+      if(params.pool_size_ < 1u)
+         throw std::invalid_argument{"generic_dispatcher: empty pool"};
+
+      for(std::size_t l = 0u; l != lanes; ++l)
+         lanes_.push_back(std::make_unique<queue_t>(params.queue_capacity_));
+
+      const auto first_lanes = Pool_Sizing::first_lanes(params.pool_size_, lanes);
+      if(first_lanes.size() != params.pool_size_ || 0u != first_lanes.front())
+         throw std::invalid_argument{
+               "generic_dispatcher: the leader has to serve all lanes"};
+
+      // Groups that serve fewer lanes go first, so a push wakes up
+      // a dedicated thread if it's possible.
+      auto distinct = first_lanes;
+      std::sort(distinct.begin(), distinct.end(), std::greater<>{});
+      distinct.erase(std::unique(distinct.begin(), distinct.end()),
+            distinct.end());
+      for(const auto first_lane : distinct) {
+         if(first_lane >= lanes)
+            throw std::invalid_argument{
+                  "generic_dispatcher: invalid first lane: "
+                  + std::to_string(first_lane)};
+         groups_.push_back(std::make_unique<group_t>(first_lane));
+      }
+
+      for(const auto first_lane : first_lanes) {
+         const auto it = std::find_if(groups_.begin(), groups_.end(),
+               [first_lane](const auto & g) {
+                  return first_lane == g->first_lane_;
+               });
+         workers_.push_back(std::make_unique<worker_t>(**it));
+      }
+   }
+
+   // Extracts one demand from lanes of the group (in the order of
+   // priority). Returns false if all that lanes are empty.
+   bool try_pop_one(const group_t & group, so_5::execution_demand_t & demand) {
+      for(auto l = group.first_lane_; l != lanes; ++l)
+         if(lanes_[l]->try_pop(demand))
+            return true;
+
+      return false;
+   }
+
+   // Handling of demands by a worker until the closing of lanes.
+   void serve_demands(worker_t & w) {
+      auto & group = w.group_;
+      so_5::execution_demand_t demand;
+      for(;;) {
+         if(try_pop_one(group, demand)) {
+            exec_demand_handler(std::move(demand));
+            continue;
+         }
+
+         // NOTE: the demand is handled after spin(), otherwise the time
+         // of the handling is counted as the idle time by the waiter.
+         if(w.waiter_.spin([&]{ return try_pop_one(group, demand); })) {
+            exec_demand_handler(std::move(demand));
+            continue;
+         }
+
+         switch(park_until_work(group.waiters_,
+               [&]{ return try_pop_one(group, demand); },
+               [this]{ return !push_gate_.is_open(); })) {
+         case park_result_t::work_found:
+            exec_demand_handler(std::move(demand));
+         break;
+
+         case park_result_t::closed:
+            // All lanes of the group are empty, and new demands are ignored.
+         return;
+
+         case park_result_t::notified:
+         case park_result_t::timed_out:
+            w.waiter_.parked_until_now();
+         break;
+         }
+      }
+   }
+
+   // Disables the push of demands and wakes up all threads.
+   void close_lanes() noexcept {
+      push_gate_.close();
+      for(auto & g : groups_)
+         g->waiters_.notify_all();
+   }
+
+   void leader_thread_body() {
+      // We have to wait while all workers are created.
+      launch_room_.wait_then_close();
+
+      {
+         // We have to block all other threads until evt_start will be processed.
+         auto_acquire_release_rundown_latch_t start_room_changer{start_room_};
+         so_5::receive(so_5::from(start_finish_ch_).handle_n(1),
+               exec_demand_handler);
+      }
+
+      serve_demands(*workers_[0u]);
+
+      // All worker should finish their work before processing of evt_finish.
+      finish_room_.wait_then_close();
+
+      // Demands pushed during the closing of lanes can land after
+      // all workers have seen lanes empty. So pushes in progress are
+      // finished and remaining demands are handled here.
+      push_gate_.wait_for_producers();
+      for(auto & lane : lanes_) {
+         so_5::execution_demand_t demand;
+         while(lane->try_pop(demand))
+            exec_demand_handler(std::move(demand));
+      }
+
+      so_5::receive(so_5::from(start_finish_ch_).handle_n(1),
+            exec_demand_handler);
+   }
+
+   void worker_thread_body(std::size_t worker_index) {
+      // Processing of evt_finish has to be enabled at the end.
+      auto_acquire_release_rundown_latch_t finish_room_changer{finish_room_};
+
+      // Wait while evt_start is processed.
+      start_room_.wait_then_close();
+
+      serve_demands(*workers_[worker_index]);
+   }
+
+   void launch_work_threads() {
+      work_threads_.resize(workers_.size());
+      try {
+         // The leader has to be suspended until all workers will be created.
+         auto_acquire_release_rundown_latch_t launch_room_changer{launch_room_};
+
+         work_threads_[0u] = std::thread{[this]{ leader_thread_body(); }};
+         for(std::size_t i = 1u; i < workers_.size(); ++i)
+            work_threads_[i] = std::thread{[this, i]{ worker_thread_body(i); }};
+      }
+      catch(...) {
+         shutdown_work_threads();
+         throw;
+      }
+   }
+
+   void shutdown_work_threads() noexcept {
+      so_5::close_drop_content(so_5::terminate_if_throws, start_finish_ch_);
+      close_lanes();
+
+      for(auto & t : work_threads_)
+         if(t.joinable())
+            t.join();
+
+      work_threads_.clear();
+   }
+
+   // Implementation of the methods inherited from disp_binder.
+   void preallocate_resources(so_5::agent_t & /*agent*/) override {
+      // Nothing to do.
+   }
+
+   void undo_preallocation(so_5::agent_t & /*agent*/) noexcept override {
+      // Nothing to do.
+   }
+
+   void bind(so_5::agent_t & agent) noexcept override {
+      agent.so_bind_to_dispatcher(*this);
+   }
+
+   void unbind(so_5::agent_t & /*agent*/) noexcept override {
+      // Nothing to do.
+   }
+
+   // Implementation of the methods inherited from event_queue.
+   void push(so_5::execution_demand_t demand) override {
+      const auto lane = Routing::lane_for(demand.m_msg_type);
+      {
+         // Demands are ignored after the closing, like mchains do it.
+         push_gate_t::pass_t pass{push_gate_};
+         if(!pass)
+            return;
+         if(!lanes_[lane]->try_push(std::move(demand)))
+            throw std::runtime_error{"generic_dispatcher: queue is full"};
+      }
+
+      for(auto & g : groups_)
+         if(g->first_lane_ <= lane && g->waiters_.notify_one())
+            break;
+   }
+
+   void push_evt_start(so_5::execution_demand_t demand) override {
+      so_5::send<so_5::execution_demand_t>(start_finish_ch_, std::move(demand));
+   }
+
+   // NOTE: don't care about exception, if the demand can't be stored
+   // into the queue the application has to be aborted anyway.
+   void push_evt_finish(so_5::execution_demand_t demand) noexcept override {
+      // Remaining demands are handled, new ones are ignored.
+      close_lanes();
+
+      so_5::send<so_5::execution_demand_t>(start_finish_ch_, std::move(demand));
+   }
+
+public:
+   generic_dispatcher_t(so_5::environment_t & env, const params_t & params)
+      :  start_finish_ch_{
+            so_5::create_mchain(env,
+                  2u, // Just evt_start and evt_finish.
+                  so_5::mchain_props::memory_usage_t::preallocated,
+                  so_5::mchain_props::overflow_reaction_t::abort_app)
+         }
+   {
+      make_lanes_and_workers(params);
+      launch_work_threads();
+   }
+
+   ~generic_dispatcher_t() noexcept override {
+      shutdown_work_threads();
+   }
+
+   [[nodiscard]]
+   static so_5::disp_binder_shptr_t make(
+         so_5::environment_t & env, const params_t & params) {
+      return std::make_shared<generic_dispatcher_t>(env, params);
+   }
+};
+
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A fixed-size histogram with log-linear buckets, like HdrHistogram.
+//
+// Every power of two is split into 2^sub_bucket_bits linear sub-buckets,
+// so the relative error of any reported value is less than
+// 1/2^sub_bucket_bits (about 3%). Values greater than max_value are
+// counted as max_value.
+//
+// Recording is O(1) and never allocates. Histograms with the same layout
+// can be merged, so per-thread histograms can be combined into one.
+//
+// Counter has to be std::uint64_t or std::atomic<std::uint64_t>.
+// The atomic version allows only one writer, but readers can work
+// concurrently with it (counters are updated without RMW-operations).
+template<typename Counter>
+class basic_log_linear_histogram_t {
+   template<typename> friend class basic_log_linear_histogram_t;
+
+public:
+   // 32 sub-buckets for every power of two.
+   static constexpr unsigned sub_bucket_bits = 5u;
+   static constexpr std::uint64_t sub_bucket_count =
+         std::uint64_t{1u} << sub_bucket_bits;
+   // Values up to 2^40 (about 18 minutes for values in nanoseconds).
+   static constexpr unsigned max_value_bits = 40u;
+   static constexpr std::uint64_t max_value =
+         (std::uint64_t{1u} << max_value_bits) - 1u;
+
+   static constexpr std::size_t bucket_count =
+         (max_value_bits - sub_bucket_bits + 1u) * sub_bucket_count;
+
+private:
+   std::array<Counter, bucket_count> counts_{};
+   Counter total_count_{};
+   Counter max_{};
+
+   static std::uint64_t load(const std::uint64_t & c) noexcept { return c; }
+   static std::uint64_t load(const std::atomic<std::uint64_t> & c) noexcept {
+      return c.load(std::memory_order_relaxed);
+   }
+
+   static void store(std::uint64_t & c, std::uint64_t v) noexcept { c = v; }
+   static void store(std::atomic<std::uint64_t> & c, std::uint64_t v) noexcept {
+      c.store(v, std::memory_order_relaxed);
+   }
+
+   // The count of significant bits in v.
+   static unsigned bit_width(std::uint64_t v) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+      return v ? 64u - static_cast<unsigned>(__builtin_clzll(v)) : 0u;
+#else
+      unsigned bits = 0u;
+      for(; v; v >>= 1u)
+         ++bits;
+      return bits;
+#endif
+   }
+
+   static std::size_t index_of(std::uint64_t v) noexcept {
+      const unsigned bits = bit_width(v >> sub_bucket_bits);
+      // Values less than 2*sub_bucket_count are stored as is.
+      const unsigned shift = bits ? bits - 1u : 0u;
+      return static_cast<std::size_t>(
+            shift * sub_bucket_count + (v >> shift));
+   }
+
+   // The greatest value that is counted in the bucket.
+   static std::uint64_t highest_value_of(std::size_t index) noexcept {
+      if(index < 2u * sub_bucket_count)
+         return index;
+
+      const auto shift = index / sub_bucket_count - 1u;
+      const auto sub = index - shift * sub_bucket_count;
+      return ((sub + 1u) << shift) - 1u;
+   }
+
+public:
+   // NOTE: it's not thread-safe, only one thread can call it.
+   void record(std::uint64_t v) noexcept {
+      v = std::min(v, max_value);
+      auto & c = counts_[index_of(v)];
+      store(c, load(c) + 1u);
+      store(total_count_, load(total_count_) + 1u);
+      if(v > load(max_))
+         store(max_, v);
+   }
+
+   template<typename Other_Counter>
+   void merge(const basic_log_linear_histogram_t<Other_Counter> & other) noexcept {
+      for(std::size_t i = 0u; i != bucket_count; ++i)
+         store(counts_[i], load(counts_[i]) + load(other.counts_[i]));
+      store(total_count_, load(total_count_) + load(other.total_count_));
+      store(max_, std::max(load(max_), load(other.max_)));
+   }
+
+   // NOTE: it's not thread-safe.
+   void reset() noexcept {
+      for(auto & c : counts_)
+         store(c, 0u);
+      store(total_count_, 0u);
+      store(max_, 0u);
+   }
+
+   std::uint64_t count() const noexcept { return load(total_count_); }
+
+   std::uint64_t max() const noexcept { return load(max_); }
+
+   // Get the value for the percentile p (0.0..100.0).
+   // Returns 0 if there are no values.
+   std::uint64_t percentile(double p) const noexcept {
+      const auto total = count();
+      if(!total)
+         return 0u;
+
+      const auto rank = std::max<std::uint64_t>(1u,
+            static_cast<std::uint64_t>(
+                  std::min(p, 100.0) / 100.0 * static_cast<double>(total) + 0.5));
+      std::uint64_t seen = 0u;
+      for(std::size_t i = 0u; i != bucket_count; ++i) {
+         seen += load(counts_[i]);
+         if(seen >= rank)
+            return std::min(highest_value_of(i), max());
+      }
+
+      return max();
+   }
+};
+
+// Histogram for use from one thread.
+using log_linear_histogram_t = basic_log_linear_histogram_t<std::uint64_t>;
+
+// Histogram with one writer and concurrent readers.
+using concurrent_log_linear_histogram_t =
+      basic_log_linear_histogram_t<std::atomic<std::uint64_t>>;
+
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <common/args.hpp>
+#include <common/log_linear_histogram.hpp>
+
+#include <fmt/format.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+   #include <arpa/inet.h>
+   #include <netinet/in.h>
+   #include <poll.h>
+   #include <sys/socket.h>
+   #include <sys/un.h>
+   #include <unistd.h>
+#endif
+
+// Helper for making metrics in the Prometheus text format.
+//
+// Usage:
+//
+//    prometheus_text_t t;
+//    t.family("lane_depth", "gauge", "Count of demands in the lane");
+//    t.sample("lane_depth", {{"lane", "init"}}, 42u);
+//    exporter.publish("dispatcher", t.release());
+class prometheus_text_t {
+   std::string text_;
+
+   void append_escaped(const std::string & v) {
+      for(const auto ch : v) {
+         if('\\' == ch || '"' == ch)
+            text_ += '\\';
+         if('\n' == ch)
+            text_ += "\\n";
+         else
+            text_ += ch;
+      }
+   }
+
+public:
+   using labels_t = std::initializer_list<std::pair<const char *, std::string>>;
+
+   // Starts a family of samples.
+   prometheus_text_t & family(
+         const char * name,
+         const char * type,
+         const char * help) {
+      text_ += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+      return *this;
+   }
+
+   template<typename V>
+   prometheus_text_t & sample(const char * name, labels_t labels, V value) {
+      text_ += name;
+      if(labels.size()) {
+         const char * separator = "{";
+         for(const auto & [label, v] : labels) {
+            text_ += separator;
+            text_ += label;
+            text_ += "=\"";
+            append_escaped(v);
+            text_ += '"';
+            separator = ",";
+         }
+         text_ += '}';
+      }
+      text_ += fmt::format(" {}\n", value);
+      return *this;
+   }
+
+   // Samples of a summary without the family header: quantiles of the
+   // histogram and the count of values. Values are multiplied by scale
+   // (e.g. 1e-6 for microseconds to seconds).
+   // NOTE: there is no _sum because histograms don't keep it.
+   prometheus_text_t & summary_samples(
+         const char * name,
+         const std::string & label,
+         const std::string & label_value,
+         const log_linear_histogram_t & h,
+         double scale) {
+      for(const auto q : {0.5, 0.9, 0.99, 0.999})
+         sample(name,
+               {{label.c_str(), label_value}, {"quantile", fmt::format("{}", q)}},
+               static_cast<double>(h.percentile(q * 100.0)) * scale);
+      sample(fmt::format("{}_count", name).c_str(),
+            {{label.c_str(), label_value}}, h.count());
+      return *this;
+   }
+
+   std::string release() noexcept { return std::move(text_); }
+};
+
+// An HTTP endpoint for scraping of metrics in the Prometheus text format.
+//
+// Producers publish ready texts of their sections (e.g. on their timers),
+// and a scrape just concatenates the last published texts. So a scrape
+// never touches the data of producers, and the cost of a scrape doesn't
+// depend on the frequency of scrapes.
+//
+// The endpoint listens on 127.0.0.1:port or on a Unix domain socket.
+// Requests are served one at a time by the own thread of the exporter.
+//
+// NOTE: it's supported on Unix-like platforms only.
+class metrics_exporter_t {
+   struct section_t {
+      std::string name_;
+      std::shared_ptr<const std::string> text_;
+   };
+
+   // Sections in the order of their first publication.
+   mutable std::mutex lock_;
+   std::vector<section_t> sections_;
+
+   std::atomic<std::uint64_t> scrapes_{0u};
+
+   int listen_fd_{ -1 };
+   std::string unix_path_;
+   std::atomic<bool> stopped_{false};
+   std::thread server_thread_;
+
+#if defined(__unix__) || defined(__APPLE__)
+   [[noreturn]]
+   void fail(const std::string & what) {
+      const auto error = std::string{std::strerror(errno)};
+      if(listen_fd_ >= 0)
+         ::close(listen_fd_);
+      throw std::runtime_error{
+            "metrics_exporter: " + what + ": " + error};
+   }
+
+   // Listens on "unix:PATH" or on the port of 127.0.0.1.
+   void listen_on(const std::string & address) {
+      static const std::string unix_prefix{"unix:"};
+      if(0u == address.compare(0u, unix_prefix.size(), unix_prefix)) {
+         unix_path_ = address.substr(unix_prefix.size());
+         sockaddr_un addr{};
+         if(unix_path_.empty() || unix_path_.size() >= sizeof(addr.sun_path))
+            throw std::invalid_argument{
+                  "metrics_exporter: invalid socket path: " + unix_path_};
+         addr.sun_family = AF_UNIX;
+         std::memcpy(addr.sun_path, unix_path_.c_str(), unix_path_.size());
+
+         listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+         if(listen_fd_ < 0)
+            fail("socket");
+         // A socket file of the previous run is removed.
+         ::unlink(unix_path_.c_str());
+         if(0 != ::bind(listen_fd_,
+               reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)))
+            fail("bind to " + unix_path_);
+      }
+      else {
+         if(address.empty() ||
+               std::string::npos != address.find_first_not_of("0123456789") ||
+               std::stoul(address) > 65535u)
+            throw std::invalid_argument{
+                  "metrics_exporter: invalid port: " + address};
+
+         sockaddr_in addr{};
+         addr.sin_family = AF_INET;
+         addr.sin_port = htons(static_cast<std::uint16_t>(std::stoul(address)));
+         addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+         listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+         if(listen_fd_ < 0)
+            fail("socket");
+         const int on = 1;
+         ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+         if(0 != ::bind(listen_fd_,
+               reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)))
+            fail("bind to port " + address);
+      }
+
+      if(0 != ::listen(listen_fd_, 16))
+         fail("listen");
+   }
+
+   using deadline_t = std::chrono::steady_clock::time_point;
+
+   // Waits until the socket is ready for events.
+   // Returns false if the deadline is reached.
+   static bool wait_for(int fd, short events, deadline_t deadline) noexcept {
+      for(;;) {
+         const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+               deadline - std::chrono::steady_clock::now()).count();
+         if(left <= 0)
+            return false;
+
+         pollfd pfd{fd, events, 0};
+         const auto r = ::poll(&pfd, 1, static_cast<int>(left));
+         if(r > 0)
+            return true;
+         if(r < 0 && EINTR != errno)
+            return false;
+      }
+   }
+
+   static void send_all(
+         int fd,
+         const std::string & data,
+         deadline_t deadline) noexcept {
+#if defined(MSG_NOSIGNAL)
+      constexpr int flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+#else
+      constexpr int flags = MSG_DONTWAIT;
+#endif
+      for(std::size_t sent = 0u; sent < data.size(); ) {
+         if(!wait_for(fd, POLLOUT, deadline))
+            return;
+         const auto r = ::send(fd, data.data() + sent, data.size() - sent, flags);
+         if(r < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+            continue;
+         if(r <= 0)
+            return;
+         sent += static_cast<std::size_t>(r);
+      }
+   }
+
+   void serve_connection(int fd) {
+      // A slow client can't stop the exporter for long: the whole
+      // connection (reading the request and sending the response) is
+      // limited by the deadline, so the destructor doesn't wait for
+      // a client that doesn't read.
+      const auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::seconds{1};
+
+      std::string request;
+      char buf[1024];
+      while(std::string::npos == request.find("\r\n\r\n") &&
+            request.size() < 8192u) {
+         if(!wait_for(fd, POLLIN, deadline))
+            break;
+         const auto r = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+         if(r < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+            continue;
+         if(r <= 0)
+            break;
+         request.append(buf, static_cast<std::size_t>(r));
+      }
+
+      const bool found = 0u == request.compare(0u, 13u, "GET /metrics ") ||
+            0u == request.compare(0u, 6u, "GET / ");
+      const auto body = found ? text() : std::string{"not found\n"};
+      send_all(fd, fmt::format(
+            "HTTP/1.1 {}\r\n"
+            "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+            "Content-Length: {}\r\n"
+            "Connection: close\r\n\r\n",
+            found ? "200 OK" : "404 Not Found",
+            body.size()) + body, deadline);
+      if(found)
+         scrapes_.fetch_add(1u, std::memory_order_relaxed);
+   }
+
+   void server_thread_body() noexcept {
+      while(!stopped_.load(std::memory_order_acquire)) {
+         // The timeout is necessary for the check of stopped_.
+         pollfd pfd{listen_fd_, POLLIN, 0};
+         if(::poll(&pfd, 1, 200) <= 0)
+            continue;
+
+         const int fd = ::accept(listen_fd_, nullptr, nullptr);
+         if(fd < 0)
+            continue;
+         try {
+            serve_connection(fd);
+         }
+         catch(const std::exception &) {
+            // The scrape is lost, but the exporter continues to work.
+         }
+         ::close(fd);
+      }
+   }
+#endif
+
+public:
+   // The address is a port of 127.0.0.1 (like "9464") or a path of
+   // a Unix domain socket (like "unix:/tmp/so5_metrics.sock").
+   explicit metrics_exporter_t(const std::string & address) {
+#if defined(__unix__) || defined(__APPLE__)
+      listen_on(address);
+      server_thread_ = std::thread{[this]{ server_thread_body(); }};
+#else
+      throw std::runtime_error{
+            "metrics_exporter: isn't supported on that platform, address: "
+            + address};
+#endif
+   }
+
+   metrics_exporter_t(const metrics_exporter_t &) = delete;
+   metrics_exporter_t & operator=(const metrics_exporter_t &) = delete;
+
+   ~metrics_exporter_t() noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+      stopped_.store(true, std::memory_order_release);
+      server_thread_.join();
+      ::close(listen_fd_);
+      if(!unix_path_.empty())
+         ::unlink(unix_path_.c_str());
+#endif
+   }
+
+   // Replaces the text of the section. It has to be a sequence of
+   // families in the Prometheus text format (see prometheus_text_t).
+   void publish(const std::string & section, std::string text) {
+      auto ptr = std::make_shared<const std::string>(std::move(text));
+
+      std::lock_guard<std::mutex> lock{lock_};
+      for(auto & s : sections_)
+         if(s.name_ == section) {
+            s.text_.swap(ptr);
+            return;
+         }
+      sections_.push_back(section_t{section, std::move(ptr)});
+   }
+
+   // The current text of all sections.
+   std::string text() const {
+      std::vector<std::shared_ptr<const std::string>> texts;
+      {
+         std::lock_guard<std::mutex> lock{lock_};
+         for(const auto & s : sections_)
+            texts.push_back(s.text_);
+      }
+
+      std::string result;
+      for(const auto & t : texts)
+         result += *t;
+      return result;
+   }
+
+   std::uint64_t scrapes() const noexcept {
+      return scrapes_.load(std::memory_order_relaxed);
+   }
+};
+
+using metrics_exporter_shptr_t = std::shared_ptr<metrics_exporter_t>;
+
+// Helper function for making the exporter from the command line args.
+// Returns nullptr if the exporter isn't enabled.
+inline metrics_exporter_shptr_t make_metrics_exporter(const args_t & args) {
+   if(args.metrics_listen_.empty())
+      return {};
+   return std::make_shared<metrics_exporter_t>(args.metrics_listen_);
+}
+
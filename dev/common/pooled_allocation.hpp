@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// A thread-safe pool of memory blocks of the same size.
+//
+// Blocks are taken from the system by chunks and are never returned
+// to the system. Free blocks are kept in an intrusive list, and they
+// are taken and returned by batches, so the lock is taken once per batch.
+class block_pool_t {
+   struct free_block_t {
+      free_block_t * next_;
+   };
+
+public:
+   // A list of free blocks.
+   class block_list_t {
+      friend class block_pool_t;
+
+      free_block_t * head_{};
+      std::size_t size_{};
+
+   public:
+      void push(void * p) noexcept {
+         auto * b = static_cast<free_block_t *>(p);
+         b->next_ = head_;
+         head_ = b;
+         ++size_;
+      }
+
+      // NOTE: the list must not be empty.
+      void * pop() noexcept {
+         auto * b = head_;
+         head_ = b->next_;
+         --size_;
+         return b;
+      }
+
+      std::size_t size() const noexcept { return size_; }
+   };
+
+   // Counters of the pool.
+   struct stats_t {
+      // The size of a block.
+      std::size_t block_size_;
+      // The count of chunks taken from the system.
+      std::uint64_t chunks_;
+      // The count of blocks in all chunks.
+      std::uint64_t blocks_;
+   };
+
+private:
+   static constexpr std::size_t blocks_per_chunk = 1024u;
+
+   const std::size_t block_size_;
+
+   mutable std::mutex lock_;
+   block_list_t free_blocks_;
+   std::vector<std::unique_ptr<std::byte[]>> chunks_;
+
+   void allocate_chunk() {
+      chunks_.emplace_back(new std::byte[block_size_ * blocks_per_chunk]);
+      auto * chunk = chunks_.back().get();
+      for(std::size_t i = 0u; i != blocks_per_chunk; ++i)
+         free_blocks_.push(chunk + i * block_size_);
+   }
+
+public:
+   explicit block_pool_t(std::size_t block_size)
+      :  block_size_{
+            // Every block has to be suitable for any object and
+            // for free_block_t.
+            (std::max(block_size, sizeof(free_block_t)) +
+                  alignof(std::max_align_t) - 1u) /
+                  alignof(std::max_align_t) * alignof(std::max_align_t)}
+   {}
+
+   block_pool_t(const block_pool_t &) = delete;
+   block_pool_t & operator=(const block_pool_t &) = delete;
+
+   // Moves count blocks to the list.
+   // A new chunk is taken from the system if there are no free blocks.
+   void take(block_list_t & to, std::size_t count) {
+      std::lock_guard<std::mutex> lock{lock_};
+      for(; count; --count) {
+         if(!free_blocks_.size())
+            allocate_chunk();
+         to.push(free_blocks_.pop());
+      }
+   }
+
+   // Moves count blocks from the list back to the pool.
+   void give_back(block_list_t & from, std::size_t count) noexcept {
+      std::lock_guard<std::mutex> lock{lock_};
+      for(count = std::min(count, from.size()); count; --count)
+         free_blocks_.push(from.pop());
+   }
+
+   stats_t stats() const {
+      std::lock_guard<std::mutex> lock{lock_};
+      return stats_t{
+            block_size_,
+            chunks_.size(),
+            static_cast<std::uint64_t>(chunks_.size()) * blocks_per_chunk };
+   }
+};
+
+// The global switch for pooled_allocation_t.
+//
+// NOTE: it has to be changed before the first allocation of pooled
+// objects and mustn't be changed after that, because the memory of an
+// object is released the same way it was allocated.
+inline std::atomic<bool> & pooled_allocation_enabled() noexcept {
+   static std::atomic<bool> enabled{false};
+   return enabled;
+}
+
+// A base class that provides operator new/delete for objects of type T
+// from a pool of blocks (if pooled_allocation_enabled() is true).
+//
+// Every thread has own cache of free blocks, so usually allocation and
+// deallocation don't take any lock. An object can be deleted by another
+// thread, its block goes to the cache of that thread.
+//
+// Usage:
+//
+//    struct device_t final : public pooled_allocation_t<device_t> {...};
+//
+// NOTE: T should be final, objects of derived types are allocated
+// by the ordinary operator new.
+template<typename T>
+class pooled_allocation_t {
+   // The count of blocks to be moved between the pool and a thread cache.
+   static constexpr std::size_t batch_size = 64u;
+
+   struct thread_cache_t {
+      block_pool_t::block_list_t blocks_;
+
+      ~thread_cache_t() {
+         pool().give_back(blocks_, blocks_.size());
+      }
+   };
+
+   static bool uses_pool(std::size_t size) noexcept {
+      return sizeof(T) == size &&
+            pooled_allocation_enabled().load(std::memory_order_relaxed);
+   }
+
+   static thread_cache_t & cache() noexcept {
+      static thread_local thread_cache_t instance;
+      return instance;
+   }
+
+public:
+   // The pool for objects of type T.
+   // NOTE: it's never destroyed because thread caches can be destroyed
+   // after the end of main().
+   static block_pool_t & pool() {
+      static block_pool_t * instance = new block_pool_t{sizeof(T)};
+      return *instance;
+   }
+
+   static void * operator new(std::size_t size) {
+      if(!uses_pool(size))
+         return ::operator new(size);
+
+      auto & blocks = cache().blocks_;
+      if(!blocks.size())
+         pool().take(blocks, batch_size);
+      return blocks.pop();
+   }
+
+   static void operator delete(void * p, std::size_t size) noexcept {
+      if(!uses_pool(size)) {
+         ::operator delete(p);
+         return;
+      }
+
+      auto & blocks = cache().blocks_;
+      blocks.push(p);
+      // Blocks freed by a consumer thread have to become available
+      // for producer threads.
+      if(blocks.size() >= 2u * batch_size)
+         pool().give_back(blocks, batch_size);
+   }
+};
+
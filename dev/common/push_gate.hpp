@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+// A gate for producers of a dispatcher that has to be closed at the
+// shutdown without losing demands.
+//
+// A producer enters the gate before the push and leaves it after the push.
+// After close() the closer waits until all producers that entered the
+// gate before the closing leave it, then it can take the remaining
+// demands from queues. So there is no demand that is pushed after the
+// last check of queues.
+//
+// The count of active producers is sharded: every thread uses its own
+// shard (shards are assigned to threads in round-robin fashion), so
+// producers don't contend on a single cache line.
+class push_gate_t {
+   // Size of cache line for separation of shards.
+   static constexpr std::size_t cache_line_size = 64u;
+
+   struct alignas(cache_line_size) shard_t {
+      std::atomic<std::size_t> active_{0u};
+   };
+
+   // The count of shards is always a power of two.
+   const std::size_t mask_;
+   const std::unique_ptr<shard_t[]> shards_;
+
+   std::atomic<bool> open_{true};
+
+   static std::size_t round_up_shards(std::size_t shards) noexcept {
+      std::size_t r = 1u;
+      while(r < shards)
+         r <<= 1u;
+      return r;
+   }
+
+   // The index of the shard of the current thread.
+   static std::size_t this_thread_index() noexcept {
+      static std::atomic<std::size_t> next_index{0u};
+      thread_local const std::size_t index =
+            next_index.fetch_add(1u, std::memory_order_relaxed);
+      return index;
+   }
+
+public:
+   // Default count of shards is twice the count of CPUs.
+   push_gate_t()
+      :  push_gate_t{2u * std::thread::hardware_concurrency()}
+   {}
+
+   explicit push_gate_t(std::size_t shards)
+      :  mask_{round_up_shards(shards) - 1u}
+      ,  shards_{new shard_t[mask_ + 1u]}
+   {}
+
+   push_gate_t(const push_gate_t &) = delete;
+   push_gate_t & operator=(const push_gate_t &) = delete;
+
+   // A pass of a producer through the gate (like std::lock_guard).
+   //
+   // Usage:
+   //
+   //    push_gate_t::pass_t pass{gate};
+   //    if(!pass)
+   //       return; // The gate is closed.
+   //    ... // Push the demand.
+   class pass_t {
+      shard_t * shard_;
+
+   public:
+      explicit pass_t(push_gate_t & gate) noexcept
+         :  shard_{&gate.shards_[this_thread_index() & gate.mask_]} {
+         // The producer is registered before the check of the state
+         // (both are seq_cst), and close() stores the state before
+         // the check of producers. So either the producer sees the closed
+         // gate or the closer waits for that producer.
+         shard_->active_.fetch_add(1u);
+         if(!gate.open_.load()) {
+            shard_->active_.fetch_sub(1u, std::memory_order_release);
+            shard_ = nullptr;
+         }
+      }
+
+      pass_t(const pass_t &) = delete;
+      pass_t & operator=(const pass_t &) = delete;
+
+      ~pass_t() noexcept {
+         if(shard_)
+            shard_->active_.fetch_sub(1u, std::memory_order_release);
+      }
+
+      // Is the producer allowed to push?
+      explicit operator bool() const noexcept { return nullptr != shard_; }
+   };
+
+   [[nodiscard]]
+   bool is_open() const noexcept {
+      return open_.load(std::memory_order_acquire);
+   }
+
+   // New producers aren't allowed to push after that call.
+   void close() noexcept {
+      open_.store(false);
+   }
+
+   // Waits until all producers that entered the gate before close()
+   // leave it. It's expected to be short: producers just push demands.
+   void wait_for_producers() const noexcept {
+      for(std::size_t i = 0u; i <= mask_; ++i)
+         while(shards_[i].active_.load())
+            std::this_thread::yield();
+   }
+};
+
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+// A kind of std::latch from C++20, but without a fixed number of participant.
+// It's something similar to Run-Down Protection from Windows's kernel:
+//
+// https://learn.microsoft.com/en-us/windows-hardware/drivers/kernel/run-down-protection
+class rundown_latch_t {
+   std::mutex lock_;
+   std::condition_variable wakeup_cv_;
+
+   bool closed_{false};
+   unsigned attenders_{};
+
+public:
+   rundown_latch_t() = default;
+
+   void acquire() {
+      std::lock_guard<std::mutex> lock{lock_};
+      if(closed_)
+         throw std::runtime_error{"rundown_latch is closed"};
+      ++attenders_;
+   }
+
+   void release() noexcept {
+      std::lock_guard<std::mutex> lock{lock_};
+      --attenders_;
+      if(!attenders_)
+         wakeup_cv_.notify_all();
+   }
+
+   void wait_then_close() {
+      std::unique_lock<std::mutex> lock{lock_};
+      if(attenders_)
+      {
+         wakeup_cv_.wait(lock, [this]{ return 0u == attenders_; });
+         closed_ = true;
+      }
+   }
+};
+
+// A kind of std::lock_guard, but for rundown_latch_t.
+class auto_acquire_release_rundown_latch_t {
+   rundown_latch_t & room_;
+
+public:
+   auto_acquire_release_rundown_latch_t(rundown_latch_t & room) : room_{room} {
+      room_.acquire();
+   }
+   // The latch is already acquired by the caller.
+   auto_acquire_release_rundown_latch_t(
+         rundown_latch_t & room, std::adopt_lock_t) : room_{room} {
+   }
+   ~auto_acquire_release_rundown_latch_t() {
+      room_.release();
+   }
+};
+
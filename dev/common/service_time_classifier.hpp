@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+// Classification of message types into heavy and light ones by the
+// measured time of handling.
+//
+// The time of handling of every type is averaged by an exponential
+// moving average: every new measurement has the weight 1/decay_window_,
+// so the average follows drifts of the cost of handlers and old
+// measurements are forgotten after a few windows.
+//
+// There is the hysteresis: a light type becomes heavy when the average
+// reaches heavy_threshold_, a heavy type becomes light again when the
+// average falls below light_threshold_. So a type with the cost near
+// the threshold doesn't jump between lanes.
+//
+// Unknown types are light until the first measurement.
+//
+// Entries are found like routes in type_router_t: via a lock-free
+// open-addressing cache where the address of the type name is the key.
+// Entries are created under the mutex and are never removed.
+class service_time_classifier_t {
+public:
+   using clock_t = std::chrono::steady_clock;
+
+   static constexpr std::chrono::milliseconds default_heavy_threshold{ 200 };
+   static constexpr std::chrono::milliseconds default_light_threshold{ 100 };
+   static constexpr unsigned default_decay_window = 16u;
+
+   struct params_t {
+      clock_t::duration heavy_threshold_{ default_heavy_threshold };
+      clock_t::duration light_threshold_{ default_light_threshold };
+      // The count of measurements of a type that mostly form its average.
+      unsigned decay_window_{ default_decay_window };
+   };
+
+   // The current class of a message type.
+   struct type_class_t {
+      std::type_index type_;
+      bool heavy_;
+      // The average time of handling.
+      clock_t::duration service_;
+      std::uint64_t measurements_;
+      // How many times the class of the type was changed.
+      std::uint64_t reclassifications_;
+   };
+
+private:
+   struct entry_t {
+      const std::type_index type_;
+      std::atomic<std::uint64_t> service_ns_{0u};
+      std::atomic<std::uint64_t> measurements_{0u};
+      std::atomic<std::uint64_t> reclassifications_{0u};
+      std::atomic<bool> heavy_{false};
+
+      explicit entry_t(std::type_index type) : type_{type} {}
+   };
+
+   struct slot_t {
+      std::atomic<const char *> key_{nullptr};
+      // nullptr means that the slot is being filled.
+      std::atomic<entry_t *> entry_{nullptr};
+   };
+
+   // The size of the cache. Must be a power of two.
+   static constexpr unsigned cache_size_bits = 9u;
+   static constexpr std::size_t cache_size = std::size_t{1u} << cache_size_bits;
+   // The max count of probes before the fallback to the slow path.
+   static constexpr std::size_t max_probes = 8u;
+
+   const std::uint64_t heavy_threshold_ns_;
+   const std::uint64_t light_threshold_ns_;
+   const std::uint64_t decay_window_;
+   const std::unique_ptr<slot_t[]> cache_;
+
+   mutable std::mutex lock_;
+   std::deque<entry_t> entries_;
+   std::unordered_map<std::type_index, entry_t *> index_;
+
+   static std::uint64_t to_ns(clock_t::duration d) noexcept {
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+      return ns > 0 ? static_cast<std::uint64_t>(ns) : 0u;
+   }
+
+   static std::size_t slot_index(const char * key) noexcept {
+      // Fibonacci hashing of the address.
+      const auto v = static_cast<std::uint64_t>(
+            reinterpret_cast<std::uintptr_t>(key));
+      return static_cast<std::size_t>(
+            (v * 0x9E3779B97F4A7C15ull) >> (64u - cache_size_bits));
+   }
+
+   entry_t & slow_lookup(const std::type_index & type) {
+      std::lock_guard<std::mutex> lock{lock_};
+      auto it = index_.find(type);
+      if(index_.end() == it)
+         it = index_.emplace(type, &entries_.emplace_back(type)).first;
+      return *(it->second);
+   }
+
+   entry_t & entry_for(const std::type_index & type) {
+      const char * key = type.name();
+      auto index = slot_index(key);
+      for(std::size_t probe = 0u; probe != max_probes; ++probe) {
+         auto & slot = cache_[index];
+         const char * current = slot.key_.load(std::memory_order_acquire);
+         if(!current &&
+               slot.key_.compare_exchange_strong(current, key,
+                     std::memory_order_acq_rel)) {
+            // The slot is occupied by us, the entry has to be stored.
+            auto & entry = slow_lookup(type);
+            slot.entry_.store(&entry, std::memory_order_release);
+            return entry;
+         }
+
+         // NOTE: current contains the actual key if CAS failed.
+         if(key == current) {
+            auto * entry = slot.entry_.load(std::memory_order_acquire);
+            // The slot can be still filled by another thread.
+            return entry ? *entry : slow_lookup(type);
+         }
+
+         index = (index + 1u) & (cache_size - 1u);
+      }
+
+      // Too many collisions, the cache can't be used.
+      return slow_lookup(type);
+   }
+
+public:
+   explicit service_time_classifier_t(const params_t & params)
+      :  heavy_threshold_ns_{to_ns(params.heavy_threshold_)}
+      ,  light_threshold_ns_{to_ns(params.light_threshold_)}
+      ,  decay_window_{params.decay_window_ ? params.decay_window_ : 1u}
+      ,  cache_{new slot_t[cache_size]}
+   {}
+
+   service_time_classifier_t(const service_time_classifier_t &) = delete;
+   service_time_classifier_t & operator=(const service_time_classifier_t &) = delete;
+
+   [[nodiscard]]
+   bool heavy(const std::type_index & type) {
+      return entry_for(type).heavy_.load(std::memory_order_relaxed);
+   }
+
+   // Adds a measurement of the time of handling of a message of the type.
+   // It can be called by several threads at the same time.
+   void record(const std::type_index & type, clock_t::duration service) {
+      auto & entry = entry_for(type);
+      const auto ns = to_ns(service);
+
+      std::uint64_t average;
+      if(!entry.measurements_.fetch_add(1u, std::memory_order_relaxed)) {
+         // The first measurement is the average.
+         average = ns;
+         entry.service_ns_.store(average, std::memory_order_relaxed);
+      }
+      else {
+         auto current = entry.service_ns_.load(std::memory_order_relaxed);
+         do {
+            average = ns >= current ?
+                  current + (ns - current) / decay_window_ :
+                  current - (current - ns) / decay_window_;
+         }
+         while(!entry.service_ns_.compare_exchange_weak(current, average,
+               std::memory_order_relaxed));
+      }
+
+      bool heavy = entry.heavy_.load(std::memory_order_relaxed);
+      const bool should_be_heavy = heavy ?
+            average >= light_threshold_ns_ : average >= heavy_threshold_ns_;
+      // Only one of concurrent callers counts the change.
+      if(heavy != should_be_heavy &&
+            entry.heavy_.compare_exchange_strong(heavy, should_be_heavy,
+                  std::memory_order_relaxed))
+         entry.reclassifications_.fetch_add(1u, std::memory_order_relaxed);
+   }
+
+   // The current classes of all known types.
+   std::vector<type_class_t> classes() const {
+      std::vector<type_class_t> result;
+      std::lock_guard<std::mutex> lock{lock_};
+      result.reserve(entries_.size());
+      for(const auto & e : entries_)
+         result.push_back(type_class_t{
+               e.type_,
+               e.heavy_.load(std::memory_order_relaxed),
+               std::chrono::duration_cast<clock_t::duration>(
+                     std::chrono::nanoseconds{
+                           e.service_ns_.load(std::memory_order_relaxed)}),
+               e.measurements_.load(std::memory_order_relaxed),
+               e.reclassifications_.load(std::memory_order_relaxed) });
+      return result;
+   }
+};
+
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <common/bounded_mpmc_queue.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// An unbounded multi-producer/multi-consumer queue: the bounded lock-free
+// ring (see bounded_mpmc_queue_t) with the spill list.
+//
+// If the ring is full then items go to the std::deque under a mutex.
+// While the list isn't empty new items go there too, so the order of
+// items is kept. Consumers take the lock only if the list isn't empty,
+// so the steady state (when the ring isn't full) is lock-free.
+//
+// NOTE: T has to be default constructible and move assignable.
+template<typename T>
+class spilling_mpmc_queue_t {
+   bounded_mpmc_queue_t<T> ring_;
+   std::mutex spill_lock_;
+   std::deque<T> spill_;
+   std::atomic<std::size_t> spill_size_{0u};
+
+   // Extracts up to max items from the spill list.
+   template<typename F>
+   std::size_t try_pop_from_spill(std::size_t max, F && f) {
+      if(!spill_size_.load(std::memory_order_acquire))
+         return 0u;
+
+      std::lock_guard<std::mutex> lock{spill_lock_};
+      std::size_t count = 0u;
+      for(; count != max && !spill_.empty(); ++count) {
+         f(std::move(spill_.front()));
+         spill_.pop_front();
+      }
+      spill_size_.store(spill_.size(), std::memory_order_release);
+      return count;
+   }
+
+public:
+   // The capacity of the ring. It's rounded up to a power of two.
+   explicit spilling_mpmc_queue_t(std::size_t capacity) : ring_{capacity} {}
+
+   spilling_mpmc_queue_t(const spilling_mpmc_queue_t &) = delete;
+   spilling_mpmc_queue_t & operator=(const spilling_mpmc_queue_t &) = delete;
+
+   void push(T && v) {
+      // NOTE: the ring doesn't touch the item if it's full.
+      if(!spill_size_.load(std::memory_order_acquire) &&
+            ring_.try_push(std::move(v)))
+         return;
+
+      std::lock_guard<std::mutex> lock{spill_lock_};
+      spill_.push_back(std::move(v));
+      spill_size_.store(spill_.size(), std::memory_order_release);
+   }
+
+   // For the contract of queue backends (see generic_dispatcher_t).
+   // It never fails.
+   bool try_push(T && v) {
+      push(std::move(v));
+      return true;
+   }
+
+   // Returns false if the queue is empty.
+   [[nodiscard]]
+   bool try_pop(T & v) {
+      return ring_.try_pop(v) ||
+            try_pop_from_spill(1u, [&v](T && x) { v = std::move(x); });
+   }
+
+   // Extracts up to max items (from the ring first, then from the spill
+   // list). Every extracted item is passed to f as rvalue.
+   // Returns the count of extracted items (0 if the queue is empty).
+   template<typename F>
+   std::size_t try_pop_bulk(std::size_t max, F && f) {
+      auto count = ring_.try_pop_bulk(max, f);
+      if(count < max)
+         count += try_pop_from_spill(max - count, f);
+      return count;
+   }
+
+   // NOTE: it's just an estimation if there are concurrent pushes/pops.
+   std::size_t approx_size() const noexcept {
+      return ring_.approx_size() + spill_size_.load(std::memory_order_relaxed);
+   }
+};
+
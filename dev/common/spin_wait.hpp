@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+   #include <immintrin.h>
+#endif
+
+// A hint for the CPU that the current thread is in a spin-loop.
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+   _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+   __asm__ __volatile__("yield");
+#endif
+}
+
+// The first part of spin-then-park waiting: spinning with pause
+// instructions, then yielding, then the caller has to park the thread.
+//
+// The spin budget adapts to recent idle periods (the time from the start
+// of waiting to the arrival of the next work). If they are short then
+// the budget is twice the average idle period (but not greater than
+// the max), so the work is usually found without parking. If they are
+// long then spinning is just a waste of CPU, and the budget drops to
+// the minimum.
+//
+// Usage:
+//
+//    if(!spinner.spin([&]{ return try_pop(); })) {
+//       park();
+//       spinner.parked_until_now();
+//    }
+//
+// NOTE: spin() and parked_until_now() have to be called by the same
+// thread, every waiting thread has to have own object. But stats()
+// can be called by any thread.
+class adaptive_spin_wait_t {
+public:
+   using clock_t = std::chrono::steady_clock;
+
+   struct params_t {
+      // The max time of spinning with pause instructions.
+      std::chrono::microseconds max_spin_{ 50 };
+      // The min time of spinning (when idle periods are long).
+      std::chrono::microseconds min_spin_{ 1 };
+      // The count of std::this_thread::yield() calls after spinning.
+      unsigned yields_{ 8u };
+   };
+
+   // Counters of outcomes of waiting.
+   struct stats_t {
+      // Work was found while spinning, while yielding
+      // and after parking.
+      std::uint64_t spin_hits_;
+      std::uint64_t yield_hits_;
+      std::uint64_t parks_;
+      // The current spin budget.
+      clock_t::duration budget_;
+   };
+
+private:
+   const params_t params_;
+
+   // The average idle period (an exponential moving average).
+   clock_t::duration avg_idle_;
+   // The start of the current waiting.
+   clock_t::time_point started_at_{};
+
+   // NOTE: there is only one writer, so RMW-operations aren't necessary.
+   std::atomic<clock_t::rep> budget_;
+   std::atomic<std::uint64_t> spin_hits_{0u};
+   std::atomic<std::uint64_t> yield_hits_{0u};
+   std::atomic<std::uint64_t> parks_{0u};
+
+   static void increment(std::atomic<std::uint64_t> & counter) noexcept {
+      counter.store(counter.load(std::memory_order_relaxed) + 1u,
+            std::memory_order_relaxed);
+   }
+
+   void update_budget(clock_t::duration idle) noexcept {
+      // The new idle period has weight 1/4.
+      avg_idle_ += (idle - avg_idle_) / 4;
+
+      const clock_t::duration min_spin = params_.min_spin_;
+      const clock_t::duration max_spin = params_.max_spin_;
+      const auto budget = avg_idle_ <= max_spin ?
+            std::clamp<clock_t::duration>(2 * avg_idle_, min_spin, max_spin) :
+            min_spin;
+      budget_.store(budget.count(), std::memory_order_relaxed);
+   }
+
+public:
+   explicit adaptive_spin_wait_t(params_t params)
+      :  params_{params}
+      ,  avg_idle_{params.max_spin_}
+      ,  budget_{clock_t::duration{params.max_spin_}.count()}
+   {}
+
+   // Spins while ready() returns false, but no longer than the budget,
+   // then yields the specified count of times.
+   // Returns true if ready() returned true. Otherwise the caller
+   // has to park the thread and call parked_until_now() after that.
+   template<typename F>
+   bool spin(F && ready) {
+      started_at_ = clock_t::now();
+
+      const auto spin_until = started_at_ +
+            clock_t::duration{budget_.load(std::memory_order_relaxed)};
+      do {
+         if(ready()) {
+            increment(spin_hits_);
+            update_budget(clock_t::now() - started_at_);
+            return true;
+         }
+         cpu_relax();
+      }
+      while(clock_t::now() < spin_until);
+
+      for(auto i = params_.yields_; i; --i) {
+         std::this_thread::yield();
+         if(ready()) {
+            increment(yield_hits_);
+            update_budget(clock_t::now() - started_at_);
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   // Informs that the thread was parked after the last spin() and
+   // now it's awake.
+   void parked_until_now() noexcept {
+      increment(parks_);
+      update_budget(clock_t::now() - started_at_);
+   }
+
+   stats_t stats() const noexcept {
+      return stats_t{
+            spin_hits_.load(std::memory_order_relaxed),
+            yield_hits_.load(std::memory_order_relaxed),
+            parks_.load(std::memory_order_relaxed),
+            clock_t::duration{budget_.load(std::memory_order_relaxed)} };
+   }
+};
+
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <common/bounded_mpmc_queue.hpp>
+#include <common/event_count.hpp>
+
+#include <fmt/ostream.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Values of stats of the dashboard for one period.
+struct stats_record_t {
+   static constexpr std::size_t ops_count = 3u;
+   static constexpr std::size_t percentiles_count = 4u;
+
+   // Delays of one type of operations, in microseconds.
+   struct op_t {
+      std::uint64_t avg_us_;
+      std::uint64_t events_;
+      std::array<std::uint64_t, percentiles_count> percentiles_us_;
+      std::uint64_t max_us_;
+   };
+
+   // The index of the period and the time since the start of the dashboard.
+   std::uint64_t tick_;
+   std::uint64_t uptime_ms_;
+   std::array<op_t, ops_count> ops_;
+};
+
+// Names of types of operations and percentiles for headers of files.
+struct stats_layout_t {
+   std::array<std::string, stats_record_t::ops_count> op_names_;
+   std::array<double, stats_record_t::percentiles_count> percentiles_;
+};
+
+// An interface of a format of stats files.
+class stats_writer_t {
+public:
+   virtual ~stats_writer_t() noexcept = default;
+
+   // The extension for names of files.
+   virtual const char * extension() const noexcept = 0;
+   // Writes the header of a new file.
+   virtual void start(std::ostream & to) = 0;
+   virtual void write(std::ostream & to, const stats_record_t & r) = 0;
+   // Writes buffered records before the closing of the file.
+   virtual void finish(std::ostream & to) = 0;
+};
+
+// Text format with ';' as the separator and values in milliseconds.
+// A record is a line like:
+//
+//    Init-Avg;Init-Cnt;Reinit-Avg;Reinit-Cnt;IO-Avg;IO-Cnt;Init-P50;...
+class csv_stats_writer_t final : public stats_writer_t {
+   const stats_layout_t layout_;
+
+   static std::uint64_t ms(std::uint64_t us) noexcept { return us / 1000u; }
+
+public:
+   explicit csv_stats_writer_t(stats_layout_t layout)
+      :  layout_{std::move(layout)}
+   {}
+
+   const char * extension() const noexcept override { return ".csv"; }
+
+   void start(std::ostream & to) override {
+      const char * separator = "";
+      for(const auto & op : layout_.op_names_) {
+         fmt::print(to, "{}{}-Avg;{}-Cnt", separator, op, op);
+         separator = ";";
+      }
+      for(const auto & op : layout_.op_names_) {
+         for(const auto p : layout_.percentiles_)
+            fmt::print(to, ";{}-P{}", op, p);
+         fmt::print(to, ";{}-Max", op);
+      }
+      to << "\n";
+   }
+
+   void write(std::ostream & to, const stats_record_t & r) override {
+      const char * separator = "";
+      for(const auto & op : r.ops_) {
+         fmt::print(to, "{}{};{}", separator, ms(op.avg_us_), op.events_);
+         separator = ";";
+      }
+      for(const auto & op : r.ops_) {
+         for(const auto p : op.percentiles_us_)
+            fmt::print(to, ";{}", ms(p));
+         fmt::print(to, ";{}", ms(op.max_us_));
+      }
+      to << "\n";
+   }
+
+   void finish(std::ostream &) override {}
+};
+
+// Compact columnar format for long runs.
+//
+// The file starts with "SO5STAT1", the count of columns and names of
+// columns (every name is the length and the bytes). Then there are
+// blocks of records: the count of records in the block and values of
+// every column for all records of the block. A value is stored as
+// the difference with the previous value of the same column (zigzag
+// encoded varint, like in protobuf), so values that change slowly take
+// a byte or two. All values are in microseconds or milliseconds
+// (see names of columns).
+//
+// NOTE: the last incomplete block is written when the file is closed.
+class binary_stats_writer_t final : public stats_writer_t {
+   static constexpr std::size_t values_per_op =
+         3u + stats_record_t::percentiles_count;
+   static constexpr std::size_t columns_count =
+         2u + stats_record_t::ops_count * values_per_op;
+
+   using row_t = std::array<std::uint64_t, columns_count>;
+
+   const stats_layout_t layout_;
+   const std::size_t block_size_;
+   std::vector<row_t> rows_;
+   std::string buffer_;
+
+   static row_t to_row(const stats_record_t & r) noexcept {
+      row_t row{};
+      auto * v = row.data();
+      *v++ = r.tick_;
+      *v++ = r.uptime_ms_;
+      for(const auto & op : r.ops_) {
+         *v++ = op.avg_us_;
+         *v++ = op.events_;
+         for(const auto p : op.percentiles_us_)
+            *v++ = p;
+         *v++ = op.max_us_;
+      }
+      return row;
+   }
+
+   void put_varint(std::uint64_t v) {
+      for(; v >= 0x80u; v >>= 7u)
+         buffer_.push_back(static_cast<char>((v & 0x7fu) | 0x80u));
+      buffer_.push_back(static_cast<char>(v));
+   }
+
+   void put_string(const std::string & s) {
+      put_varint(s.size());
+      buffer_ += s;
+   }
+
+   void write_block(std::ostream & to) {
+      buffer_.clear();
+      put_varint(rows_.size());
+      for(std::size_t c = 0u; c != columns_count; ++c) {
+         std::uint64_t prev = 0u;
+         for(const auto & row : rows_) {
+            // The difference is calculated modulo 2^64.
+            const auto delta = static_cast<std::int64_t>(row[c] - prev);
+            put_varint((static_cast<std::uint64_t>(delta) << 1u) ^
+                  static_cast<std::uint64_t>(delta >> 63));
+            prev = row[c];
+         }
+      }
+      to.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+      rows_.clear();
+   }
+
+public:
+   binary_stats_writer_t(stats_layout_t layout, std::size_t block_size)
+      :  layout_{std::move(layout)}
+      ,  block_size_{block_size ? block_size : 1u} {
+      rows_.reserve(block_size_);
+   }
+
+   const char * extension() const noexcept override { return ".bin"; }
+
+   void start(std::ostream & to) override {
+      buffer_ = "SO5STAT1";
+      put_varint(columns_count);
+      put_string("Tick");
+      put_string("Uptime-ms");
+      for(const auto & op : layout_.op_names_) {
+         put_string(op + "-Avg-us");
+         put_string(op + "-Cnt");
+         for(const auto p : layout_.percentiles_)
+            put_string(fmt::format("{}-P{}-us", op, p));
+         put_string(op + "-Max-us");
+      }
+      to.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+   }
+
+   void write(std::ostream & to, const stats_record_t & r) override {
+      rows_.push_back(to_row(r));
+      if(rows_.size() >= block_size_)
+         write_block(to);
+   }
+
+   void finish(std::ostream & to) override {
+      if(!rows_.empty())
+         write_block(to);
+   }
+};
+
+// A sink that writes stats records to files on a background thread.
+//
+// A producer puts records into a lock-free ring buffer and never waits
+// for the disk: if the writer is too slow and the buffer is full then
+// the record is dropped (see dropped()).
+//
+// Files can be rotated by size: the first file is base_name + extension,
+// the next ones are base_name.1 + extension, base_name.2 + extension
+// and so on.
+class stats_sink_t {
+public:
+   enum class format_t { csv, binary };
+
+   struct params_t {
+      static constexpr std::chrono::milliseconds default_flush_interval{ 1000 };
+
+      format_t format_{ format_t::csv };
+      // The name of the first file without the extension.
+      std::string base_name_;
+      // A new file is started when the current one becomes greater than
+      // that size (in bytes). Zero means a single file.
+      std::uint64_t rotate_size_{};
+      // The max count of files, the oldest files are removed.
+      // Zero means that all files are kept.
+      unsigned max_files_{};
+      // How often the writer flushes the current file.
+      std::chrono::milliseconds flush_interval_{ default_flush_interval };
+      // The capacity of the ring buffer.
+      std::size_t capacity_{ 256u };
+      // The count of records in a block of the binary format.
+      std::size_t block_size_{ 64u };
+   };
+
+private:
+   const params_t params_;
+   const std::unique_ptr<stats_writer_t> writer_;
+
+   bounded_mpmc_queue_t<stats_record_t> ring_;
+   // The writer thread sleeps here when the ring is empty.
+   event_count_t ready_;
+   std::atomic<bool> stopped_{false};
+
+   std::atomic<std::uint64_t> dropped_{0u};
+   std::atomic<std::uint64_t> written_{0u};
+   // Is the writer stopped by an I/O error?
+   std::atomic<bool> failed_{false};
+
+   // The current file and names of all kept files.
+   // NOTE: they are used by the writer thread only (after the constructor).
+   std::ofstream file_;
+   unsigned file_index_{};
+   std::deque<std::string> files_;
+   bool dirty_{ false };
+
+   std::thread writer_thread_;
+
+   static std::unique_ptr<stats_writer_t> make_writer(
+         const params_t & params,
+         stats_layout_t layout) {
+      if(format_t::binary == params.format_)
+         return std::make_unique<binary_stats_writer_t>(
+               std::move(layout), params.block_size_);
+      return std::make_unique<csv_stats_writer_t>(std::move(layout));
+   }
+
+   void open_next_file() {
+      const auto name = file_index_ ?
+            fmt::format("{}.{}{}", params_.base_name_, file_index_,
+                  writer_->extension()) :
+            params_.base_name_ + writer_->extension();
+      ++file_index_;
+
+      file_ = std::ofstream{};
+      file_.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+      file_.open(name, std::ios::binary);
+      writer_->start(file_);
+      dirty_ = true;
+
+      files_.push_back(name);
+      if(params_.max_files_)
+         while(files_.size() > params_.max_files_) {
+            std::error_code ec;
+            std::filesystem::remove(files_.front(), ec);
+            files_.pop_front();
+         }
+   }
+
+   void close_file() {
+      writer_->finish(file_);
+      file_.close();
+   }
+
+   void write(const stats_record_t & r) {
+      writer_->write(file_, r);
+      dirty_ = true;
+      written_.fetch_add(1u, std::memory_order_relaxed);
+
+      if(params_.rotate_size_ &&
+            static_cast<std::uint64_t>(file_.tellp()) >= params_.rotate_size_) {
+         close_file();
+         open_next_file();
+      }
+   }
+
+   // Writes all records from the ring. Records are dropped after an error.
+   void drain() {
+      while(ring_.try_pop_bulk(16u, [this](stats_record_t && r) {
+            if(failed_.load(std::memory_order_relaxed)) {
+               dropped_.fetch_add(1u, std::memory_order_relaxed);
+               return;
+            }
+            try {
+               write(r);
+            }
+            catch(const std::exception &) {
+               failed_.store(true, std::memory_order_relaxed);
+               dropped_.fetch_add(1u, std::memory_order_relaxed);
+            }
+         }))
+         ;
+   }
+
+   void flush() noexcept {
+      if(!dirty_ || failed_.load(std::memory_order_relaxed))
+         return;
+      try {
+         file_.flush();
+         dirty_ = false;
+      }
+      catch(const std::exception &) {
+         failed_.store(true, std::memory_order_relaxed);
+      }
+   }
+
+   void writer_thread_body() noexcept {
+      auto next_flush = std::chrono::steady_clock::now() + params_.flush_interval_;
+      while(!stopped_.load(std::memory_order_acquire)) {
+         drain();
+
+         const auto now = std::chrono::steady_clock::now();
+         if(now >= next_flush) {
+            flush();
+            next_flush = now + params_.flush_interval_;
+         }
+
+         const auto ticket = ready_.prepare_wait();
+         if(ring_.approx_size() || stopped_.load(std::memory_order_acquire))
+            ready_.cancel_wait();
+         else
+            ready_.wait_for(ticket, next_flush - now);
+      }
+
+      // Records pushed before the stop have to be written.
+      drain();
+      if(!failed_.load(std::memory_order_relaxed)) {
+         try {
+            close_file();
+         }
+         catch(const std::exception &) {
+            failed_.store(true, std::memory_order_relaxed);
+         }
+      }
+   }
+
+public:
+   // NOTE: the first file is created here, so an error is reported
+   // to the caller by an exception.
+   stats_sink_t(params_t params, stats_layout_t layout)
+      :  params_{std::move(params)}
+      ,  writer_{make_writer(params_, std::move(layout))}
+      ,  ring_{params_.capacity_} {
+      open_next_file();
+      writer_thread_ = std::thread{[this]{ writer_thread_body(); }};
+   }
+
+   stats_sink_t(const stats_sink_t &) = delete;
+   stats_sink_t & operator=(const stats_sink_t &) = delete;
+
+   // Waits while all pushed records are written.
+   ~stats_sink_t() noexcept {
+      stopped_.store(true, std::memory_order_release);
+      ready_.notify_all();
+      writer_thread_.join();
+   }
+
+   // Passes the record to the writer thread.
+   // Returns false if the record is dropped because the ring is full.
+   bool push(stats_record_t r) {
+      if(!ring_.try_push(std::move(r))) {
+         dropped_.fetch_add(1u, std::memory_order_relaxed);
+         return false;
+      }
+      ready_.notify_one();
+      return true;
+   }
+
+   std::uint64_t dropped() const noexcept {
+      return dropped_.load(std::memory_order_relaxed);
+   }
+
+   std::uint64_t written() const noexcept {
+      return written_.load(std::memory_order_relaxed);
+   }
+
+   bool failed() const noexcept {
+      return failed_.load(std::memory_order_relaxed);
+   }
+};
+
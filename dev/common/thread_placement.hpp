@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+   #include <pthread.h>
+   #include <sched.h>
+#endif
+
+// Helpers for placement of threads on CPUs and NUMA nodes.
+//
+// They are implemented for Linux only (via sysfs and pthread API).
+// On other platforms threads can't be pinned, and there are no NUMA nodes.
+
+// A list of CPU indexes.
+using cpu_list_t = std::vector<unsigned>;
+
+// Parses a list in the format of sysfs and taskset, like "0-3,8,10-11".
+inline cpu_list_t parse_cpu_list(const std::string & list) {
+   cpu_list_t result;
+   std::istringstream in{list};
+   std::string item;
+   while(std::getline(in, item, ',')) {
+      // sysfs files end with a new line.
+      item.erase(std::remove_if(item.begin(), item.end(),
+            [](char ch) { return std::isspace(static_cast<unsigned char>(ch)); }),
+            item.end());
+      if(item.empty())
+         continue;
+
+      const auto valid = [](const std::string & s) {
+         return !s.empty() && std::string::npos == s.find_first_not_of("0123456789");
+      };
+      const auto dash = item.find('-');
+      const auto first = item.substr(0u, dash);
+      const auto last = std::string::npos == dash ? first : item.substr(dash + 1u);
+      if(!valid(first) || !valid(last) || std::stoul(first) > std::stoul(last))
+         throw std::invalid_argument("invalid CPU list: " + list);
+
+      for(auto cpu = std::stoul(first); cpu <= std::stoul(last); ++cpu)
+         result.push_back(static_cast<unsigned>(cpu));
+   }
+
+   return result;
+}
+
+// CPUs of the NUMA node. Throws if there is no information about the node.
+inline cpu_list_t cpus_of_numa_node(unsigned node) {
+   std::ifstream file{"/sys/devices/system/node/node"
+         + std::to_string(node) + "/cpulist"};
+   std::string list;
+   if(!std::getline(file, list))
+      throw std::runtime_error(
+            "there is no information about NUMA node " + std::to_string(node));
+
+   return parse_cpu_list(list);
+}
+
+// Parses the specification of CPUs for threads:
+// an empty string (any CPU), "node:N" (CPUs of NUMA node N)
+// or a list of CPUs (see parse_cpu_list).
+inline cpu_list_t parse_cpus_spec(const std::string & spec) {
+   static const std::string node_prefix{"node:"};
+   if(0u == spec.compare(0u, node_prefix.size(), node_prefix)) {
+      const auto node = spec.substr(node_prefix.size());
+      if(node.empty() ||
+            std::string::npos != node.find_first_not_of("0123456789"))
+         throw std::invalid_argument("invalid NUMA node: " + spec);
+      return cpus_of_numa_node(static_cast<unsigned>(std::stoul(node)));
+   }
+
+   return parse_cpu_list(spec);
+}
+
+// Makes a map from the CPU index to the index of its NUMA node.
+// CPUs without a node have -1. The map is empty if there is no
+// information about NUMA nodes.
+inline std::vector<int> make_numa_node_of_cpu_map() {
+   std::vector<int> result;
+   for(unsigned node = 0u; ; ++node) {
+      cpu_list_t cpus;
+      try {
+         cpus = cpus_of_numa_node(node);
+      }
+      catch(const std::exception &) {
+         break;
+      }
+
+      for(const auto cpu : cpus) {
+         if(cpu >= result.size())
+            result.resize(cpu + 1u, -1);
+         result[cpu] = static_cast<int>(node);
+      }
+   }
+
+   return result;
+}
+
+// Pins the current thread to the CPUs.
+// Returns false if it's not possible.
+inline bool pin_current_thread(const cpu_list_t & cpus) {
+#if defined(__linux__)
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   for(const auto cpu : cpus) {
+      if(cpu >= CPU_SETSIZE)
+         return false;
+      CPU_SET(cpu, &set);
+   }
+
+   return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+   (void)cpus;
+   return false;
+#endif
+}
+
+// The index of the CPU the current thread runs on (-1 if it's unknown).
+inline int current_cpu() noexcept {
+#if defined(__linux__)
+   return sched_getcpu();
+#else
+   return -1;
+#endif
+}
+
+// Calls f on a temporary thread that runs on the specified CPUs and
+// returns its result.
+//
+// It's intended for the creation of objects whose memory should be
+// placed on the NUMA node of the CPUs: Linux places a page on the node
+// of the thread that touches the page first.
+template<typename F>
+auto call_on_cpus(const cpu_list_t & cpus, F && f) {
+   if(cpus.empty())
+      return f();
+
+   std::decay_t<decltype(f())> result{};
+   std::exception_ptr error;
+   std::thread t{[&] {
+         try {
+            pin_current_thread(cpus);
+            result = f();
+         }
+         catch(...) {
+            error = std::current_exception();
+         }
+      }};
+   t.join();
+
+   if(error)
+      std::rethrow_exception(error);
+   return result;
+}
+
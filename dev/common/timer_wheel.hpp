@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// A hierarchical timing wheel (like the old timer wheel of Linux kernel).
+//
+// Time is measured in ticks. There are 4 levels of 256 slots: the first
+// level holds timers for the next 256 ticks (a slot per tick), the second
+// one holds timers for the next 256*256 ticks (a slot per 256 ticks) and
+// so on. When the first level completes a turn, timers from the next slot
+// of the second level are redistributed to the first level, and so on.
+//
+// So an insertion is O(1) regardless of the count of timers, and every
+// timer is moved between levels at most 3 times.
+//
+// Timers with the same expiration tick are returned in the unspecified
+// order. Timers that are more than 2^32 ticks away are kept at the last
+// level until they become close enough.
+//
+// NOTE: it's not thread-safe.
+template<typename T>
+class timer_wheel_t {
+public:
+   using tick_t = std::uint64_t;
+
+private:
+   static constexpr unsigned slot_bits = 8u;
+   static constexpr std::size_t slots_per_level = std::size_t{1u} << slot_bits;
+   static constexpr tick_t slot_mask = slots_per_level - 1u;
+   static constexpr unsigned levels = 4u;
+   // The max distance to a timer that can be placed into the last level.
+   static constexpr tick_t max_delta = (tick_t{1u} << (slot_bits * levels)) - 1u;
+
+   struct entry_t {
+      tick_t expires_;
+      T value_;
+   };
+
+   using slot_t = std::vector<entry_t>;
+
+   std::array<std::array<slot_t, slots_per_level>, levels> slots_;
+   // A buffer for entries of a slot that is being processed.
+   slot_t processing_;
+
+   // The tick to be processed next.
+   tick_t current_{};
+   // The count of timers in the wheel.
+   std::size_t size_{};
+
+   // Stores an entry into the slot according to its distance from current_.
+   // Expired entries go to the slot of current_.
+   void place(entry_t && e) {
+      tick_t pos = std::max(e.expires_, current_);
+      const tick_t delta = std::min(pos - current_, max_delta);
+      pos = current_ + delta;
+
+      unsigned level = 0u;
+      while(level + 1u != levels &&
+            delta >= (tick_t{1u} << (slot_bits * (level + 1u))))
+         ++level;
+
+      slots_[level][(pos >> (slot_bits * level)) & slot_mask]
+            .push_back(std::move(e));
+   }
+
+   // Redistributes entries of the slot to lower levels.
+   void cascade(unsigned level, std::size_t index) {
+      processing_.clear();
+      processing_.swap(slots_[level][index]);
+      for(auto & e : processing_)
+         place(std::move(e));
+      processing_.clear();
+   }
+
+   template<typename F>
+   void process_current_tick(F & f) {
+      const auto index = static_cast<std::size_t>(current_ & slot_mask);
+      // The first level completed a turn, the next slots of upper levels
+      // have to be redistributed.
+      if(!index)
+         for(unsigned level = 1u; level != levels; ++level) {
+            const auto i = static_cast<std::size_t>(
+                  (current_ >> (slot_bits * level)) & slot_mask);
+            cascade(level, i);
+            if(i)
+               break;
+         }
+
+      processing_.clear();
+      processing_.swap(slots_[0u][index]);
+      ++current_;
+
+      size_ -= processing_.size();
+      for(auto & e : processing_)
+         f(std::move(e.value_));
+      processing_.clear();
+   }
+
+public:
+   timer_wheel_t() = default;
+   timer_wheel_t(const timer_wheel_t &) = delete;
+   timer_wheel_t & operator=(const timer_wheel_t &) = delete;
+
+   // Adds a timer that expires at the specified tick.
+   // A timer for an already processed tick expires at the next advance().
+   void insert(tick_t expires, T value) {
+      place(entry_t{expires, std::move(value)});
+      ++size_;
+   }
+
+   // Processes all ticks up to now (inclusive).
+   // Values of expired timers are passed to f as rvalues.
+   //
+   // NOTE: f must not call insert().
+   template<typename F>
+   void advance(tick_t now, F && f) {
+      while(current_ <= now) {
+         if(!size_) {
+            // There is nothing to process, empty ticks can be skipped.
+            current_ = now + 1u;
+            break;
+         }
+         process_current_tick(f);
+      }
+   }
+
+   // The earliest tick that can have expired timers (it isn't earlier
+   // than the tick to be processed next). Empty if there are no timers.
+   //
+   // Timers of upper levels can't expire before the end of the current
+   // turn of the first level, so the end of that turn is returned if
+   // the first level is empty. It's a lower bound: the caller has to
+   // check again after advance() to that tick.
+   std::optional<tick_t> next_expiry() const noexcept {
+      if(!size_)
+         return std::nullopt;
+
+      tick_t tick = current_;
+      // Upper levels are cascaded at the start of every turn.
+      while((tick & slot_mask) &&
+            slots_[0u][static_cast<std::size_t>(tick & slot_mask)].empty())
+         ++tick;
+      return tick;
+   }
+
+   std::size_t size() const noexcept { return size_; }
+};
+
@@ -0,0 +1,2999 @@
+#pragma once
+
+#include <common/args.hpp>
+#include <common/a_device_manager.hpp>
+
+#include <common/deadline_queue.hpp>
+#include <common/demand_trace.hpp>
+#include <common/demand_scheduler.hpp>
+#include <common/dispatcher_policies.hpp>
+#include <common/event_count.hpp>
+#include <common/log_linear_histogram.hpp>
+#include <common/push_gate.hpp>
+#include <common/rundown_latch.hpp>
+#include <common/service_time_classifier.hpp>
+#include <common/spin_wait.hpp>
+#include <common/thread_placement.hpp>
+#include <common/timer_wheel.hpp>
+#include <common/type_router.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+
+// A class of dispatcher intended to process events of a_device_manager_t agent.
+class tricky_dispatcher_t final
+      : public so_5::disp_binder_t
+      , public so_5::event_queue_t
+      , public demand_scheduler_t {
+public:
+   // Type to be used for time counting.
+   using clock_t = std::chrono::steady_clock;
+
+   // Type of queues to be used for lanes.
+   enum class queue_backend_t {
+      // Ordinary mchains. Every push/pop takes a lock.
+      mchain,
+      // Bounded lock-free MPMC queues. Workers take a lock only
+      // when they have nothing to do and go to sleep.
+      lock_free,
+      // Every worker has own local queues. Idle workers steal demands
+      // from queues of other workers.
+      work_stealing
+   };
+
+   // The order of demands in a lane.
+   enum class lane_ordering_t {
+      // Demands are served in the order of their pushing.
+      fifo,
+      // Demands with the earliest deadline are served first.
+      // It's supported for queue_backend_t::lock_free and
+      // queue_backend_t::work_stealing only.
+      edf
+   };
+
+   // How a worker chooses between non-empty lanes of its group.
+   enum class lane_scheduling_t {
+      // Lanes are checked in the order of their priority, a lane is
+      // served only if all lanes with higher priority are empty.
+      // NOTE: for queue_backend_t::mchain lanes are served by select(),
+      // so there is no strict priority.
+      strict_priority,
+      // Every worker shares its time between backlogged lanes in
+      // proportion to their weights. The cost of a demand is the time
+      // of its handling, so a backlogged lane gets at least
+      // weight/(sum of weights of lanes of the group) of the time
+      // of every thread of the group.
+      // It's supported for queue_backend_t::lock_free and
+      // queue_backend_t::work_stealing only.
+      weighted
+   };
+
+   // How idle workers wait for new demands.
+   enum class wait_strategy_t {
+      // A worker goes to sleep at once. It doesn't waste CPU, but every
+      // demand for a sleeping worker costs a wakeup via the OS.
+      blocking,
+      // A worker spins for a while, then yields, then goes to sleep
+      // (see adaptive_spin_wait_t).
+      spin_then_park
+   };
+
+   // How worker threads are pinned to CPUs of their groups.
+   enum class pinning_t {
+      // Threads aren't pinned.
+      none,
+      // Every thread is pinned to one CPU of its group
+      // (CPUs are assigned to threads of a group in round-robin fashion).
+      core,
+      // Every thread can run on any CPU of its group.
+      core_set
+   };
+
+   // What happens with a demand for a full bounded lane.
+   enum class overflow_policy_t {
+      // The producer waits for free space, but no longer than
+      // the block timeout. Then the demand is rejected.
+      // NOTE: producers are often workers of the same dispatcher,
+      // so the timeout should be short.
+      block,
+      // The oldest demand in the lane is dropped to make room for the new
+      // one. For EDF lanes it's the least urgent demand (the demand with
+      // the latest deadline).
+      drop_oldest,
+      // The new demand is dropped.
+      drop_newest,
+      // The new demand is passed to disp_params_t::on_overflow_
+      // (an exception is thrown if there is no handler).
+      reject
+   };
+
+   // Limits of a lane.
+   struct lane_limits_t {
+      static constexpr std::chrono::milliseconds default_block_timeout{ 100 };
+
+      // The max count of demands in the lane. Zero means unbounded.
+      std::size_t capacity_{};
+      overflow_policy_t overflow_policy_{ overflow_policy_t::reject };
+      // The max wait time of a producer for overflow_policy_t::block.
+      std::chrono::milliseconds block_timeout_{ default_block_timeout };
+   };
+
+   // Type of functor that is called for a rejected or dropped demand.
+   // It receives the name of the lane and the demand, and the handler can
+   // take the message from the demand (e.g. to send it again later).
+   using overflow_handler_t = std::function<
+         void(const std::string &, so_5::execution_demand_t &)>;
+
+   // Type of functor for getting the deadline of a demand.
+   // If there is no deadline then the time of pushing is used.
+   using deadline_extractor_t = std::function<
+         std::optional<clock_t::time_point>(const so_5::execution_demand_t &)>;
+
+   // Type of functor for getting the affinity key of a demand
+   // (see disp_params_t::affinity_key_of_).
+   using affinity_key_extractor_t = std::function<
+         std::optional<std::uint64_t>(const so_5::execution_demand_t &)>;
+
+   // A compile-time list of message types.
+   template<typename... Msgs>
+   struct msg_types_t {};
+
+   // Description of a lane.
+   // Demands for messages of the specified types go to that lane.
+   struct lane_params_t {
+      // The name of the lane (for diagnostic purposes).
+      std::string name_;
+      // Types of messages for that lane.
+      // NOTE: mutable messages have to be specified as so_5::mutable_msg<M>.
+      std::vector<std::type_index> types_{};
+      // The order of demands in that lane.
+      lane_ordering_t ordering_{ lane_ordering_t::fifo };
+      // Capacity of the lane and the reaction to its overflow.
+      lane_limits_t limits_{};
+      // The weight of the lane for lane_scheduling_t::weighted.
+      unsigned weight_{ 1u };
+
+      lane_params_t & ordering(lane_ordering_t v) {
+         ordering_ = v;
+         return *this;
+      }
+
+      lane_params_t & limits(lane_limits_t v) {
+         limits_ = v;
+         return *this;
+      }
+
+      lane_params_t & weight(unsigned v) {
+         weight_ = v;
+         return *this;
+      }
+
+      template<typename... Msgs>
+      lane_params_t & add_types() {
+         (types_.emplace_back(typeid(Msgs)), ...);
+         return *this;
+      }
+
+      template<typename... Msgs>
+      lane_params_t & add_types(msg_types_t<Msgs...>) {
+         return add_types<Msgs...>();
+      }
+   };
+
+   // Description of a group of threads.
+   struct thread_group_params_t {
+      // The name of the group (for diagnostic purposes).
+      std::string name_;
+      // The count of threads in the group.
+      unsigned threads_;
+      // Indexes of lanes to be served by threads of that group.
+      // Lanes are checked in that order, so the first lane has
+      // the greatest priority.
+      std::vector<std::size_t> lanes_;
+      // CPUs for threads of that group (see pinning_t).
+      // Empty list means any CPU.
+      cpu_list_t cpus_{};
+      // The max count of threads for the elastic pool. If it's greater
+      // than threads_ then threads are added while lanes of the group are
+      // overloaded, and threads above threads_ retire after idle_timeout_.
+      // Zero means the fixed count of threads.
+      unsigned max_threads_{};
+   };
+
+   // Observed load of a lane for the last check in the adaptive split mode.
+   struct lane_load_t {
+      // The name of the lane.
+      std::string lane_;
+      // The average wait time of extracted demands.
+      clock_t::duration avg_wait_;
+      // The count of extracted demands.
+      std::uint64_t extracted_;
+      // The count of demands in the lane.
+      std::size_t depth_;
+   };
+
+   // Information about a move of a thread from one group to another
+   // in the adaptive split mode.
+   struct role_change_t {
+      // When the change happened.
+      clock_t::time_point at_;
+      // The index of the thread.
+      unsigned thread_index_;
+      // Names of groups.
+      std::string from_group_;
+      std::string to_group_;
+      // Sizes of groups after the change.
+      unsigned from_group_threads_;
+      unsigned to_group_threads_;
+      // Observed loads of all lanes that led to the change.
+      std::vector<lane_load_t> lane_loads_;
+   };
+
+   // Current state of the adaptive split.
+   struct adaptive_split_stats_t {
+      // Total count of role changes.
+      std::uint64_t role_changes_;
+      // Current sizes of thread groups (in the order of their definition).
+      std::vector<unsigned> group_threads_;
+      // Last role changes (the oldest is the first).
+      std::vector<role_change_t> recent_changes_;
+   };
+
+   // Metrics of a lane.
+   struct lane_metrics_t {
+      // The name of the lane.
+      std::string name_;
+      // Counts of pushed and extracted demands.
+      std::uint64_t enqueued_;
+      std::uint64_t dequeued_;
+      // The current and the max count of demands in the lane.
+      std::uint64_t depth_;
+      std::uint64_t max_depth_;
+      // The capacity of the lane (zero if it's unbounded) and counts of
+      // demands dropped and rejected because of its overflow.
+      std::size_t capacity_;
+      std::uint64_t dropped_;
+      std::uint64_t rejected_;
+      // Time from the push of a demand to the start of its handling
+      // and time of handling, in nanoseconds.
+      log_linear_histogram_t wait_ns_;
+      log_linear_histogram_t service_ns_;
+      // The weight of the lane (see lane_scheduling_t::weighted).
+      unsigned weight_;
+      // Total time of handling of demands of the lane and its share
+      // in the time of handling of all demands.
+      clock_t::duration served_;
+      double share_;
+   };
+
+   // Shares of lanes in the time of handling of demands by threads
+   // of a group.
+   // NOTE: the time of a worker is accounted to its current group.
+   struct group_shares_t {
+      // The name of the group.
+      std::string group_;
+      // Indexes of lanes of the group (in the priority order).
+      std::vector<std::size_t> lanes_;
+      // Actual shares of these lanes (from 0 to 1).
+      std::vector<double> shares_;
+      // Shares that are guaranteed for backlogged lanes.
+      std::vector<double> min_shares_;
+   };
+
+   // Metrics of a worker thread.
+   struct worker_metrics_t {
+      // The index of the thread.
+      unsigned index_;
+      // The name of the current group of the thread.
+      std::string group_;
+      // The count of handled demands.
+      std::uint64_t handled_;
+      // Time spent in event handlers and time spent outside of them.
+      clock_t::duration busy_;
+      clock_t::duration idle_;
+      // The same as in lane_metrics_t, but for all lanes.
+      log_linear_histogram_t wait_ns_;
+      log_linear_histogram_t service_ns_;
+      // CPUs the thread is pinned to (empty if it isn't pinned).
+      cpu_list_t pinned_to_;
+      // The CPU the thread was running on the last time and its NUMA node
+      // (-1 if it's unknown). The CPU is updated at the start of the
+      // thread and for every demand if metrics are collected.
+      int last_cpu_;
+      int last_numa_node_;
+      // How many times the thread was found on another CPU.
+      std::uint64_t cpu_migrations_;
+      // Demands with affinity keys handled by their preferred worker
+      // (hits) and by other workers (misses).
+      std::uint64_t affinity_hits_;
+      std::uint64_t affinity_misses_;
+      // Outcomes of waiting for wait_strategy_t::spin_then_park
+      // (all are zero for wait_strategy_t::blocking).
+      adaptive_spin_wait_t::stats_t wait_;
+      // Does the worker have a thread now?
+      // It's false for retired threads of the elastic pool.
+      bool active_;
+   };
+
+   // Metrics of the dispatcher at some moment.
+   struct metrics_snapshot_t {
+      // When the snapshot was taken.
+      clock_t::time_point taken_at_;
+      // Time since the start of the dispatcher.
+      clock_t::duration uptime_;
+      std::vector<lane_metrics_t> lanes_;
+      std::vector<worker_metrics_t> workers_;
+      std::vector<group_shares_t> groups_;
+      // Counts of threads added and retired by the elastic pool.
+      std::uint64_t threads_added_;
+      std::uint64_t threads_retired_;
+   };
+
+   // Parameters for the dispatcher.
+   //
+   // Lanes and thread groups can be specified this way:
+   //
+   //    tricky_dispatcher_t::disp_params_t params{};
+   //    params.add_lane("init").add_types<init_device_t>();
+   //    params.add_lane("reinit").add_types<so_5::mutable_msg<reinit_device_t>>();
+   //    params.add_lane("other");
+   //    params.default_lane(2u)
+   //       .add_thread_group("init", 2u, {0u, 2u})
+   //       .add_thread_group("reinit", 2u, {1u, 2u})
+   //       .add_thread_group("other", 4u, {2u});
+   struct disp_params_t {
+      static constexpr std::size_t default_lock_free_queue_capacity = 65536u;
+
+      static constexpr std::chrono::milliseconds default_rebalance_interval{ 250 };
+      static constexpr std::chrono::milliseconds default_rebalance_wait_threshold{ 100 };
+      static constexpr unsigned default_rebalance_hysteresis = 4u;
+
+      static constexpr std::chrono::milliseconds default_idle_timeout{ 10000 };
+
+      static constexpr std::size_t default_affinity_steal_threshold = 4u;
+
+      static constexpr std::chrono::milliseconds default_timer_tick{ 1 };
+
+      // The size of the thread pool.
+      // It's used only if there are no lanes: 3/4 of threads serve
+      // init/reinit and other demands, 1/4 serve other demands only.
+      unsigned pool_size_{};
+      // Type of queues for lanes.
+      queue_backend_t queue_backend_{ queue_backend_t::mchain };
+      // Capacity of every lock-free queue.
+      // Unbounded lanes never reject demands: if the queue is full then
+      // demands go to the spill list of the lane (a mutex-protected
+      // deque) until the list is emptied by workers.
+      std::size_t lock_free_queue_capacity_{ default_lock_free_queue_capacity };
+      // The max count of demands extracted from a lane by a worker in one
+      // synchronized operation. Values greater than 1 are supported for
+      // queue_backend_t::lock_free and queue_backend_t::work_stealing only.
+      std::size_t batch_size_{ 1u };
+
+      // How workers choose between lanes of their groups.
+      // NOTE: batches can't be used with lane_scheduling_t::weighted.
+      lane_scheduling_t lane_scheduling_{ lane_scheduling_t::strict_priority };
+
+      // The order of demands in lanes that are created if lanes_ is empty.
+      lane_ordering_t default_lanes_ordering_{ lane_ordering_t::fifo };
+      // Limits for lanes that are created if lanes_ is empty.
+      lane_limits_t init_reinit_lane_limits_{};
+      lane_limits_t other_lane_limits_{};
+      // Weights for lanes that are created if lanes_ is empty.
+      unsigned init_reinit_lane_weight_{ 1u };
+      unsigned other_lane_weight_{ 1u };
+
+      // Lanes for demands.
+      std::vector<lane_params_t> lanes_{};
+      // The lane for messages of types that aren't listed in lanes_.
+      std::size_t default_lane_{};
+      // Should message types be routed by the measured time of their
+      // handling instead of lists of types (see service_time_classifier_t)?
+      // Heavy types go to heavy_lane_, light types go to default_lane_.
+      // If lanes_ is empty then lanes "heavy" and "light" are created
+      // instead of "init_reinit" and "other".
+      // NOTE: lanes can't have types in that mode.
+      bool auto_classification_{ false };
+      std::size_t heavy_lane_{};
+      service_time_classifier_t::params_t classifier_{};
+      // Groups of threads.
+      // NOTE: the first thread of the first group is the leader that
+      // handles evt_start and evt_finish.
+      std::vector<thread_group_params_t> thread_groups_{};
+      // The max size of the thread pool for the elastic pool. It's used
+      // only if there are no lanes (it's split between groups like
+      // pool_size_). Zero means the fixed size of the pool.
+      unsigned max_pool_size_{};
+      // A thread of the elastic pool above the min count of its group
+      // retires if it has nothing to do for that time.
+      std::chrono::milliseconds idle_timeout_{ default_idle_timeout };
+
+      // How threads are pinned to CPUs of their groups.
+      // The memory of a lock-free queue is allocated on the NUMA node of
+      // CPUs of the first group that serves it (dedicated groups go first).
+      // NOTE: threads keep their CPUs in the adaptive split mode.
+      pinning_t pinning_{ pinning_t::none };
+      // CPUs for groups that are created if thread_groups_ is empty.
+      cpu_list_t first_type_cpus_{};
+      cpu_list_t second_type_cpus_{};
+
+      // How idle workers wait for new demands.
+      wait_strategy_t wait_strategy_{ wait_strategy_t::blocking };
+      // Limits of spinning for wait_strategy_t::spin_then_park.
+      adaptive_spin_wait_t::params_t spin_wait_{};
+
+      // Deadlines for lanes with lane_ordering_t::edf.
+      deadline_extractor_t deadline_of_{};
+
+      // Keys for affinity routing (queue_backend_t::work_stealing only).
+      // Demands with the same key go to the same preferred worker among
+      // workers of the lane. Other workers steal from that worker only if
+      // it has at least affinity_steal_threshold_ demands in the queue.
+      // Demands without keys are distributed as usual.
+      affinity_key_extractor_t affinity_key_of_{};
+      std::size_t affinity_steal_threshold_{ default_affinity_steal_threshold };
+
+      // It's called for every demand rejected or dropped by a bounded lane
+      // (see overflow_policy_t), on the thread that pushes the demand.
+      // Drops aren't reported if there is no handler.
+      // NOTE: it mustn't push demands to the dispatcher synchronously,
+      // otherwise the overflow of the lane leads to a recursion.
+      overflow_handler_t on_overflow_{};
+
+      // Should threads move between groups at runtime?
+      // It's supported for queue_backend_t::lock_free only.
+      bool adaptive_split_{ false };
+      // How often lanes are checked in the adaptive split mode
+      // and for the elastic pool.
+      std::chrono::milliseconds rebalance_interval_{ default_rebalance_interval };
+      // A lane is overloaded if the average wait time of its demands
+      // is greater than that threshold (or if there is no progress at all).
+      // The elastic pool adds a thread for an overloaded lane.
+      // A lane is relaxed if the average wait time is less than the half
+      // of that threshold.
+      std::chrono::milliseconds rebalance_wait_threshold_{
+            default_rebalance_wait_threshold };
+      // How many checks in a row have to show the same imbalance
+      // before the move of a thread (or the same overloaded lane
+      // before the addition of a thread).
+      unsigned rebalance_hysteresis_{ default_rebalance_hysteresis };
+      // It's called for every move of a thread.
+      // NOTE: it's called on the monitor thread.
+      std::function<void(const role_change_t &)> on_role_change_{};
+
+      // Should the dispatcher collect metrics (see metrics_snapshot())?
+      // It costs two reads of the clock and several relaxed atomic
+      // operations per demand.
+      bool metrics_{ false };
+
+      // The count of the last handled demands to be kept in the trace
+      // of every worker (see write_trace()). Zero means no tracing.
+      // It costs up to four reads of the clock and several relaxed
+      // atomic stores per demand.
+      std::size_t trace_capacity_{ 0u };
+
+      // Should the dispatcher have own timer for schedule()?
+      // If it's false then schedule() throws.
+      bool timer_wheel_{ false };
+      // The resolution of the timer. Messages are sent at most
+      // one tick later than the specified time.
+      std::chrono::milliseconds timer_tick_{ default_timer_tick };
+
+      lane_params_t & add_lane(std::string name) {
+         lanes_.push_back(lane_params_t{std::move(name)});
+         return lanes_.back();
+      }
+
+      disp_params_t & default_lane(std::size_t lane) {
+         default_lane_ = lane;
+         return *this;
+      }
+
+      disp_params_t & add_thread_group(
+            std::string name,
+            unsigned threads,
+            std::vector<std::size_t> lanes,
+            cpu_list_t cpus = {},
+            unsigned max_threads = 0u) {
+         thread_groups_.push_back(thread_group_params_t{
+               std::move(name), threads, std::move(lanes), std::move(cpus),
+               max_threads});
+         return *this;
+      }
+   };
+
+private:
+   // Type of container for worker threads.
+   using thread_pool_t = std::vector<std::thread>;
+
+   // The max count of lanes for a thread group in the case of
+   // queue_backend_t::mchain. so_5::select requires all cases at
+   // compile time, so there should be some limit.
+   static constexpr std::size_t max_mchain_lanes_per_group = 8u;
+
+   // The max count of lanes for a thread group in the case of
+   // lane_scheduling_t::weighted (checked lanes are marked in a bitmask).
+   static constexpr std::size_t max_weighted_lanes_per_group = 64u;
+
+   // A value of timed_demand_t::preferred_worker_ for demands
+   // without affinity keys.
+   static constexpr unsigned no_preferred_worker =
+         std::numeric_limits<unsigned>::max();
+
+   // A demand with the time of its pushing.
+   // NOTE: pushed_at_ is set only if it's necessary (for EDF lanes,
+   // the adaptive split mode, metrics and tracing).
+   struct timed_demand_t {
+      so_5::execution_demand_t demand_;
+      clock_t::time_point pushed_at_;
+      // The index of the preferred worker for affinity routing.
+      unsigned preferred_worker_{ no_preferred_worker };
+      // The time of the extraction from the lane (for tracing only).
+      clock_t::time_point dequeued_at_{};
+   };
+
+   // A message to be sent at the specified time.
+   struct scheduled_demand_t {
+      clock_t::time_point at_;
+      scheduled_message_uptr_t msg_;
+   };
+
+   // A buffer for scheduled messages that aren't in the timer wheel yet.
+   // Every worker has own buffer, so producers almost never contend,
+   // and the timer thread takes the content of all buffers once per tick.
+   struct timer_buffer_t {
+      std::mutex lock_;
+      std::vector<scheduled_demand_t> demands_;
+   };
+
+   // Type of queue to be used with queue_backend_t::lock_free.
+   using lock_free_queue_t =
+         lock_free_queue_backend_t::queue_t<timed_demand_t>;
+
+   // Type of queue to be used for lanes with lane_ordering_t::edf.
+   using edf_queue_t = deadline_queue_t<timed_demand_t, clock_t::time_point>;
+
+   // A local queue of a worker for queue_backend_t::work_stealing.
+   // The owner and thieves use it under the lock, but the lock is
+   // taken only if the queue isn't empty, and every worker has own locks.
+   class stealable_queue_t {
+      std::mutex lock_;
+      std::deque<timed_demand_t> demands_;
+      // The size of demands_ for checks without taking the lock.
+      std::atomic<std::size_t> size_{0u};
+
+   public:
+      void push(timed_demand_t demand) {
+         std::lock_guard<std::mutex> lock{lock_};
+         demands_.push_back(std::move(demand));
+         size_.store(demands_.size(), std::memory_order_relaxed);
+      }
+
+      // Extracts up to max demands under a single lock.
+      // Every extracted demand is passed to f as rvalue.
+      template<typename F>
+      std::size_t try_pop_bulk(std::size_t max, F && f) {
+         if(!size_.load(std::memory_order_relaxed))
+            return 0u;
+
+         std::lock_guard<std::mutex> lock{lock_};
+         std::size_t count = 0u;
+         for(; count != max && !demands_.empty(); ++count) {
+            f(std::move(demands_.front()));
+            demands_.pop_front();
+         }
+         size_.store(demands_.size(), std::memory_order_relaxed);
+         return count;
+      }
+
+      // Steals up to the half of demands (but at least one).
+      // The oldest demand is returned via demand, the remaining ones
+      // are stored into rest.
+      bool try_steal(
+            timed_demand_t & demand,
+            std::vector<timed_demand_t> & rest) {
+         if(!size_.load(std::memory_order_relaxed))
+            return false;
+
+         std::lock_guard<std::mutex> lock{lock_};
+         if(demands_.empty())
+            return false;
+
+         demand = std::move(demands_.front());
+         demands_.pop_front();
+         for(auto n = demands_.size() / 2u; n; --n) {
+            rest.push_back(std::move(demands_.front()));
+            demands_.pop_front();
+         }
+         size_.store(demands_.size(), std::memory_order_relaxed);
+         return true;
+      }
+
+      std::size_t approx_size() const noexcept {
+         return size_.load(std::memory_order_relaxed);
+      }
+   };
+
+   // A lane for demands.
+   struct lane_t {
+      // The name of the lane.
+      const std::string name_;
+      // The channel for queue_backend_t::mchain.
+      so_5::mchain_t ch_;
+      // The queue for queue_backend_t::lock_free. It's unbounded:
+      // demands that don't fit into the ring go to the spill list.
+      std::unique_ptr<lock_free_queue_t> queue_;
+      // The queue for lane_ordering_t::edf. It's shared between all
+      // workers regardless of queue_backend_.
+      std::unique_ptr<edf_queue_t> edf_queue_;
+      // Total wait time and the count of extracted demands since
+      // the last check. They are updated only in the adaptive split mode
+      // and for the elastic pool.
+      alignas(64) std::atomic<clock_t::rep> total_wait_{0};
+      std::atomic<std::uint64_t> extracted_{0u};
+      // Counters for metrics. Producers and consumers update different
+      // cache lines.
+      alignas(64) std::atomic<std::uint64_t> enqueued_{0u};
+      std::atomic<std::uint64_t> max_depth_{0u};
+      alignas(64) std::atomic<std::uint64_t> dequeued_{0u};
+      // Groups that serve that lane. Groups with less count of lanes
+      // go first.
+      std::vector<std::size_t> groups_;
+      // Workers with local queues for that lane
+      // (queue_backend_t::work_stealing only).
+      std::vector<unsigned> workers_;
+      // A counter for round-robin distribution of demands from
+      // non-worker threads (queue_backend_t::work_stealing only).
+      std::atomic<unsigned> next_worker_{0u};
+      // Limits of the lane.
+      lane_limits_t limits_{};
+      // The count of demands in a bounded lane (including demands that
+      // are being pushed). A place is reserved before the push and is
+      // released after the extraction, so the lane never holds more than
+      // limits_.capacity_ demands.
+      alignas(64) std::atomic<std::size_t> size_{0u};
+      // Producers wait here for overflow_policy_t::block.
+      event_count_t space_waiters_;
+      std::atomic<std::uint64_t> dropped_{0u};
+      std::atomic<std::uint64_t> rejected_{0u};
+      // The weight for lane_scheduling_t::weighted.
+      unsigned weight_{ 1u };
+
+      explicit lane_t(std::string name) : name_{std::move(name)} {}
+   };
+
+   // A group of threads.
+   struct thread_group_t {
+      // The name of the group.
+      const std::string name_;
+      // Lanes to be served in the priority order.
+      const std::vector<std::size_t> lanes_;
+      // Idle threads of that group sleep here when queues are empty.
+      // Threads of different groups wait separately because a thread
+      // can't be woken up for a demand from a lane it doesn't serve.
+      event_count_t waiters_;
+      // The min and the max count of threads (they are equal if the
+      // group isn't elastic) and the current count of threads.
+      const unsigned min_threads_;
+      const unsigned max_threads_;
+      std::atomic<unsigned> active_threads_;
+
+      thread_group_t(
+            std::string name,
+            std::vector<std::size_t> lanes,
+            unsigned min_threads,
+            unsigned max_threads)
+         :  name_{std::move(name)}, lanes_{std::move(lanes)}
+         ,  min_threads_{min_threads}, max_threads_{max_threads}
+         ,  active_threads_{min_threads}
+      {}
+   };
+
+   // Metrics of a worker for one lane.
+   // NOTE: they are updated by the worker's thread only.
+   struct alignas(64) worker_lane_metrics_t {
+      std::atomic<std::uint64_t> handled_{0u};
+      concurrent_log_linear_histogram_t wait_ns_;
+      concurrent_log_linear_histogram_t service_ns_;
+   };
+
+   // Data of a worker thread.
+   struct alignas(64) worker_t {
+      // The dispatcher the worker belongs to.
+      tricky_dispatcher_t * const owner_;
+      // The index of the worker in the dispatcher's workers_.
+      const unsigned index_;
+      // The group of the worker.
+      // NOTE: it can be changed in the adaptive split mode.
+      std::atomic<std::size_t> group_;
+      // Local queues for queue_backend_t::work_stealing, an item for
+      // every lane. Items for lanes that aren't served are empty.
+      std::vector<std::unique_ptr<stealable_queue_t>> local_queues_;
+      // A buffer for stolen demands to avoid allocations on every steal.
+      std::vector<timed_demand_t> stolen_;
+      // Demands extracted by the last synchronized operation.
+      std::vector<timed_demand_t> batch_;
+      // The group and the position of the lane in the group's lanes
+      // for demands in batch_.
+      std::size_t batch_group_{};
+      std::size_t batch_lane_pos_{};
+      // Metrics for every lane (if metrics are collected).
+      std::vector<std::unique_ptr<worker_lane_metrics_t>> lane_metrics_;
+      // Time spent in event handlers (if metrics are collected).
+      std::atomic<clock_t::rep> busy_{0};
+      // The last handled demands (if tracing is on).
+      std::unique_ptr<demand_trace_ring_t> trace_;
+      // Virtual times of lanes for lane_scheduling_t::weighted: the time
+      // of handling of demands of a lane by that worker divided by the
+      // weight of the lane (in nanoseconds). And the virtual time of the
+      // lane of the last extracted demand.
+      std::vector<double> vtime_;
+      double vclock_{};
+      // Time of handling of demands of every lane (if metrics are
+      // collected or lanes are weighted).
+      // NOTE: it's updated by the worker's thread only.
+      std::unique_ptr<std::atomic<std::uint64_t>[]> served_ns_;
+      // Messages scheduled by that worker (if the timer is used).
+      timer_buffer_t timer_buffer_;
+      // CPUs the thread is pinned to (empty if it isn't pinned).
+      cpu_list_t pinned_to_;
+      // The last observed CPU and the count of changes of it.
+      // NOTE: they are updated by the worker's thread only.
+      std::atomic<int> last_cpu_{-1};
+      std::atomic<std::uint64_t> cpu_migrations_{0u};
+      // Spinning before sleep (for wait_strategy_t::spin_then_park only).
+      std::unique_ptr<adaptive_spin_wait_t> spinner_;
+      // Is the worker going to sleep or sleeping in the event_count?
+      // A producer of a demand for that preferred worker has to wake it up
+      // explicitly, because other workers may not steal the demand.
+      std::atomic<bool> parked_{false};
+      // Affinity hits and misses.
+      // NOTE: they are updated by the worker's thread only.
+      std::atomic<std::uint64_t> affinity_hits_{0u};
+      std::atomic<std::uint64_t> affinity_misses_{0u};
+      // Does the worker have a thread? Workers for all threads of the
+      // elastic pool are created in advance, a thread is started for
+      // an inactive worker and makes it inactive on retirement.
+      std::atomic<bool> active_{false};
+
+      worker_t(tricky_dispatcher_t * owner, unsigned index, std::size_t group)
+         :  owner_{owner}, index_{index}, group_{group}
+      {}
+   };
+
+   // State of queues for lock_free and work_stealing backends.
+   enum class queues_state_t {
+      // Demands can be pushed to and popped from queues.
+      open,
+      // New demands are ignored, but the remaining ones have to be handled.
+      closed_retain_content,
+      // New demands are ignored, the remaining ones have to be dropped.
+      closed_drop_content
+   };
+
+   // Type of queues for lanes.
+   const queue_backend_t queue_backend_;
+
+   // The channel for evt_start and evt_finish.
+   // NOTE: it's used regardless of queue_backend_ value.
+   so_5::mchain_t start_finish_ch_;
+
+   // Lanes, groups and workers. They aren't changed after the construction.
+   // Threads of the first group go first (the leader has index 0).
+   // NOTE: there are workers for the max count of threads of every group.
+   std::vector<std::unique_ptr<lane_t>> lanes_;
+   std::vector<std::unique_ptr<thread_group_t>> groups_;
+   std::vector<std::unique_ptr<worker_t>> workers_;
+
+   // Routing of demands to lanes.
+   std::unique_ptr<type_router_t> router_;
+   // Routing by the measured time of handling (if auto-classification
+   // is on). Light types go to the default lane of router_.
+   std::unique_ptr<service_time_classifier_t> classifier_;
+   std::size_t heavy_lane_{};
+
+   // Deadlines for lanes with lane_ordering_t::edf.
+   const deadline_extractor_t deadline_of_;
+
+   // The handler for demands rejected by bounded lanes.
+   const overflow_handler_t on_overflow_;
+
+   // Parameters of affinity routing.
+   const affinity_key_extractor_t affinity_key_of_;
+   const std::size_t affinity_steal_threshold_;
+
+   // The max count of demands extracted in one synchronized operation.
+   const std::size_t batch_size_;
+   // Is lane_scheduling_t::weighted used?
+   const bool weighted_;
+
+   // Should metrics be collected?
+   const bool metrics_;
+   // Size of the trace of every worker (zero if tracing is off).
+   const std::size_t trace_capacity_;
+   const bool tracing_;
+   // When the dispatcher was started.
+   const clock_t::time_point started_at_{ clock_t::now() };
+
+   // How threads are pinned to CPUs.
+   const pinning_t pinning_;
+   // NUMA nodes of CPUs for metrics.
+   const std::vector<int> numa_node_of_cpu_;
+
+   // How idle workers wait for new demands.
+   const wait_strategy_t wait_strategy_;
+   const adaptive_spin_wait_t::params_t spin_wait_params_;
+
+   // The worker of the current thread (if any).
+   static inline thread_local worker_t * current_worker_{nullptr};
+
+   // State of queues for lock_free and work_stealing backends.
+   std::atomic<queues_state_t> queues_state_{
+         queues_state_t::open};
+   // Producers of lock_free and work_stealing backends pass this gate,
+   // so the leader can wait for pushes that started before the closing.
+   push_gate_t push_gate_;
+
+   // The pool of worker threads for that dispatcher.
+   // NOTE: the index of a thread is the index of its worker_t, threads
+   // of inactive workers aren't joinable.
+   thread_pool_t work_threads_;
+
+   // Parameters of the elastic pool.
+   // NOTE: elastic_ isn't changed after the construction.
+   bool elastic_{false};
+   const clock_t::duration idle_timeout_;
+   // Counts of checks in a row that show an overloaded lane, an item
+   // for every lane. They are used by the monitor thread only.
+   std::vector<unsigned> overloaded_checks_;
+   // New threads can't be started before the handling of evt_start
+   // and after the start of the shutdown.
+   std::atomic<bool> started_{false};
+   std::atomic<bool> finishing_{false};
+   std::atomic<std::uint64_t> threads_added_{0u};
+   std::atomic<std::uint64_t> threads_retired_{0u};
+
+   // Parameters of the adaptive split mode.
+   const bool adaptive_split_;
+   const std::chrono::milliseconds rebalance_interval_;
+   const clock_t::duration rebalance_wait_threshold_;
+   const unsigned rebalance_hysteresis_;
+   const std::function<void(const role_change_t &)> on_role_change_;
+
+   // The thread for checking the load of lanes in the adaptive split mode
+   // and for the elastic pool.
+   std::thread monitor_thread_;
+   std::mutex monitor_lock_;
+   std::condition_variable monitor_wakeup_cv_;
+   bool monitor_stopped_{false};
+
+   // A move of a thread (from group, to group) that was selected
+   // during the last checks and the count of checks in a row.
+   // They are used by the monitor thread only.
+   std::optional<std::pair<std::size_t, std::size_t>> pending_move_;
+   unsigned pending_move_checks_{};
+
+   // The max count of role changes to be stored in recent_changes_.
+   static constexpr std::size_t max_recent_role_changes = 64u;
+   // The history of role changes and the current sizes of groups.
+   mutable std::mutex role_changes_lock_;
+   adaptive_split_stats_t adaptive_split_stats_{};
+
+   // The timer for schedule(). The wheel is used by the timer thread only,
+   // other threads put messages into timer buffers.
+   using timer_wheel_for_demands_t = timer_wheel_t<scheduled_message_uptr_t>;
+   const clock_t::duration timer_tick_;
+   std::unique_ptr<timer_wheel_for_demands_t> timer_wheel_;
+   // The buffer for messages scheduled by threads that aren't workers.
+   timer_buffer_t foreign_timer_buffer_;
+   std::thread timer_thread_;
+   std::mutex timer_lock_;
+   std::condition_variable timer_wakeup_cv_;
+   bool timer_stopped_{false};
+   // Is there a message that is earlier than the planned wakeup?
+   // NOTE: it's protected by timer_lock_.
+   bool timer_kicked_{false};
+   // The planned wakeup of the timer thread (time_since_epoch() of
+   // clock_t, the max value if the wheel is empty).
+   std::atomic<clock_t::rep> timer_wakeup_at_{
+         std::numeric_limits<clock_t::rep>::max()};
+
+   // Synchronization objects required for thread management.
+   //
+   // This one is for starting worker threads.
+   // The leader thread should wait while all workers are created.
+   rundown_latch_t launch_room_;
+   // This one is for handling evt_start,
+   // All workers (except the leader) have to wait while evt_start completed.
+   rundown_latch_t start_room_;
+   // This on is for handling evt_finish.
+   // The leader thread has to wait while all workers complete their work.
+   rundown_latch_t finish_room_;
+
+   // Types of messages for the separate lane in the configuration
+   // that is used if lanes aren't specified.
+   static inline const std::type_index init_device_type{
+         typeid(a_device_manager_t::init_device_t)};
+   static inline const std::type_index reinit_device_type{
+         typeid(so_5::mutable_msg<a_device_manager_t::reinit_device_t>)};
+
+   // Helper method for making the params with lanes and groups.
+   // If lanes aren't specified then there will be two lanes: for
+   // init/reinit demands and for all other demands (or for heavy and
+   // light demands if auto-classification is on). Threads of the first
+   // type serve both lanes, threads of the second type serve the
+   // second lane only.
+   static disp_params_t complete_params(const disp_params_t & params) {
+      if(!params.lanes_.empty())
+         return params;
+
+      auto result = params;
+      const auto [first_type_count, second_type_count] =
+            split_pool_t::sizes(params.pool_size_);
+      const auto [first_type_max, second_type_max] = params.max_pool_size_ ?
+            split_pool_t::sizes(params.max_pool_size_) :
+            std::make_pair(0u, 0u);
+
+      auto & first_lane = result.add_lane(
+            params.auto_classification_ ? "heavy" : "init_reinit")
+         .ordering(params.default_lanes_ordering_)
+         .limits(params.init_reinit_lane_limits_)
+         .weight(params.init_reinit_lane_weight_);
+      if(!params.auto_classification_)
+         first_lane.types_ = {init_device_type, reinit_device_type};
+      result.add_lane(params.auto_classification_ ? "light" : "other")
+         .ordering(params.default_lanes_ordering_)
+         .limits(params.other_lane_limits_)
+         .weight(params.other_lane_weight_);
+      // NOTE: the leader is always a thread of the first type
+      // even if first_type_count is zero.
+      result.heavy_lane_ = 0u;
+      result.default_lane(1u)
+         .add_thread_group("first", std::max(first_type_count, 1u), {0u, 1u},
+               params.first_type_cpus_,
+               first_type_max ? std::max(first_type_max, first_type_count) : 0u)
+         .add_thread_group("second", second_type_count, {1u},
+               params.second_type_cpus_,
+               second_type_max ? std::max(second_type_max, second_type_count) : 0u);
+
+      return result;
+   }
+
+   // Helper method for checking the consistency of params.
+   static void check_params(const disp_params_t & params) {
+      const auto fail = [](const std::string & what) {
+         throw std::invalid_argument{"tricky_dispatcher: " + what};
+      };
+
+      if(params.adaptive_split_ &&
+            queue_backend_t::lock_free != params.queue_backend_)
+         fail("adaptive split requires lock-free queues");
+
+      const bool elastic = std::any_of(
+            params.thread_groups_.begin(), params.thread_groups_.end(),
+            [](const thread_group_params_t & g) {
+               return g.max_threads_ > g.threads_;
+            });
+      if(elastic && params.adaptive_split_)
+         fail("elastic pool can't be used in the adaptive split mode");
+      if(elastic && params.idle_timeout_.count() <= 0)
+         fail("idle timeout has to be positive");
+
+      if(queue_backend_t::mchain == params.queue_backend_ &&
+            std::any_of(params.lanes_.begin(), params.lanes_.end(),
+               [](const lane_params_t & l) {
+                  return lane_ordering_t::edf == l.ordering_;
+               }))
+         fail("EDF lanes require lock-free or work-stealing queues");
+
+      for(const auto & l : params.lanes_) {
+         if(l.limits_.capacity_ &&
+               overflow_policy_t::block == l.limits_.overflow_policy_ &&
+               l.limits_.block_timeout_.count() <= 0)
+            fail("block timeout has to be positive for lane " + l.name_);
+         // A rejection without the handler throws, but the timer thread
+         // can't pass the exception to anybody.
+         if(params.timer_wheel_ && l.limits_.capacity_ &&
+               !params.on_overflow_ &&
+               (overflow_policy_t::reject == l.limits_.overflow_policy_ ||
+                  overflow_policy_t::block == l.limits_.overflow_policy_))
+            fail("the timer requires the overflow handler for lane " + l.name_);
+      }
+
+      if(params.affinity_key_of_ &&
+            queue_backend_t::work_stealing != params.queue_backend_)
+         fail("affinity routing requires work-stealing queues");
+
+      if(!params.batch_size_)
+         fail("batch size can't be zero");
+      if(params.timer_wheel_ && params.timer_tick_.count() <= 0)
+         fail("timer tick has to be positive");
+      if(wait_strategy_t::spin_then_park == params.wait_strategy_ &&
+            (params.spin_wait_.min_spin_.count() < 0 ||
+               params.spin_wait_.min_spin_ > params.spin_wait_.max_spin_))
+         fail("invalid limits of spinning");
+      if(queue_backend_t::mchain == params.queue_backend_ &&
+            params.batch_size_ > 1u)
+         fail("batches require lock-free or work-stealing queues");
+      if(lane_scheduling_t::weighted == params.lane_scheduling_) {
+         if(queue_backend_t::mchain == params.queue_backend_)
+            fail("weighted lanes require lock-free or work-stealing queues");
+         if(params.batch_size_ > 1u)
+            fail("batches can't be used with weighted lanes");
+      }
+      for(const auto & l : params.lanes_)
+         if(!l.weight_)
+            fail("weight has to be positive for lane " + l.name_);
+
+      if(params.default_lane_ >= params.lanes_.size())
+         fail("invalid index of the default lane");
+      if(params.auto_classification_) {
+         if(params.heavy_lane_ >= params.lanes_.size())
+            fail("invalid index of the heavy lane");
+         if(params.heavy_lane_ == params.default_lane_)
+            fail("the heavy lane can't be the default lane");
+         if(std::any_of(params.lanes_.begin(), params.lanes_.end(),
+               [](const lane_params_t & l) { return !l.types_.empty(); }))
+            fail("lanes can't have types with auto-classification");
+         if(params.classifier_.light_threshold_ >
+               params.classifier_.heavy_threshold_)
+            fail("light threshold is greater than heavy threshold");
+         if(!params.classifier_.decay_window_)
+            fail("decay window can't be zero");
+      }
+      if(params.thread_groups_.empty())
+         fail("there are no thread groups");
+
+      std::vector<bool> served(params.lanes_.size(), false);
+      for(const auto & g : params.thread_groups_) {
+         if(!g.threads_)
+            fail("there are no threads in group " + g.name_);
+         if(g.max_threads_ && g.max_threads_ < g.threads_)
+            fail("max count of threads is less than count of threads "
+                  "for group " + g.name_);
+         if(g.lanes_.empty())
+            fail("there are no lanes for group " + g.name_);
+         if(queue_backend_t::mchain == params.queue_backend_ &&
+               g.lanes_.size() > max_mchain_lanes_per_group)
+            fail("too many lanes for group " + g.name_);
+         if(lane_scheduling_t::weighted == params.lane_scheduling_ &&
+               g.lanes_.size() > max_weighted_lanes_per_group)
+            fail("too many weighted lanes for group " + g.name_);
+
+         for(const auto l : g.lanes_) {
+            if(l >= params.lanes_.size())
+               fail("invalid lane index for group " + g.name_);
+            if(std::count(g.lanes_.begin(), g.lanes_.end(), l) > 1)
+               fail("duplicate lanes for group " + g.name_);
+            served[l] = true;
+         }
+      }
+
+      for(std::size_t l = 0u; l != served.size(); ++l)
+         if(!served[l])
+            fail("there are no threads for lane " + params.lanes_[l].name_);
+
+      std::vector<std::type_index> types;
+      for(const auto & l : params.lanes_)
+         types.insert(types.end(), l.types_.begin(), l.types_.end());
+      std::sort(types.begin(), types.end());
+      if(types.end() != std::adjacent_find(types.begin(), types.end()))
+         fail("the same message type is specified for several lanes");
+   }
+
+   // CPUs of the group that serves the lane (groups with less count of
+   // lanes are preferred). Empty list if threads aren't pinned.
+   static cpu_list_t consumer_cpus_of_lane(
+         const disp_params_t & params,
+         std::size_t lane) {
+      if(pinning_t::none == params.pinning_)
+         return {};
+
+      const thread_group_params_t * consumer = nullptr;
+      for(const auto & g : params.thread_groups_)
+         if(std::count(g.lanes_.begin(), g.lanes_.end(), lane) &&
+               (!consumer || g.lanes_.size() < consumer->lanes_.size()))
+            consumer = &g;
+
+      return consumer ? consumer->cpus_ : cpu_list_t{};
+   }
+
+   // Helper method for creation of lanes, groups and workers.
+   void make_lanes_and_workers(
+         so_5::environment_t & env,
+         const disp_params_t & params) {
+      type_router_t::routes_t routes;
+      for(std::size_t l = 0u; l != params.lanes_.size(); ++l) {
+         const auto & lane_params = params.lanes_[l];
+         auto lane = std::make_unique<lane_t>(lane_params.name_);
+         lane->limits_ = lane_params.limits_;
+         lane->weight_ = lane_params.weight_;
+         const auto capacity = lane->limits_.capacity_;
+
+         if(lane_ordering_t::edf == lane_params.ordering_) {
+            lane->edf_queue_ = std::make_unique<edf_queue_t>();
+            if(capacity)
+               lane->edf_queue_->reserve(capacity);
+         }
+
+         switch(queue_backend_) {
+         case queue_backend_t::mchain:
+            // The storage of a bounded lane is preallocated. The chain
+            // can't overflow because places are reserved before pushes.
+            lane->ch_ = capacity ?
+                  so_5::create_mchain(env,
+                        capacity,
+                        so_5::mchain_props::memory_usage_t::preallocated,
+                        so_5::mchain_props::overflow_reaction_t::abort_app) :
+                  so_5::create_mchain(env);
+         break;
+
+         case queue_backend_t::lock_free:
+            // The memory of the queue should be on the NUMA node of
+            // its consumers.
+            if(!lane->edf_queue_)
+               lane->queue_ = call_on_cpus(consumer_cpus_of_lane(params, l),
+                     [&] {
+                        return std::make_unique<lock_free_queue_t>(
+                              capacity ? capacity :
+                                    params.lock_free_queue_capacity_);
+                     });
+         break;
+
+         case queue_backend_t::work_stealing:
+         break;
+         }
+
+         for(const auto & t : lane_params.types_)
+            routes.emplace_back(t, l);
+         lanes_.push_back(std::move(lane));
+      }
+      router_ = std::make_unique<type_router_t>(routes, params.default_lane_);
+      if(params.auto_classification_) {
+         classifier_ = std::make_unique<service_time_classifier_t>(
+               params.classifier_);
+         heavy_lane_ = params.heavy_lane_;
+      }
+
+      for(std::size_t g = 0u; g != params.thread_groups_.size(); ++g) {
+         const auto & group_params = params.thread_groups_[g];
+         const auto max_threads = std::max(
+               group_params.threads_, group_params.max_threads_);
+         groups_.push_back(std::make_unique<thread_group_t>(
+               group_params.name_, group_params.lanes_,
+               group_params.threads_, max_threads));
+         for(const auto l : group_params.lanes_)
+            lanes_[l]->groups_.push_back(g);
+         if(max_threads > group_params.threads_)
+            elastic_ = true;
+
+         for(auto i = 0u; i != max_threads; ++i) {
+            const auto index = static_cast<unsigned>(workers_.size());
+            auto w = std::make_unique<worker_t>(this, index, g);
+            // Threads above the min count are started on demand.
+            w->active_.store(i < group_params.threads_, std::memory_order_relaxed);
+            w->batch_.reserve(batch_size_);
+            if(pinning_t::core == pinning_ && !group_params.cpus_.empty())
+               w->pinned_to_ = cpu_list_t{
+                     group_params.cpus_[i % group_params.cpus_.size()]};
+            else if(pinning_t::core_set == pinning_)
+               w->pinned_to_ = group_params.cpus_;
+            if(wait_strategy_t::spin_then_park == wait_strategy_)
+               w->spinner_ = std::make_unique<adaptive_spin_wait_t>(
+                     spin_wait_params_);
+            if(metrics_)
+               // NOTE: the group of a worker can be changed, so metrics
+               // are necessary for every lane.
+               for(std::size_t l = 0u; l != lanes_.size(); ++l)
+                  w->lane_metrics_.push_back(
+                        std::make_unique<worker_lane_metrics_t>());
+            if(tracing_)
+               w->trace_ = std::make_unique<demand_trace_ring_t>(
+                     trace_capacity_);
+            if(weighted_)
+               w->vtime_.assign(lanes_.size(), 0.0);
+            if(metrics_ || weighted_)
+               w->served_ns_ = std::make_unique<std::atomic<std::uint64_t>[]>(
+                     lanes_.size());
+            if(queue_backend_t::work_stealing == queue_backend_) {
+               w->local_queues_.resize(lanes_.size());
+               for(const auto l : group_params.lanes_) {
+                  // EDF lanes don't use local queues.
+                  if(lanes_[l]->edf_queue_)
+                     continue;
+                  w->local_queues_[l] = std::make_unique<stealable_queue_t>();
+                  lanes_[l]->workers_.push_back(index);
+               }
+            }
+            workers_.push_back(std::move(w));
+         }
+
+         adaptive_split_stats_.group_threads_.push_back(group_params.threads_);
+      }
+
+      overloaded_checks_.resize(lanes_.size());
+
+      // Groups dedicated to a lane should be woken up first.
+      for(auto & lane : lanes_)
+         std::stable_sort(lane->groups_.begin(), lane->groups_.end(),
+               [this](std::size_t a, std::size_t b) {
+                  return groups_[a]->lanes_.size() < groups_[b]->lanes_.size();
+               });
+   }
+
+   // Helper method for closing lock-free or work-stealing queues.
+   // All waiting threads are woken up.
+   void close_queues(queues_state_t state) noexcept {
+      push_gate_.close();
+      queues_state_.store(state, std::memory_order_release);
+      for(auto & g : groups_)
+         g->waiters_.notify_all();
+   }
+
+   // Helper method for stopping the monitor thread.
+   void stop_monitor_thread() noexcept {
+      if(!monitor_thread_.joinable())
+         return;
+
+      {
+         std::lock_guard<std::mutex> lock{monitor_lock_};
+         monitor_stopped_ = true;
+      }
+      monitor_wakeup_cv_.notify_one();
+      monitor_thread_.join();
+   }
+
+   // Helper method for stopping the timer thread.
+   // Demands that remain in the timer are dropped.
+   void stop_timer_thread() noexcept {
+      if(!timer_thread_.joinable())
+         return;
+
+      {
+         std::lock_guard<std::mutex> lock{timer_lock_};
+         timer_stopped_ = true;
+      }
+      timer_wakeup_cv_.notify_one();
+      timer_thread_.join();
+   }
+
+   // Helper method for shutdown and join all threads.
+   void shutdown_work_threads() noexcept {
+      // There shouldn't be new demands from the timer.
+      stop_timer_thread();
+      // Groups of threads shouldn't be changed anymore.
+      finishing_.store(true, std::memory_order_release);
+      stop_monitor_thread();
+
+      // All channels should be closed first.
+      so_5::close_drop_content(so_5::terminate_if_throws, start_finish_ch_);
+      if(queue_backend_t::mchain == queue_backend_) {
+         for(auto & lane : lanes_)
+            so_5::close_drop_content(so_5::terminate_if_throws, lane->ch_);
+      }
+      else
+         close_queues(queues_state_t::closed_drop_content);
+
+      // Now all threads can be joined.
+      for(auto & t : work_threads_)
+         if(t.joinable())
+            t.join();
+
+      // The pool should be dropped.
+      work_threads_.clear();
+   }
+
+   // Launch all threads.
+   // If there is an error then all previously started threads
+   // should be stopped.
+   void launch_work_threads() {
+      work_threads_.resize(workers_.size());
+      try {
+         // The leader has to be suspended until all workers will be created.
+         auto_acquire_release_rundown_latch_t launch_room_changer{launch_room_};
+
+         // Start the leader thread first.
+         work_threads_[0u] = std::thread{[this]{
+               place_current_thread(*workers_[0u]);
+               leader_thread_body();
+            }};
+
+         // Now we can launch all remaining workers.
+         // NOTE: threads for inactive workers are started by
+         // the elastic pool later.
+         for(auto i = 1u; i < workers_.size(); ++i)
+            if(workers_[i]->active_.load(std::memory_order_relaxed))
+               work_threads_[i] = std::thread{[this, i]{
+                     place_current_thread(*workers_[i]);
+                     worker_thread_body(i);
+                  }};
+      }
+      catch(...) {
+         shutdown_work_threads();
+         throw; // Rethrow an exception to be handled somewhere upper.
+      }
+   }
+
+   // Pins the current thread to CPUs of the worker (if necessary).
+   // NOTE: a failure isn't an error, the actual CPUs are visible
+   // in metrics.
+   static void place_current_thread(worker_t & w) {
+      if(!w.pinned_to_.empty() && !pin_current_thread(w.pinned_to_))
+         w.pinned_to_.clear();
+      note_current_cpu(w);
+   }
+
+   // Updates affinity counters of the worker.
+   static void note_affinity(worker_t & w, bool hit) noexcept {
+      auto & counter = hit ? w.affinity_hits_ : w.affinity_misses_;
+      counter.store(counter.load(std::memory_order_relaxed) + 1u,
+            std::memory_order_relaxed);
+   }
+
+   // Updates the last observed CPU of the worker.
+   static void note_current_cpu(worker_t & w) noexcept {
+      const auto cpu = current_cpu();
+      const auto last = w.last_cpu_.load(std::memory_order_relaxed);
+      if(cpu != last) {
+         w.last_cpu_.store(cpu, std::memory_order_relaxed);
+         if(last >= 0)
+            w.cpu_migrations_.store(
+                  w.cpu_migrations_.load(std::memory_order_relaxed) + 1u,
+                  std::memory_order_relaxed);
+      }
+   }
+
+   // A handler for so_5::execution_demand_t.
+   static void exec_demand_handler(so_5::execution_demand_t d) {
+      d.call_handler(so_5::null_current_thread_id());
+   }
+
+   // Should demands have the time of their pushing?
+   bool need_push_time() const noexcept {
+      return adaptive_split_ || elastic_ || metrics_ || tracing_;
+   }
+
+   // Handling of a demand from the specified lane.
+   // Statistics for the adaptive split mode, metrics and the trace
+   // are updated here.
+   void handle_demand(
+         worker_t & w,
+         std::size_t lane_index,
+         timed_demand_t & td) {
+      if(no_preferred_worker != td.preferred_worker_)
+         note_affinity(w, td.preferred_worker_ == w.index_);
+
+      if(!need_push_time() && !weighted_ && !classifier_) {
+         exec_demand_handler(std::move(td.demand_));
+         return;
+      }
+
+      const auto started_at = clock_t::now();
+      const auto wait = started_at - td.pushed_at_;
+      if(adaptive_split_ || elastic_) {
+         auto & lane = *lanes_[lane_index];
+         lane.total_wait_.fetch_add(wait.count(), std::memory_order_relaxed);
+         lane.extracted_.fetch_add(1u, std::memory_order_relaxed);
+      }
+
+      const auto msg_type_index = td.demand_.m_msg_type;
+      // The name has the static storage duration, see demand_trace_event_t.
+      const char * msg_type = tracing_ ? msg_type_index.name() : nullptr;
+
+      exec_demand_handler(std::move(td.demand_));
+
+      if(!metrics_ && !tracing_ && !weighted_ && !classifier_)
+         return;
+
+      const auto finished_at = clock_t::now();
+      const auto service = finished_at - started_at;
+      if(classifier_)
+         classifier_->record(msg_type_index, service);
+      if(w.served_ns_) {
+         // There is only one writer, so RMW-operations aren't necessary.
+         auto & served = w.served_ns_[lane_index];
+         served.store(served.load(std::memory_order_relaxed) + to_ns(service),
+               std::memory_order_relaxed);
+      }
+      if(weighted_)
+         w.vtime_[lane_index] += static_cast<double>(to_ns(service)) /
+               lanes_[lane_index]->weight_;
+
+      if(tracing_)
+         w.trace_->record(demand_trace_event_t{
+               to_ns(td.pushed_at_ - started_at_),
+               to_ns(td.dequeued_at_ - started_at_),
+               to_ns(started_at - started_at_),
+               to_ns(finished_at - started_at_),
+               msg_type,
+               static_cast<std::uint32_t>(lane_index) });
+
+      if(metrics_) {
+         note_current_cpu(w);
+         // There is only one writer, so RMW-operations aren't necessary.
+         auto & m = *w.lane_metrics_[lane_index];
+         m.handled_.store(m.handled_.load(std::memory_order_relaxed) + 1u,
+               std::memory_order_relaxed);
+         m.wait_ns_.record(to_ns(wait));
+         m.service_ns_.record(to_ns(service));
+         w.busy_.store(w.busy_.load(std::memory_order_relaxed) + service.count(),
+               std::memory_order_relaxed);
+      }
+   }
+
+   static std::uint64_t to_ns(clock_t::duration d) noexcept {
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+      return ns > 0 ? static_cast<std::uint64_t>(ns) : 0u;
+   }
+
+   // Helper method for updating metrics after a push to the lane.
+   static void note_enqueued(lane_t & lane) noexcept {
+      const auto enqueued = lane.enqueued_.fetch_add(
+            1u, std::memory_order_relaxed) + 1u;
+      const auto dequeued = lane.dequeued_.load(std::memory_order_relaxed);
+      const auto depth = enqueued > dequeued ? enqueued - dequeued : 0u;
+      auto max_depth = lane.max_depth_.load(std::memory_order_relaxed);
+      while(depth > max_depth &&
+            !lane.max_depth_.compare_exchange_weak(
+                  max_depth, depth, std::memory_order_relaxed))
+         ;
+   }
+
+   // Helper method for updating metrics after an extraction from the lane.
+   // Places of extracted demands in a bounded lane are released.
+   void note_dequeued(lane_t & lane, std::size_t count) {
+      if(metrics_)
+         lane.dequeued_.fetch_add(count, std::memory_order_relaxed);
+
+      if(lane.limits_.capacity_) {
+         lane.size_.fetch_sub(count, std::memory_order_relaxed);
+         if(overflow_policy_t::block == lane.limits_.overflow_policy_)
+            // notify_one is cheap if there are no waiting producers.
+            for(; count && lane.space_waiters_.notify_one(); --count)
+               ;
+      }
+   }
+
+   // Helper method for handling demands from the specified count of
+   // mchains. Runs until all channels will be closed.
+   template<std::size_t... I>
+   void select_from_lanes(
+         worker_t & w,
+         const std::vector<std::size_t> & lanes,
+         std::index_sequence<I...>) {
+      // Is the worker sleeping inside select after the spinning?
+      // NOTE: the wakeup is noted before the handling of the first demand,
+      // otherwise the time of the handling is counted as the idle time.
+      bool parked = false;
+      const auto note_wakeup = [&w, &parked] {
+         if(parked) {
+            parked = false;
+            w.spinner_->parked_until_now();
+         }
+      };
+
+      const auto make_case = [this, &w, &note_wakeup](std::size_t lane_index) {
+         return receive_case(lanes_[lane_index]->ch_,
+               [this, &w, &note_wakeup, lane_index](timed_demand_t td) {
+                  note_wakeup();
+                  if(tracing_)
+                     td.dequeued_at_ = clock_t::now();
+                  note_dequeued(*lanes_[lane_index], 1u);
+                  handle_demand(w, lane_index, td);
+               });
+      };
+
+      if(!w.spinner_ && !elastic_) {
+         so_5::select(so_5::from_all().handle_all(), make_case(lanes[I])...);
+         return;
+      }
+
+      // All available demands are handled without waiting, then the
+      // worker spins while mchains are empty (for spin-then-park), then
+      // it sleeps inside select until the next demand (but no longer than
+      // idle_timeout_ for the elastic pool).
+      auto wait_params = so_5::from_all().handle_n(1);
+      if(elastic_)
+         wait_params.empty_timeout(idle_timeout_);
+
+      const auto handle_available = so_5::prepare_select(
+            so_5::from_all().handle_all().no_wait_on_empty(),
+            make_case(lanes[I])...);
+      const auto wait_for_one = so_5::prepare_select(
+            std::move(wait_params),
+            make_case(lanes[I])...);
+      const auto closed = [](const so_5::mchain_receive_result_t & r) {
+         return so_5::extraction_status_t::chain_closed == r.status();
+      };
+
+      for(;;) {
+         if(closed(so_5::select(handle_available)))
+            break;
+
+         // NOTE: the closing of mchains isn't detected while spinning,
+         // it's detected by the next select.
+         if(w.spinner_ && w.spinner_->spin([&] {
+               return (!lanes_[lanes[I]]->ch_->empty() || ...);
+            }))
+            continue;
+
+         parked = nullptr != w.spinner_;
+         const auto r = so_5::select(wait_for_one);
+         // The select can be finished without demands.
+         note_wakeup();
+         if(closed(r))
+            break;
+         // Nothing has arrived during idle_timeout_.
+         if(!r.handled() && try_retire(w))
+            break;
+      }
+   }
+
+   template<std::size_t N>
+   void select_from_n_lanes(
+         worker_t & w,
+         const std::vector<std::size_t> & lanes) {
+      select_from_lanes(w, lanes, std::make_index_sequence<N>{});
+   }
+
+   // Handling of demands in the case of queue_backend_t::mchain.
+   // so_5::select requires all cases at compile time, so the count of
+   // lanes is mapped to the appropriate instantiation of select_from_lanes.
+   template<std::size_t... N>
+   void select_from_lanes_of_group(
+         worker_t & w,
+         const thread_group_t & group,
+         std::index_sequence<N...>) {
+      using method_t = void (tricky_dispatcher_t::*)(
+            worker_t &, const std::vector<std::size_t> &);
+      static constexpr method_t methods[] = {
+            &tricky_dispatcher_t::select_from_n_lanes<N + 1u>...
+         };
+
+      (this->*methods[group.lanes_.size() - 1u])(w, group.lanes_);
+   }
+
+   // Helper method for stealing a demand from the local queues of other
+   // workers for the specified lane. Workers are checked starting from
+   // the next one after the thief.
+   bool try_steal_from(
+         worker_t & thief,
+         std::size_t lane_index,
+         timed_demand_t & d) {
+      const auto & victims = lanes_[lane_index]->workers_;
+      for(std::size_t i = 1u; i <= victims.size(); ++i) {
+         const auto victim_index = victims[(thief.index_ + i) % victims.size()];
+         if(victim_index == thief.index_)
+            continue;
+
+         auto & victim = *workers_[victim_index];
+         // With affinity routing demands are stolen only from overloaded
+         // workers (and from retired workers of the elastic pool).
+         if(affinity_key_of_ &&
+               victim.active_.load(std::memory_order_relaxed) &&
+               victim.local_queues_[lane_index]->approx_size() <
+                     affinity_steal_threshold_)
+            continue;
+
+         if(victim.local_queues_[lane_index]->try_steal(d, thief.stolen_)) {
+            // The remaining stolen demands go to the thief's queue.
+            for(auto & s : thief.stolen_)
+               thief.local_queues_[lane_index]->push(std::move(s));
+            thief.stolen_.clear();
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   // Helper method for extraction of up to max demands from a lane.
+   // Every extracted demand is passed to sink as rvalue.
+   //
+   // In the case of queue_backend_t::work_stealing the own queue is
+   // checked first, then queues of other workers that serve the same lane.
+   // EDF lanes have only the shared queue.
+   template<typename Sink>
+   std::size_t try_pop_from(
+         worker_t & w,
+         std::size_t lane_index,
+         std::size_t max,
+         Sink && sink) {
+      // Extracted demands get the time of the extraction if tracing is on.
+      // The clock is read only if something is extracted.
+      clock_t::time_point dequeued_at{};
+      const auto stamping_sink = [&](timed_demand_t && td) {
+         if(tracing_) {
+            if(clock_t::time_point{} == dequeued_at)
+               dequeued_at = clock_t::now();
+            td.dequeued_at_ = dequeued_at;
+         }
+         sink(std::move(td));
+      };
+
+      auto & lane = *lanes_[lane_index];
+      std::size_t count = 0u;
+      if(lane.edf_queue_)
+         count = lane.edf_queue_->try_pop_bulk(max, stamping_sink);
+      else if(lane.queue_)
+         count = lane.queue_->try_pop_bulk(max, stamping_sink);
+      else {
+         count = w.local_queues_[lane_index]->try_pop_bulk(max, stamping_sink);
+
+         timed_demand_t td;
+         if(!count && try_steal_from(w, lane_index, td)) {
+            stamping_sink(std::move(td));
+            count = 1u;
+         }
+      }
+
+      if(count)
+         note_dequeued(lane, count);
+      return count;
+   }
+
+   // Helper method for extraction of a batch of demands.
+   // Lanes are checked in the order of their priority, the batch is
+   // taken from the first non-empty lane.
+   bool try_pop_batch(worker_t & w) {
+      const auto group = w.group_.load(std::memory_order_relaxed);
+      const auto & lanes = groups_[group]->lanes_;
+      const auto sink = [&w](timed_demand_t && td) {
+            w.batch_.push_back(std::move(td));
+         };
+      if(weighted_) {
+         const auto pos = try_pop_weighted(w, lanes, sink);
+         if(lanes.size() == pos)
+            return false;
+         w.batch_group_ = group;
+         w.batch_lane_pos_ = pos;
+         return true;
+      }
+
+      for(std::size_t pos = 0u; pos != lanes.size(); ++pos)
+         if(try_pop_from(w, lanes[pos], batch_size_, sink)) {
+            w.batch_group_ = group;
+            w.batch_lane_pos_ = pos;
+            return true;
+         }
+
+      return false;
+   }
+
+   // Helper method for extraction of a demand with lane_scheduling_t::weighted.
+   //
+   // Lanes are checked in the order of their virtual times, so the lane
+   // that got the least time relative to its weight is served first.
+   // An empty lane can't save its turns for the future: its virtual time
+   // is moved forward to the virtual time of the last served lane.
+   // This way the worker never idles while there are demands, and
+   // backlogged lanes get its time in proportion to their weights.
+   //
+   // Returns the position of the lane in lanes or lanes.size()
+   // if all lanes are empty.
+   template<typename Sink>
+   std::size_t try_pop_weighted(
+         worker_t & w,
+         const std::vector<std::size_t> & lanes,
+         Sink && sink) {
+      std::uint64_t checked = 0u;
+      for(std::size_t attempt = 0u; attempt != lanes.size(); ++attempt) {
+         // Lanes with equal virtual times are checked in the priority order.
+         auto pos = lanes.size();
+         for(std::size_t i = 0u; i != lanes.size(); ++i)
+            if(!(checked & (std::uint64_t{1u} << i)) &&
+                  (lanes.size() == pos ||
+                     w.vtime_[lanes[i]] < w.vtime_[lanes[pos]]))
+               pos = i;
+         checked |= std::uint64_t{1u} << pos;
+
+         auto & vtime = w.vtime_[lanes[pos]];
+         if(try_pop_from(w, lanes[pos], 1u, sink)) {
+            w.vclock_ = vtime;
+            return pos;
+         }
+         vtime = std::max(vtime, w.vclock_);
+      }
+
+      return lanes.size();
+   }
+
+   // Handling of demands from the batch.
+   //
+   // Demands are handled back to back. But if the batch is taken from
+   // a lane with lower priority then a demand from lanes with higher
+   // priority (if any) is handled before every next demand from the batch.
+   // So a batch can't delay a demand with higher priority for more
+   // than the handling of one demand.
+   void handle_batch(worker_t & w) {
+      const auto & lanes = groups_[w.batch_group_]->lanes_;
+      for(std::size_t i = 0u; i != w.batch_.size(); ++i) {
+         for(std::size_t pos = 0u; i && pos != w.batch_lane_pos_; ++pos) {
+            timed_demand_t td;
+            if(try_pop_from(w, lanes[pos], 1u,
+                  [&td](timed_demand_t && x) { td = std::move(x); })) {
+               handle_demand(w, lanes[pos], td);
+               break;
+            }
+         }
+
+         handle_demand(w, lanes[w.batch_lane_pos_], w.batch_[i]);
+      }
+
+      w.batch_.clear();
+   }
+
+   // Handling of demands from lock-free or work-stealing queues.
+   // Works until queues will be closed. If queues are closed with
+   // retaining of the content then all remaining demands are handled.
+   void queues_loop(worker_t & w) {
+      for(;;) {
+         w.parked_.store(false, std::memory_order_relaxed);
+
+         const auto state = queues_state_.load(
+               std::memory_order_acquire);
+         if(queues_state_t::closed_drop_content == state)
+            break;
+
+         if(try_pop_batch(w)) {
+            handle_batch(w);
+            continue;
+         }
+
+         // There is nothing to do. But it's necessary to re-check queues
+         // after the registration as a waiter, otherwise a notification
+         // can be lost.
+         // NOTE: the group of the thread can be changed in the adaptive
+         // split mode, but all waiters are woken up in that case.
+         // NOTE: it isn't necessary to spin if queues are closed.
+         if(w.spinner_ && queues_state_t::open == state &&
+               w.spinner_->spin([&]{ return try_pop_batch(w); })) {
+            handle_batch(w);
+            continue;
+         }
+
+         auto & waiters =
+               groups_[w.group_.load(std::memory_order_relaxed)]->waiters_;
+         // NOTE: the flag has to be visible before the re-check of queues.
+         w.parked_.store(true);
+         // NOTE: the state is loaded again after the registration as
+         // a waiter. If queues are closed between the first load and
+         // the registration then the ticket already includes
+         // the notification from close_queues().
+         const auto r = park_until_work(waiters,
+               [&]{ return try_pop_batch(w); },
+               [this]{
+                  return queues_state_t::open !=
+                        queues_state_.load(std::memory_order_acquire);
+               },
+               elastic_ ? idle_timeout_ : clock_t::duration::zero());
+         if(park_result_t::work_found == r) {
+            w.parked_.store(false, std::memory_order_relaxed);
+            handle_batch(w);
+            continue;
+         }
+         if(park_result_t::closed == r)
+            // Queues are closed and empty, the work is finished.
+            break;
+
+         if(w.spinner_)
+            w.spinner_->parked_until_now();
+         if(park_result_t::timed_out == r && try_retire(w)) {
+            // The notification could be taken by that thread at
+            // the moment of the timeout, so it's passed to another one.
+            waiters.notify_one();
+            break;
+         }
+      }
+   }
+
+   // The body of the leader thread.
+   void leader_thread_body() {
+      // We have to wait while all workers are created.
+      // NOTE: not all of them can start their work actually, but all
+      // std::thread objects should be created.
+      launch_room_.wait_then_close();
+
+      {
+         // We have to block all other threads until evt_start will be processed.
+         auto_acquire_release_rundown_latch_t start_room_changer{start_room_};
+         // Process evt_start.
+         so_5::receive(so_5::from(start_finish_ch_).handle_n(1),
+               exec_demand_handler);
+      }
+      // Since now the elastic pool can start new threads.
+      started_.store(true, std::memory_order_release);
+
+      // Now the leader can play the role of an ordinary worker.
+      worker_thread_body(0u);
+
+      // All worker should finish their work before processing of evt_finish.
+      finish_room_.wait_then_close();
+
+      // A producer could pass the gate before the closing of queues, but
+      // push its demand after workers saw empty queues and finished.
+      if(queue_backend_t::mchain != queue_backend_ &&
+            queues_state_t::closed_retain_content ==
+               queues_state_.load(std::memory_order_acquire)) {
+         push_gate_.wait_for_producers();
+         drain_queues(*workers_[0u]);
+      }
+
+      // Process evt_finish.
+      so_5::receive(so_5::from(start_finish_ch_).handle_n(1),
+            exec_demand_handler);
+   }
+
+   // Handling of demands that remain in lock-free or work-stealing queues
+   // after the finish of all workers.
+   void drain_queues(worker_t & w) {
+      timed_demand_t td;
+      const auto take = [&td](timed_demand_t && x) { td = std::move(x); };
+      for(std::size_t l = 0u; l != lanes_.size(); ++l) {
+         auto & lane = *lanes_[l];
+         for(;;) {
+            std::size_t count = 0u;
+            if(lane.edf_queue_ || lane.queue_)
+               count = try_pop_from(w, l, 1u, take);
+            else
+               // Demands can be in local queues of any worker of the lane.
+               for(const auto i : lane.workers_)
+                  if(0u != (count = workers_[i]->local_queues_[l]
+                        ->try_pop_bulk(1u, take))) {
+                     note_dequeued(lane, count);
+                     break;
+                  }
+
+            if(!count)
+               break;
+            handle_demand(w, l, td);
+         }
+      }
+   }
+
+   // The body for a worker thread.
+   void worker_thread_body(unsigned worker_index) {
+      // Processing of evt_finish has to be enabled at the end.
+      auto_acquire_release_rundown_latch_t finish_room_changer{finish_room_};
+
+      // Wait while evt_start is processed.
+      start_room_.wait_then_close();
+
+      serve_demands(*workers_[worker_index]);
+   }
+
+   // The body for a thread started by the elastic pool.
+   void late_worker_thread_body(unsigned worker_index) {
+      // NOTE: finish_room_ is acquired by the starter of the thread,
+      // and evt_start is already processed.
+      auto_acquire_release_rundown_latch_t finish_room_changer{
+            finish_room_, std::adopt_lock};
+
+      serve_demands(*workers_[worker_index]);
+   }
+
+   // Handling of demands by a worker until the shutdown
+   // (or the retirement of the thread).
+   void serve_demands(worker_t & w) {
+      // Demands sent or scheduled from this thread should go to
+      // the local queues and the local timer buffer.
+      current_worker_ = &w;
+
+      // Run until all channels will be closed.
+      switch(queue_backend_) {
+      case queue_backend_t::mchain:
+         // NOTE: the group is never changed for that backend.
+         select_from_lanes_of_group(w, *groups_[w.group_.load()],
+               std::make_index_sequence<max_mchain_lanes_per_group>{});
+      break;
+
+      case queue_backend_t::lock_free:
+         queues_loop(w);
+      break;
+
+      case queue_backend_t::work_stealing:
+         queues_loop(w);
+      break;
+      }
+
+      current_worker_ = nullptr;
+   }
+
+   // The current count of demands in the lane.
+   std::size_t lane_depth(std::size_t lane_index) const {
+      const auto & lane = *lanes_[lane_index];
+      if(lane.edf_queue_)
+         return lane.edf_queue_->approx_size();
+      if(lane.queue_)
+         return lane.queue_->approx_size();
+      if(lane.ch_)
+         return lane.ch_->size();
+
+      std::size_t depth = 0u;
+      for(const auto i : lane.workers_)
+         depth += workers_[i]->local_queues_[lane_index]->approx_size();
+      return depth;
+   }
+
+   // Helper method for taking the load of a lane for the last interval.
+   lane_load_t take_lane_load(std::size_t lane_index) const {
+      auto & lane = *lanes_[lane_index];
+      const auto total_wait = lane.total_wait_.exchange(
+            0, std::memory_order_relaxed);
+      const auto extracted = lane.extracted_.exchange(
+            0u, std::memory_order_relaxed);
+
+      return lane_load_t{
+            lane.name_,
+            extracted ? clock_t::duration{
+                  total_wait / static_cast<clock_t::rep>(extracted)}
+                  : clock_t::duration::zero(),
+            extracted,
+            lane_depth(lane_index)
+         };
+   }
+
+   // Is the lane overloaded?
+   // It's overloaded if demands wait too long or if there are
+   // waiting demands, but nothing was extracted during the last interval.
+   bool is_overloaded(const lane_load_t & load) const noexcept {
+      return load.avg_wait_ > rebalance_wait_threshold_ ||
+            (load.depth_ && !load.extracted_);
+   }
+
+   // Is the lane relaxed?
+   bool is_relaxed(const lane_load_t & load) const noexcept {
+      return !is_overloaded(load) &&
+            load.avg_wait_ < rebalance_wait_threshold_ / 2;
+   }
+
+   // The position of the lane in the list of the group's lanes.
+   // The less value means the greater priority.
+   // If the group doesn't serve the lane then max() is returned.
+   std::size_t lane_priority(std::size_t group, std::size_t lane) const {
+      const auto & lanes = groups_[group]->lanes_;
+      const auto it = std::find(lanes.begin(), lanes.end(), lane);
+      return lanes.end() == it ? std::numeric_limits<std::size_t>::max()
+            : static_cast<std::size_t>(it - lanes.begin());
+   }
+
+   // Looks for a pair of groups (from, to) for moving a thread.
+   //
+   // A thread can be moved from group `from` to group `to` if:
+   // - there is an overloaded lane that is served by `to` with a greater
+   //   priority than by `from` (or isn't served by `from` at all);
+   // - all other lanes served by `from` are relaxed;
+   // - there is more than one thread in `from`.
+   std::optional<std::pair<std::size_t, std::size_t>> find_move(
+         const std::vector<lane_load_t> & loads,
+         const std::vector<unsigned> & group_threads) const {
+      for(std::size_t l = 0u; l != lanes_.size(); ++l) {
+         if(!is_overloaded(loads[l]))
+            continue;
+
+         for(const auto to : lanes_[l]->groups_)
+            for(std::size_t from = 0u; from != groups_.size(); ++from) {
+               if(from == to || group_threads[from] < 2u ||
+                     lane_priority(from, l) <= lane_priority(to, l))
+                  continue;
+
+               const auto & from_lanes = groups_[from]->lanes_;
+               if(std::all_of(from_lanes.begin(), from_lanes.end(),
+                     [&](std::size_t fl) {
+                        return fl == l || is_relaxed(loads[fl]);
+                     }))
+                  return std::make_pair(from, to);
+            }
+      }
+
+      return std::nullopt;
+   }
+
+   // Helper method for moving one thread from one group to another.
+   // The thread with the greatest index is selected for that.
+   // NOTE: the leader (index 0) is never moved.
+   void move_thread(
+         std::size_t from,
+         std::size_t to,
+         std::vector<lane_load_t> loads) {
+      for(auto i = workers_.size() - 1u; i > 0u; --i) {
+         auto & w = *workers_[i];
+         if(from != w.group_.load(std::memory_order_relaxed))
+            continue;
+
+         w.group_.store(to, std::memory_order_relaxed);
+         // The thread can sleep on the event_count of the old group.
+         for(auto & g : groups_)
+            g->waiters_.notify_all();
+
+         role_change_t change;
+         {
+            std::lock_guard<std::mutex> lock{role_changes_lock_};
+            auto & stats = adaptive_split_stats_;
+            stats.role_changes_ += 1u;
+            --stats.group_threads_[from];
+            ++stats.group_threads_[to];
+
+            change = role_change_t{
+                  clock_t::now(),
+                  static_cast<unsigned>(i),
+                  groups_[from]->name_,
+                  groups_[to]->name_,
+                  stats.group_threads_[from],
+                  stats.group_threads_[to],
+                  std::move(loads)
+               };
+
+            if(max_recent_role_changes == stats.recent_changes_.size())
+               stats.recent_changes_.erase(stats.recent_changes_.begin());
+            stats.recent_changes_.push_back(change);
+         }
+
+         if(on_role_change_)
+            on_role_change_(change);
+
+         return;
+      }
+   }
+
+   // Check the load of lanes and move a thread if an imbalance
+   // is observed long enough.
+   void rebalance() {
+      std::vector<lane_load_t> loads;
+      loads.reserve(lanes_.size());
+      for(std::size_t l = 0u; l != lanes_.size(); ++l)
+         loads.push_back(take_lane_load(l));
+
+      std::vector<unsigned> group_threads;
+      {
+         std::lock_guard<std::mutex> lock{role_changes_lock_};
+         group_threads = adaptive_split_stats_.group_threads_;
+      }
+
+      const auto move = find_move(loads, group_threads);
+      if(move && move == pending_move_)
+         ++pending_move_checks_;
+      else {
+         pending_move_ = move;
+         pending_move_checks_ = move ? 1u : 0u;
+      }
+
+      if(move && pending_move_checks_ >= rebalance_hysteresis_) {
+         move_thread(move->first, move->second, std::move(loads));
+         pending_move_.reset();
+         pending_move_checks_ = 0u;
+      }
+   }
+
+   // Helper method for the retirement of a thread of the elastic pool.
+   // A thread can retire if there are more than the min count of threads
+   // in its group. The leader never retires, it has to handle evt_finish.
+   // Returns true if the thread has to exit.
+   bool try_retire(worker_t & w) noexcept {
+      if(!elastic_ || 0u == w.index_)
+         return false;
+
+      auto & group = *groups_[w.group_.load(std::memory_order_relaxed)];
+      auto active = group.active_threads_.load(std::memory_order_relaxed);
+      while(active > group.min_threads_)
+         if(group.active_threads_.compare_exchange_weak(active, active - 1u,
+               std::memory_order_relaxed)) {
+            w.active_.store(false, std::memory_order_release);
+            threads_retired_.fetch_add(1u, std::memory_order_relaxed);
+            return true;
+         }
+
+      return false;
+   }
+
+   // Helper method for starting a thread for an inactive worker of the
+   // group. Returns false if there are no inactive workers in the group
+   // or if new threads can't be started now.
+   bool add_thread_to_group(std::size_t g) {
+      auto & group = *groups_[g];
+      if(group.active_threads_.load(std::memory_order_relaxed) >=
+            group.max_threads_)
+         return false;
+
+      for(unsigned i = 1u; i != workers_.size(); ++i) {
+         auto & w = *workers_[i];
+         if(g != w.group_.load(std::memory_order_relaxed) ||
+               w.active_.load(std::memory_order_acquire))
+            continue;
+
+         // The previous thread of that worker could retire recently.
+         if(work_threads_[i].joinable())
+            work_threads_[i].join();
+
+         // The new thread has to be counted by finish_room_ before its
+         // start, otherwise evt_finish could be handled while it works.
+         // NOTE: the latch isn't closed if there were no threads at the
+         // moment of the wait, so the flag is checked after the acquisition.
+         try {
+            finish_room_.acquire();
+         }
+         catch(const std::runtime_error &) {
+            return false;
+         }
+         if(finishing_.load(std::memory_order_acquire)) {
+            finish_room_.release();
+            return false;
+         }
+
+         w.active_.store(true, std::memory_order_relaxed);
+         group.active_threads_.fetch_add(1u, std::memory_order_relaxed);
+         try {
+            work_threads_[i] = std::thread{[this, i]{
+                  place_current_thread(*workers_[i]);
+                  late_worker_thread_body(i);
+               }};
+         }
+         catch(...) {
+            group.active_threads_.fetch_sub(1u, std::memory_order_relaxed);
+            w.active_.store(false, std::memory_order_relaxed);
+            finish_room_.release();
+            throw;
+         }
+
+         threads_added_.fetch_add(1u, std::memory_order_relaxed);
+         return true;
+      }
+
+      return false;
+   }
+
+   // Check the load of lanes and add a thread for a lane that is
+   // overloaded long enough (the elastic pool). At most one thread
+   // is added per check.
+   void resize_pool() {
+      if(!started_.load(std::memory_order_acquire) ||
+            finishing_.load(std::memory_order_acquire))
+         return;
+
+      for(std::size_t l = 0u; l != lanes_.size(); ++l)
+         overloaded_checks_[l] = is_overloaded(take_lane_load(l)) ?
+               overloaded_checks_[l] + 1u : 0u;
+
+      for(std::size_t l = 0u; l != lanes_.size(); ++l) {
+         if(overloaded_checks_[l] < rebalance_hysteresis_)
+            continue;
+
+         // Groups dedicated to the lane go first.
+         for(const auto g : lanes_[l]->groups_)
+            if(add_thread_to_group(g)) {
+               overloaded_checks_[l] = 0u;
+               return;
+            }
+      }
+   }
+
+   // The body of the monitor thread.
+   void monitor_thread_body() {
+      std::unique_lock<std::mutex> lock{monitor_lock_};
+      while(!monitor_wakeup_cv_.wait_for(lock, rebalance_interval_,
+            [this]{ return monitor_stopped_; })) {
+         lock.unlock();
+         // NOTE: the elastic pool isn't used in the adaptive split mode.
+         if(adaptive_split_)
+            rebalance();
+         else
+            resize_pool();
+         lock.lock();
+      }
+   }
+
+   // The index of the first tick that isn't earlier than t.
+   timer_wheel_for_demands_t::tick_t first_tick_since(
+         clock_t::time_point t) const noexcept {
+      if(t <= started_at_)
+         return 0u;
+
+      return static_cast<timer_wheel_for_demands_t::tick_t>(
+            (t - started_at_ + timer_tick_ - clock_t::duration{1}) / timer_tick_);
+   }
+
+   // The index of the last tick that isn't later than t.
+   timer_wheel_for_demands_t::tick_t last_tick_until(
+         clock_t::time_point t) const noexcept {
+      return static_cast<timer_wheel_for_demands_t::tick_t>(
+            (t - started_at_) / timer_tick_);
+   }
+
+   // Moves demands from all timer buffers to the wheel.
+   void collect_scheduled_demands(std::vector<scheduled_demand_t> & tmp) {
+      const auto collect = [&](timer_buffer_t & buffer) {
+         {
+            std::lock_guard<std::mutex> lock{buffer.lock_};
+            tmp.swap(buffer.demands_);
+         }
+         for(auto & sd : tmp)
+            timer_wheel_->insert(
+                  first_tick_since(sd.at_), std::move(sd.msg_));
+         tmp.clear();
+      };
+
+      for(auto & w : workers_)
+         collect(w->timer_buffer_);
+      collect(foreign_timer_buffer_);
+   }
+
+   // The time of the next tick that can have expired messages
+   // (clock_t::time_point::max() if the wheel is empty).
+   clock_t::time_point next_timer_wakeup() const noexcept {
+      const auto tick = timer_wheel_->next_expiry();
+      if(!tick)
+         return clock_t::time_point::max();
+      return started_at_ + timer_tick_ *
+            static_cast<clock_t::duration::rep>(*tick);
+   }
+
+   // Wakes up the timer thread before the planned time.
+   void kick_timer_thread() {
+      {
+         std::lock_guard<std::mutex> lock{timer_lock_};
+         timer_kicked_ = true;
+      }
+      timer_wakeup_cv_.notify_one();
+   }
+
+   // The body of the timer thread.
+   //
+   // The thread sleeps until the next tick with messages (or until
+   // a message is scheduled if the wheel is empty). Missed ticks are
+   // processed at once if the thread was suspended.
+   //
+   // NOTE: push() doesn't throw for messages from here: lanes are
+   // unbounded or have the overflow handler (see check_params()).
+   // Other exceptions from the sending (like an overflow of message
+   // limits) are reported, and the message is lost.
+   void timer_thread_body() noexcept {
+      std::vector<scheduled_demand_t> tmp;
+      const auto send = [](scheduled_message_uptr_t && msg) {
+         try {
+            msg->send();
+         }
+         catch(const std::exception & x) {
+            std::cerr << "tricky_dispatcher: scheduled message is lost: "
+                  << x.what() << std::endl;
+         }
+      };
+
+      for(;;) {
+         collect_scheduled_demands(tmp);
+         timer_wheel_->advance(last_tick_until(clock_t::now()), send);
+
+         // Producers wake the thread up only for messages that are
+         // earlier than the published time, so buffers are checked
+         // again after the publication.
+         timer_wakeup_at_.store(next_timer_wakeup().time_since_epoch().count());
+         collect_scheduled_demands(tmp);
+         const auto wakeup_at = next_timer_wakeup();
+
+         std::unique_lock<std::mutex> lock{timer_lock_};
+         const auto woken_up = [this]{ return timer_stopped_ || timer_kicked_; };
+         if(clock_t::time_point::max() == wakeup_at)
+            timer_wakeup_cv_.wait(lock, woken_up);
+         else
+            timer_wakeup_cv_.wait_until(lock, wakeup_at, woken_up);
+         if(timer_stopped_)
+            break;
+         timer_kicked_ = false;
+      }
+   }
+
+   // Implementation of the methods inherited from disp_binder.
+   void preallocate_resources(so_5::agent_t & /*agent*/) override {
+      // Nothing to do.
+   }
+
+   void undo_preallocation(so_5::agent_t & /*agent*/) noexcept override {
+      // Nothing to do.
+   }
+
+   void bind(so_5::agent_t & agent) noexcept override {
+      agent.so_bind_to_dispatcher(*this);
+   }
+
+   void unbind(so_5::agent_t & /*agent*/) noexcept override {
+      // Nothing to do.
+   }
+
+   // Helper method for reservation of a place in a bounded lane.
+   static bool try_reserve_place(lane_t & lane) noexcept {
+      auto size = lane.size_.load(std::memory_order_relaxed);
+      do {
+         if(size >= lane.limits_.capacity_)
+            return false;
+      }
+      while(!lane.size_.compare_exchange_weak(
+            size, size + 1u, std::memory_order_relaxed));
+      return true;
+   }
+
+   // Helper method for waiting for a place in a bounded lane
+   // (for overflow_policy_t::block).
+   // Returns false if there is no place after the block timeout.
+   static bool wait_for_place(lane_t & lane) {
+      const auto deadline = clock_t::now() + lane.limits_.block_timeout_;
+      for(;;) {
+         const auto ticket = lane.space_waiters_.prepare_wait();
+         if(try_reserve_place(lane)) {
+            lane.space_waiters_.cancel_wait();
+            return true;
+         }
+
+         const auto now = clock_t::now();
+         if(now >= deadline) {
+            lane.space_waiters_.cancel_wait();
+            return false;
+         }
+         lane.space_waiters_.wait_for(ticket, deadline - now);
+      }
+   }
+
+   // Helper method for dropping the oldest demand from a lane.
+   // The dropped demand is passed to the overflow handler.
+   // Returns false if there are no demands in the lane.
+   bool drop_oldest_demand(std::size_t lane_index) {
+      auto & lane = *lanes_[lane_index];
+      timed_demand_t dropped;
+      const auto drop = [&dropped](timed_demand_t && td) {
+         dropped = std::move(td);
+      };
+      std::size_t count = 0u;
+      if(lane.edf_queue_)
+         count = lane.edf_queue_->try_pop_latest(dropped) ? 1u : 0u;
+      else if(lane.queue_)
+         count = lane.queue_->try_pop_bulk(1u, drop);
+      else if(queue_backend_t::mchain == queue_backend_)
+         count = so_5::receive(
+               so_5::from(lane.ch_).handle_n(1).no_wait_on_empty(),
+               [&dropped](timed_demand_t td) {
+                  dropped = std::move(td);
+               }).handled();
+      else
+         // There is no global order for local queues, so the oldest
+         // demand of the first non-empty queue is dropped.
+         for(const auto i : lane.workers_)
+            if(0u != (count = workers_[i]->local_queues_[lane_index]
+                  ->try_pop_bulk(1u, drop)))
+               break;
+
+      if(!count)
+         return false;
+
+      lane.dropped_.fetch_add(1u, std::memory_order_relaxed);
+      note_dequeued(lane, count);
+      if(on_overflow_)
+         on_overflow_(lane.name_, dropped.demand_);
+      return true;
+   }
+
+   // Helper method for the admission of a demand to a bounded lane.
+   // Reserves a place for the demand according to the overflow policy.
+   // Returns false if the demand is dropped or rejected.
+   bool admit(std::size_t lane_index, timed_demand_t & td) {
+      auto & lane = *lanes_[lane_index];
+      if(try_reserve_place(lane))
+         return true;
+
+      switch(lane.limits_.overflow_policy_) {
+      case overflow_policy_t::block:
+         if(wait_for_place(lane))
+            return true;
+      break;
+
+      case overflow_policy_t::drop_oldest:
+         // The new demand is dropped if a place is taken by another
+         // producer or the lane is full of demands that are being pushed.
+         if(drop_oldest_demand(lane_index) && try_reserve_place(lane))
+            return true;
+         lane.dropped_.fetch_add(1u, std::memory_order_relaxed);
+         if(on_overflow_)
+            on_overflow_(lane.name_, td.demand_);
+      return false;
+
+      case overflow_policy_t::drop_newest:
+         lane.dropped_.fetch_add(1u, std::memory_order_relaxed);
+         if(on_overflow_)
+            on_overflow_(lane.name_, td.demand_);
+      return false;
+
+      case overflow_policy_t::reject:
+      break;
+      }
+
+      lane.rejected_.fetch_add(1u, std::memory_order_relaxed);
+      if(!on_overflow_)
+         throw std::runtime_error{
+               "tricky_dispatcher: lane " + lane.name_ + " is full"};
+      on_overflow_(lane.name_, td.demand_);
+      return false;
+   }
+
+   // Helper method for pushing a demand to a lock-free lane.
+   // The lane is unbounded like a mchain: if the ring is full then
+   // the demand goes to the spill list.
+   static void push_to_lock_free_lane(
+         lane_t & lane,
+         timed_demand_t td) {
+      lane.queue_->push(std::move(td));
+   }
+
+   // Helper method for pushing a demand to an EDF lane.
+   void push_to_edf_lane(
+         lane_t & lane,
+         timed_demand_t td) {
+      std::optional<clock_t::time_point> deadline;
+      if(deadline_of_)
+         deadline = deadline_of_(td.demand_);
+
+      const auto d = deadline.value_or(td.pushed_at_);
+      lane.edf_queue_->push(d, std::move(td));
+   }
+
+   // The index of the preferred worker among n workers of a lane.
+   static std::size_t affinity_slot(std::uint64_t key, std::size_t n) noexcept {
+      // Bits of the key are mixed (the finalizer of splitmix64),
+      // so sequential keys are spread evenly.
+      key ^= key >> 30u;
+      key *= 0xbf58476d1ce4e5b9ull;
+      key ^= key >> 27u;
+      key *= 0x94d049bb133111ebull;
+      key ^= key >> 31u;
+      return static_cast<std::size_t>(key % n);
+   }
+
+   // Helper method for pushing a demand to a queue of a worker.
+   //
+   // A demand with an affinity key goes to its preferred worker (if that
+   // worker is active). If the demand is pushed from a worker of that
+   // dispatcher and that worker serves the lane, the demand goes to the
+   // worker's own queue. Otherwise workers are selected in round-robin
+   // fashion.
+   //
+   // Returns false if there is no need to wake up a waiting worker.
+   bool push_to_worker_queue(
+         std::size_t lane_index,
+         timed_demand_t td) {
+      auto & lane = *lanes_[lane_index];
+      if(affinity_key_of_) {
+         if(const auto key = affinity_key_of_(td.demand_)) {
+            const auto index = lane.workers_[
+                  affinity_slot(*key, lane.workers_.size())];
+            auto & preferred = *workers_[index];
+            if(preferred.active_.load(std::memory_order_relaxed)) {
+               td.preferred_worker_ = index;
+               preferred.local_queues_[lane_index]->push(std::move(td));
+               // The push has to be visible before the check of the flag.
+               std::atomic_thread_fence(std::memory_order_seq_cst);
+               if(preferred.parked_.load(std::memory_order_relaxed)) {
+                  // There is no way to wake up the specific worker, so all
+                  // workers of its group are woken up.
+                  groups_[preferred.group_.load(std::memory_order_relaxed)]
+                        ->waiters_.notify_all();
+                  return false;
+               }
+               // Other workers can take the demand only from
+               // an overloaded worker.
+               return preferred.local_queues_[lane_index]->approx_size() >=
+                     affinity_steal_threshold_;
+            }
+         }
+      }
+
+      auto * w = current_worker_;
+      if(!w || this != w->owner_ || !w->local_queues_[lane_index]) {
+         // Retired workers of the elastic pool are skipped, demands
+         // in their queues can be only stolen.
+         for(auto attempts = lane.workers_.size(); attempts; --attempts) {
+            w = workers_[lane.workers_[
+                  lane.next_worker_.fetch_add(1u, std::memory_order_relaxed)
+                        % lane.workers_.size()]].get();
+            if(w->active_.load(std::memory_order_relaxed))
+               break;
+         }
+      }
+
+      w->local_queues_[lane_index]->push(std::move(td));
+      return true;
+   }
+
+   // The lane for a demand of the specified type.
+   std::size_t lane_for(const std::type_index & msg_type) {
+      if(classifier_)
+         return classifier_->heavy(msg_type) ?
+               heavy_lane_ : router_->default_lane();
+      return router_->lane_for(msg_type);
+   }
+
+   // Implementation of the methods inherited from event_queue.
+   void push(so_5::execution_demand_t demand) override {
+      const auto lane_index = lane_for(demand.m_msg_type);
+      auto & lane = *lanes_[lane_index];
+
+      // EDF lanes use the push time as the deadline for demands
+      // without the deadline.
+      timed_demand_t td{
+            std::move(demand),
+            need_push_time() || lane.edf_queue_ ?
+                  clock_t::now() : clock_t::time_point{}
+         };
+
+      if(queue_backend_t::mchain == queue_backend_) {
+         if(lane.limits_.capacity_ && !admit(lane_index, td))
+            return;
+         so_5::send<timed_demand_t>(lane.ch_, std::move(td));
+         if(metrics_)
+            note_enqueued(lane);
+         return;
+      }
+
+      // Demands are ignored after the closing of lock-free or
+      // work-stealing queues, like mchains do it.
+      push_gate_t::pass_t pass{push_gate_};
+      if(!pass)
+         return;
+
+      if(lane.limits_.capacity_ && !admit(lane_index, td))
+         return;
+
+      if(lane.edf_queue_)
+         push_to_edf_lane(lane, std::move(td));
+      else if(queue_backend_t::lock_free == queue_backend_)
+         push_to_lock_free_lane(lane, std::move(td));
+      else if(!push_to_worker_queue(lane_index, std::move(td))) {
+         if(metrics_)
+            note_enqueued(lane);
+         return;
+      }
+
+      if(metrics_)
+         note_enqueued(lane);
+
+      // Threads of groups dedicated to that lane are preferred because
+      // threads of other groups can be necessary for their own lanes.
+      for(const auto g : lane.groups_)
+         if(groups_[g]->waiters_.notify_one())
+            break;
+   }
+
+   // Implementation of the method inherited from demand_scheduler.
+   void schedule(
+         clock_t::time_point at,
+         scheduled_message_uptr_t msg) override {
+      if(!timer_wheel_)
+         throw std::logic_error{"tricky_dispatcher: the timer isn't enabled"};
+
+      auto * w = current_worker_;
+      auto & buffer = w && this == w->owner_ ?
+            w->timer_buffer_ : foreign_timer_buffer_;
+
+      {
+         std::lock_guard<std::mutex> lock{buffer.lock_};
+         buffer.demands_.push_back(scheduled_demand_t{at, std::move(msg)});
+      }
+
+      // The timer thread sleeps until the planned time, so it has to be
+      // woken up if the new message is earlier.
+      if(at.time_since_epoch().count() < timer_wakeup_at_.load())
+         kick_timer_thread();
+   }
+
+   void push_evt_start(so_5::execution_demand_t demand) override {
+      so_5::send<so_5::execution_demand_t>(start_finish_ch_, std::move(demand));
+   }
+
+   // NOTE: don't care about exception, if the demand can't be stored
+   // into the queue the application has to be aborted anyway.
+   void push_evt_finish(so_5::execution_demand_t demand) noexcept override {
+      // The elastic pool shouldn't start new threads.
+      finishing_.store(true, std::memory_order_release);
+
+      // Chains for "ordinary" messages has to be closed.
+      if(queue_backend_t::mchain == queue_backend_) {
+         for(auto & lane : lanes_)
+            so_5::close_retain_content(so_5::terminate_if_throws, lane->ch_);
+      }
+      else
+         close_queues(queues_state_t::closed_retain_content);
+
+      // Now we can store the evt_finish demand in the special chain.
+      so_5::send<so_5::execution_demand_t>(start_finish_ch_, std::move(demand));
+   }
+
+public:
+   // The constructor that starts all worker threads.
+   tricky_dispatcher_t(
+         // SObjectizer Environment to work in.
+         so_5::environment_t & env,
+         // Parameters for the dispatcher.
+         const disp_params_t & params)
+         :  queue_backend_{params.queue_backend_}
+         ,  start_finish_ch_{
+               so_5::create_mchain(env,
+                     2u, // Just evt_start and evt_finish.
+                     so_5::mchain_props::memory_usage_t::preallocated,
+                     so_5::mchain_props::overflow_reaction_t::abort_app)
+            }
+         ,  deadline_of_{params.deadline_of_}
+         ,  on_overflow_{params.on_overflow_}
+         ,  affinity_key_of_{params.affinity_key_of_}
+         ,  affinity_steal_threshold_{params.affinity_steal_threshold_}
+         ,  batch_size_{params.batch_size_}
+         ,  weighted_{lane_scheduling_t::weighted == params.lane_scheduling_}
+         ,  metrics_{params.metrics_}
+         ,  trace_capacity_{params.trace_capacity_}
+         ,  tracing_{0u != params.trace_capacity_}
+         ,  pinning_{params.pinning_}
+         ,  numa_node_of_cpu_{make_numa_node_of_cpu_map()}
+         ,  wait_strategy_{params.wait_strategy_}
+         ,  spin_wait_params_{params.spin_wait_}
+         ,  idle_timeout_{params.idle_timeout_}
+         ,  adaptive_split_{params.adaptive_split_}
+         ,  rebalance_interval_{params.rebalance_interval_}
+         ,  rebalance_wait_threshold_{params.rebalance_wait_threshold_}
+         ,  rebalance_hysteresis_{std::max(params.rebalance_hysteresis_, 1u)}
+         ,  on_role_change_{params.on_role_change_}
+         ,  timer_tick_{params.timer_tick_}
+   {
+      const auto actual_params = complete_params(params);
+      check_params(actual_params);
+
+      make_lanes_and_workers(env, actual_params);
+
+      launch_work_threads();
+
+      try {
+         if(adaptive_split_ || elastic_)
+            monitor_thread_ = std::thread{[this]{ monitor_thread_body(); }};
+
+         if(params.timer_wheel_) {
+            timer_wheel_ = std::make_unique<timer_wheel_for_demands_t>();
+            timer_thread_ = std::thread{[this]{ timer_thread_body(); }};
+         }
+      }
+      catch(...) {
+         shutdown_work_threads();
+         throw;
+      }
+   }
+   ~tricky_dispatcher_t() noexcept override {
+      // All worker threads should be stopped.
+      shutdown_work_threads();
+   }
+
+   // Get the current state of the adaptive split.
+   [[nodiscard]]
+   adaptive_split_stats_t adaptive_split_stats() const {
+      std::lock_guard<std::mutex> lock{role_changes_lock_};
+      return adaptive_split_stats_;
+   }
+
+   // Get the current metrics.
+   // Only names and counts of lanes and workers are filled
+   // if metrics aren't collected.
+   [[nodiscard]]
+   metrics_snapshot_t metrics_snapshot() const {
+      metrics_snapshot_t result;
+      result.taken_at_ = clock_t::now();
+      result.uptime_ = result.taken_at_ - started_at_;
+
+      for(const auto & lane : lanes_) {
+         lane_metrics_t m{};
+         m.name_ = lane->name_;
+         m.enqueued_ = lane->enqueued_.load(std::memory_order_relaxed);
+         m.dequeued_ = lane->dequeued_.load(std::memory_order_relaxed);
+         m.depth_ = m.enqueued_ > m.dequeued_ ? m.enqueued_ - m.dequeued_ : 0u;
+         m.max_depth_ = lane->max_depth_.load(std::memory_order_relaxed);
+         m.capacity_ = lane->limits_.capacity_;
+         m.dropped_ = lane->dropped_.load(std::memory_order_relaxed);
+         m.rejected_ = lane->rejected_.load(std::memory_order_relaxed);
+         m.weight_ = lane->weight_;
+         result.lanes_.push_back(std::move(m));
+      }
+
+      // Time of handling of demands of every lane by threads of every group.
+      std::vector<std::vector<std::uint64_t>> group_served(
+            groups_.size(), std::vector<std::uint64_t>(lanes_.size(), 0u));
+
+      for(const auto & w : workers_) {
+         worker_metrics_t m{};
+         m.index_ = w->index_;
+         const auto group = w->group_.load(std::memory_order_relaxed);
+         m.group_ = groups_[group]->name_;
+         m.busy_ = clock_t::duration{w->busy_.load(std::memory_order_relaxed)};
+         m.idle_ = result.uptime_ > m.busy_ ?
+               result.uptime_ - m.busy_ : clock_t::duration::zero();
+
+         for(std::size_t l = 0u; l != w->lane_metrics_.size(); ++l) {
+            const auto & lm = *w->lane_metrics_[l];
+            m.handled_ += lm.handled_.load(std::memory_order_relaxed);
+            m.wait_ns_.merge(lm.wait_ns_);
+            m.service_ns_.merge(lm.service_ns_);
+            result.lanes_[l].wait_ns_.merge(lm.wait_ns_);
+            result.lanes_[l].service_ns_.merge(lm.service_ns_);
+         }
+         if(w->served_ns_)
+            for(std::size_t l = 0u; l != lanes_.size(); ++l)
+               group_served[group][l] +=
+                     w->served_ns_[l].load(std::memory_order_relaxed);
+
+         m.pinned_to_ = w->pinned_to_;
+         m.last_cpu_ = w->last_cpu_.load(std::memory_order_relaxed);
+         m.last_numa_node_ =
+               m.last_cpu_ >= 0 &&
+               static_cast<std::size_t>(m.last_cpu_) < numa_node_of_cpu_.size() ?
+                  numa_node_of_cpu_[static_cast<std::size_t>(m.last_cpu_)] : -1;
+         m.cpu_migrations_ = w->cpu_migrations_.load(std::memory_order_relaxed);
+         if(w->spinner_)
+            m.wait_ = w->spinner_->stats();
+         m.active_ = w->active_.load(std::memory_order_relaxed);
+         m.affinity_hits_ = w->affinity_hits_.load(std::memory_order_relaxed);
+         m.affinity_misses_ = w->affinity_misses_.load(std::memory_order_relaxed);
+         result.workers_.push_back(std::move(m));
+      }
+
+      std::uint64_t total_served = 0u;
+      for(std::size_t g = 0u; g != groups_.size(); ++g)
+         for(std::size_t l = 0u; l != lanes_.size(); ++l) {
+            result.lanes_[l].served_ += std::chrono::duration_cast<
+                  clock_t::duration>(
+                        std::chrono::nanoseconds{group_served[g][l]});
+            total_served += group_served[g][l];
+         }
+      for(std::size_t l = 0u; l != lanes_.size(); ++l)
+         result.lanes_[l].share_ = total_served ?
+               static_cast<double>(to_ns(result.lanes_[l].served_)) /
+                  total_served : 0.0;
+
+      for(std::size_t g = 0u; g != groups_.size(); ++g) {
+         const auto & lanes = groups_[g]->lanes_;
+         group_shares_t s;
+         s.group_ = groups_[g]->name_;
+         s.lanes_ = lanes;
+
+         std::uint64_t served = 0u;
+         unsigned weights = 0u;
+         for(const auto l : lanes) {
+            served += group_served[g][l];
+            weights += lanes_[l]->weight_;
+         }
+         for(std::size_t pos = 0u; pos != lanes.size(); ++pos) {
+            s.shares_.push_back(served ?
+                  static_cast<double>(group_served[g][lanes[pos]]) / served :
+                  0.0);
+            // With the strict priority only the first lane has a guarantee.
+            s.min_shares_.push_back(weighted_ ?
+                  static_cast<double>(lanes_[lanes[pos]]->weight_) / weights :
+                  (0u == pos ? 1.0 : 0.0));
+         }
+         result.groups_.push_back(std::move(s));
+      }
+
+      result.threads_added_ = threads_added_.load(std::memory_order_relaxed);
+      result.threads_retired_ = threads_retired_.load(std::memory_order_relaxed);
+
+      return result;
+   }
+
+   // The current classes of message types (if auto-classification is on).
+   // Heavy types go to the heavy lane, light types go to the default lane.
+   std::vector<service_time_classifier_t::type_class_t>
+   message_type_classes() const {
+      return classifier_ ? classifier_->classes() :
+            std::vector<service_time_classifier_t::type_class_t>{};
+   }
+
+   // Writes the last handled demands of every worker in the Chrome
+   // trace-event format (see chrome_trace_writer_t).
+   // Only the metadata is written if tracing is off.
+   // NOTE: workers aren't stopped, demands handled during the writing
+   // can be lost.
+   void write_trace(std::ostream & to) const {
+      chrome_trace_writer_t writer{to};
+      for(std::size_t l = 0u; l != lanes_.size(); ++l)
+         writer.thread_name(chrome_trace_writer_t::lanes_pid,
+               static_cast<unsigned>(l), lanes_[l]->name_);
+      for(const auto & w : workers_)
+         writer.thread_name(chrome_trace_writer_t::workers_pid, w->index_,
+               fmt::format("thread #{} ({})", w->index_,
+                     groups_[w->group_.load(std::memory_order_relaxed)]->name_));
+
+      // Names of message types are demangled only once.
+      std::map<const char *, std::string> type_names;
+      std::vector<demand_trace_event_t> events;
+      for(const auto & w : workers_) {
+         if(!w->trace_)
+            continue;
+
+         events.clear();
+         w->trace_->collect(events);
+         for(const auto & e : events) {
+            auto it = type_names.find(e.msg_type_);
+            if(type_names.end() == it)
+               it = type_names.emplace(e.msg_type_,
+                     chrome_trace_writer_t::type_name(e.msg_type_)).first;
+            writer.demand(w->index_, lanes_[e.lane_]->name_, it->second, e);
+         }
+      }
+   }
+
+   // A factory for the creation of the dispatcher.
+   [[nodiscard]]
+   static so_5::disp_binder_shptr_t make(
+         so_5::environment_t & env, const disp_params_t & params) {
+      return std::make_shared<tricky_dispatcher_t>(env, params);
+   }
+
+   // A factory for the creation of the dispatcher with the default params.
+   [[nodiscard]]
+   static so_5::disp_binder_shptr_t make(
+         so_5::environment_t & env, unsigned pool_size) {
+      return make(env, disp_params_t{pool_size});
+   }
+};
+
+// Helper function for making dispatcher's params from the command line args.
+inline tricky_dispatcher_t::disp_params_t make_disp_params(const args_t & args) {
+   using queue_backend_t = tricky_dispatcher_t::queue_backend_t;
+
+   tricky_dispatcher_t::disp_params_t params{args.thread_pool_size_};
+
+   if("mchain" == args.queue_backend_)
+      params.queue_backend_ = queue_backend_t::mchain;
+   else if("lock-free" == args.queue_backend_)
+      params.queue_backend_ = queue_backend_t::lock_free;
+   else if("work-stealing" == args.queue_backend_)
+      params.queue_backend_ = queue_backend_t::work_stealing;
+   else
+      throw std::invalid_argument(
+            "unknown queue backend: " + args.queue_backend_);
+
+   params.lock_free_queue_capacity_ = args.lock_free_queue_capacity_;
+   params.batch_size_ = args.batch_size_;
+   // The exporter of metrics takes them from the dispatcher.
+   params.metrics_ = args.metrics_ || !args.metrics_listen_.empty();
+   params.timer_wheel_ = args.timer_wheel_;
+   params.trace_capacity_ = args.trace_capacity_;
+
+   using lane_scheduling_t = tricky_dispatcher_t::lane_scheduling_t;
+   if("strict" == args.lane_scheduling_)
+      params.lane_scheduling_ = lane_scheduling_t::strict_priority;
+   else if("weighted" == args.lane_scheduling_)
+      params.lane_scheduling_ = lane_scheduling_t::weighted;
+   else
+      throw std::invalid_argument(
+            "unknown lane scheduling: " + args.lane_scheduling_);
+   params.init_reinit_lane_weight_ = args.init_lane_weight_;
+   params.other_lane_weight_ = args.other_lane_weight_;
+
+   params.auto_classification_ = args.auto_classify_;
+   params.classifier_.heavy_threshold_ = args.heavy_threshold_;
+   params.classifier_.light_threshold_ = args.light_threshold_;
+   params.classifier_.decay_window_ = args.classify_window_;
+
+   using pinning_t = tricky_dispatcher_t::pinning_t;
+   if("none" == args.pinning_)
+      params.pinning_ = pinning_t::none;
+   else if("core" == args.pinning_)
+      params.pinning_ = pinning_t::core;
+   else if("core-set" == args.pinning_)
+      params.pinning_ = pinning_t::core_set;
+   else
+      throw std::invalid_argument("unknown pinning: " + args.pinning_);
+   params.first_type_cpus_ = parse_cpus_spec(args.first_type_cpus_);
+   params.second_type_cpus_ = parse_cpus_spec(args.second_type_cpus_);
+
+   using wait_strategy_t = tricky_dispatcher_t::wait_strategy_t;
+   if("blocking" == args.wait_strategy_)
+      params.wait_strategy_ = wait_strategy_t::blocking;
+   else if("spin-then-park" == args.wait_strategy_)
+      params.wait_strategy_ = wait_strategy_t::spin_then_park;
+   else
+      throw std::invalid_argument(
+            "unknown wait strategy: " + args.wait_strategy_);
+   params.spin_wait_.max_spin_ = std::chrono::microseconds{args.max_spin_us_};
+   params.spin_wait_.min_spin_ = std::min(
+         params.spin_wait_.min_spin_, params.spin_wait_.max_spin_);
+
+   if(args.edf_) {
+      // All messages of a_device_manager_t have the expected time
+      // of the arrival. It's used as the deadline.
+      params.default_lanes_ordering_ =
+            tricky_dispatcher_t::lane_ordering_t::edf;
+      params.deadline_of_ = [](const so_5::execution_demand_t & d)
+            -> std::optional<tricky_dispatcher_t::clock_t::time_point> {
+            const auto * msg = dynamic_cast<const a_device_manager_t::msg_base_t *>(
+                  d.m_message_ref.get());
+            if(msg)
+               return msg->expected_time_;
+            return std::nullopt;
+         };
+   }
+
+   if(args.affinity_) {
+      // All messages of a_device_manager_t have the ID of a device.
+      params.affinity_key_of_ = [](const so_5::execution_demand_t & d)
+            -> std::optional<std::uint64_t> {
+            const auto * msg = dynamic_cast<const a_device_manager_t::msg_base_t *>(
+                  d.m_message_ref.get());
+            if(msg)
+               return msg->device_id();
+            return std::nullopt;
+         };
+      params.affinity_steal_threshold_ = args.affinity_steal_threshold_;
+   }
+
+   using overflow_policy_t = tricky_dispatcher_t::overflow_policy_t;
+   overflow_policy_t overflow_policy;
+   if("block" == args.overflow_policy_)
+      overflow_policy = overflow_policy_t::block;
+   else if("drop-oldest" == args.overflow_policy_)
+      overflow_policy = overflow_policy_t::drop_oldest;
+   else if("drop-newest" == args.overflow_policy_)
+      overflow_policy = overflow_policy_t::drop_newest;
+   else if("reject" == args.overflow_policy_)
+      overflow_policy = overflow_policy_t::reject;
+   else
+      throw std::invalid_argument(
+            "unknown overflow policy: " + args.overflow_policy_);
+   params.init_reinit_lane_limits_ = tricky_dispatcher_t::lane_limits_t{
+         args.init_lane_capacity_, overflow_policy, args.block_timeout_};
+   params.other_lane_limits_ = tricky_dispatcher_t::lane_limits_t{
+         args.other_lane_capacity_, overflow_policy, args.block_timeout_};
+   // A rejected or dropped device is created again later by its manager.
+   params.on_overflow_ = [](const std::string &, so_5::execution_demand_t & d) {
+         const auto * manager = dynamic_cast<const a_device_manager_t *>(
+               d.m_receiver);
+         const auto * msg = dynamic_cast<const a_device_manager_t::msg_base_t *>(
+               d.m_message_ref.get());
+         if(manager && msg)
+            if(const auto id = msg->device_id()) {
+               // The first init of a device is in-flight until
+               // its completion.
+               const auto * init = dynamic_cast<
+                     const a_device_manager_t::init_device_t *>(msg);
+               const auto * completion = dynamic_cast<
+                     const a_device_manager_t::op_completed_t *>(msg);
+               manager->device_rejected(*id,
+                     (init && init->startup_) ||
+                     (completion && completion->startup_));
+            }
+      };
+
+   params.adaptive_split_ = args.adaptive_split_;
+   params.rebalance_wait_threshold_ = args.rebalance_wait_threshold_;
+   params.max_pool_size_ = args.max_thread_pool_size_;
+   params.idle_timeout_ = args.idle_timeout_;
+   // Every move of a thread is shown with the time since the start.
+   params.on_role_change_ =
+         [started_at = tricky_dispatcher_t::clock_t::now()](
+               const tricky_dispatcher_t::role_change_t & c) {
+            using namespace std::chrono;
+            fmt::print("*** {}ms: thread #{} moved from {}({}) to {}({})",
+                  duration_cast<milliseconds>(c.at_ - started_at).count(),
+                  c.thread_index_,
+                  c.from_group_, c.from_group_threads_,
+                  c.to_group_, c.to_group_threads_);
+            for(const auto & l : c.lane_loads_)
+               fmt::print(" | {} wait={}ms queued={}",
+                     l.lane_,
+                     duration_cast<milliseconds>(l.avg_wait_).count(),
+                     l.depth_);
+            fmt::print("\n");
+         };
+
+   return params;
+}
+
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Mapping of message types to indexes of lanes.
+//
+// Routes are specified at the construction time. A lookup via
+// std::type_index's hash is too expensive for every demand (the hash is
+// calculated from the type name), so routes are cached in a lock-free
+// open-addressing table where the address of the type name is the key.
+// Routes for the specified types are placed into the cache at the
+// construction time, other types are cached on the first lookup.
+// So the lookup is one multiplication and usually one probe,
+// regardless of the count of lanes and types.
+//
+// Types without a route go to the default lane.
+class type_router_t {
+public:
+   using lane_index_t = std::size_t;
+   using routes_t = std::vector<std::pair<std::type_index, lane_index_t>>;
+
+private:
+   struct slot_t {
+      std::atomic<const char *> key_{nullptr};
+      // Index of the lane plus one. Zero means that the slot is being filled.
+      std::atomic<std::size_t> lane_plus_one_{0u};
+   };
+
+   // The size of the cache. Must be a power of two.
+   static constexpr unsigned cache_size_bits = 9u;
+   static constexpr std::size_t cache_size = std::size_t{1u} << cache_size_bits;
+   // The max count of probes before the fallback to the slow path.
+   static constexpr std::size_t max_probes = 8u;
+
+   std::unordered_map<std::type_index, lane_index_t> routes_;
+   const lane_index_t default_lane_;
+   const std::unique_ptr<slot_t[]> cache_;
+
+   static std::size_t slot_index(const char * key) noexcept {
+      // Fibonacci hashing of the address.
+      const auto v = static_cast<std::uint64_t>(
+            reinterpret_cast<std::uintptr_t>(key));
+      return static_cast<std::size_t>(
+            (v * 0x9E3779B97F4A7C15ull) >> (64u - cache_size_bits));
+   }
+
+   lane_index_t slow_lookup(const std::type_index & type) const {
+      const auto it = routes_.find(type);
+      return routes_.end() == it ? default_lane_ : it->second;
+   }
+
+public:
+   type_router_t(const routes_t & routes, lane_index_t default_lane)
+      :  default_lane_{default_lane}
+      ,  cache_{new slot_t[cache_size]} {
+      for(const auto & [type, lane] : routes) {
+         routes_.emplace(type, lane);
+         (void)lane_for(type);
+      }
+   }
+
+   type_router_t(const type_router_t &) = delete;
+   type_router_t & operator=(const type_router_t &) = delete;
+
+   [[nodiscard]]
+   lane_index_t lane_for(const std::type_index & type) {
+      const char * key = type.name();
+      auto index = slot_index(key);
+      for(std::size_t probe = 0u; probe != max_probes; ++probe) {
+         auto & slot = cache_[index];
+         const char * current = slot.key_.load(std::memory_order_acquire);
+         if(!current &&
+               slot.key_.compare_exchange_strong(current, key,
+                     std::memory_order_acq_rel)) {
+            // The slot is occupied by us, the route has to be stored.
+            const auto lane = slow_lookup(type);
+            slot.lane_plus_one_.store(lane + 1u, std::memory_order_release);
+            return lane;
+         }
+
+         // NOTE: current contains the actual key if CAS failed.
+         if(key == current) {
+            const auto lane_plus_one = slot.lane_plus_one_.load(
+                  std::memory_order_acquire);
+            // The slot can be still filled by another thread.
+            return lane_plus_one ? lane_plus_one - 1u : slow_lookup(type);
+         }
+
+         index = (index + 1u) & (cache_size - 1u);
+      }
+
+      // Too many collisions, the cache can't be used.
+      return slow_lookup(type);
+   }
+
+   lane_index_t default_lane() const noexcept { return default_lane_; }
+};
+
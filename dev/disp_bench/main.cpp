@@ -0,0 +1,446 @@
+// A headless benchmark for comparison of dispatchers on the workload
+// of a_device_manager_t.
+//
+// Every run starts a SObjectizer environment with the device manager
+// bound to the specified dispatcher, waits for the warm-up period, then
+// measures for the specified duration and stops the environment.
+// Runs are performed for every combination of dispatchers, thread counts
+// and device counts. Results are printed in JSON format.
+
+#include <common/generic_device_dispatcher.hpp>
+#include <common/tricky_dispatcher.hpp>
+
+#include <clara/clara.hpp>
+
+#include <fmt/ostream.h>
+
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <variant>
+
+#if defined(__linux__)
+   #include <unistd.h>
+#endif
+
+// The count of calls of the global operator new.
+// It's updated by all threads, so it slows allocations down a bit.
+static std::atomic<std::uint64_t> g_heap_allocations{0u};
+
+void * operator new(std::size_t size) {
+   g_heap_allocations.fetch_add(1u, std::memory_order_relaxed);
+   if(void * p = std::malloc(size ? size : 1u))
+      return p;
+   throw std::bad_alloc{};
+}
+
+void operator delete(void * p) noexcept {
+   std::free(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept {
+   std::free(p);
+}
+
+struct bench_args_t {
+   static constexpr std::chrono::seconds default_warmup{ 10 };
+   static constexpr std::chrono::seconds default_duration{ 30 };
+
+   // Dispatchers to be tested: tricky, generic, adv_thread_pool, thread_pool.
+   std::vector<std::string> dispatchers_{ "tricky", "adv_thread_pool" };
+   // Thread counts to be tested.
+   std::vector<unsigned> thread_counts_{ args_t::default_thread_pool_size };
+   // Device counts to be tested.
+   std::vector<unsigned> device_counts_{ args_t::default_device_count };
+
+   // The time before the start of measurement.
+   std::chrono::seconds warmup_{ default_warmup };
+   // The time of measurement.
+   std::chrono::seconds duration_{ default_duration };
+
+   // The name of a file for results. Results go to stdout if it's empty.
+   std::string output_file_;
+
+   // Params of the workload and of the tricky dispatcher.
+   // device_count_ and thread_pool_size_ are changed for every run.
+   args_t workload_;
+};
+
+struct help_requested_t {};
+
+// Parses a comma-separated list like "2,4,8".
+std::vector<unsigned> parse_counts(const std::string & list, const char * name) {
+   std::vector<unsigned> result;
+   std::istringstream in{list};
+   std::string item;
+   while(std::getline(in, item, ',')) {
+      const auto pos = item.find_first_not_of("0123456789");
+      const auto v = item.empty() || pos != std::string::npos ?
+            0ul : std::stoul(item);
+      if(!v)
+         throw std::invalid_argument(
+               fmt::format("invalid value in the list of {}: '{}'", name, item));
+      result.push_back(static_cast<unsigned>(v));
+   }
+   if(result.empty())
+      throw std::invalid_argument(fmt::format("empty list of {}", name));
+
+   return result;
+}
+
+std::vector<std::string> parse_names(const std::string & list) {
+   std::vector<std::string> result;
+   std::istringstream in{list};
+   std::string item;
+   while(std::getline(in, item, ',')) {
+      if("tricky" != item && "generic" != item &&
+            "adv_thread_pool" != item && "thread_pool" != item)
+         throw std::invalid_argument("unknown dispatcher: " + item);
+      result.push_back(item);
+   }
+   if(result.empty())
+      throw std::invalid_argument("empty list of dispatchers");
+
+   return result;
+}
+
+std::variant<help_requested_t, bench_args_t>
+parse_args(int argc, char ** argv) {
+   bench_args_t result;
+   bool help_requested = false;
+
+   std::string dispatchers{ "tricky,adv_thread_pool" };
+   std::string thread_counts = std::to_string(args_t::default_thread_pool_size);
+   std::string device_counts = std::to_string(args_t::default_device_count);
+   auto warmup = result.warmup_.count();
+   auto duration = result.duration_.count();
+
+   auto & w = result.workload_;
+   auto device_init_time = w.device_init_time_.count();
+   auto io_op_time = w.io_op_time_.count();
+
+   using namespace clara;
+
+   auto cli = Opt(dispatchers, "names")["-D"]["--dispatchers"]
+            (fmt::format("comma-separated list of dispatchers "
+               "(tricky, generic, adv_thread_pool, thread_pool), default: {}",
+               dispatchers))
+      | Opt(thread_counts, "list")["-t"]["--threads"]
+            (fmt::format("comma-separated list of thread counts, default: {}",
+               thread_counts))
+      | Opt(device_counts, "list")["-d"]["--devices"]
+            (fmt::format("comma-separated list of device counts, default: {}",
+               device_counts))
+      | Opt(warmup, "sec")["-w"]["--warmup"]
+            (fmt::format("warm-up time before measurement (seconds), default: {}",
+               warmup))
+      | Opt(duration, "sec")["-s"]["--duration"]
+            (fmt::format("time of measurement (seconds), default: {}",
+               duration))
+      | Opt(result.output_file_, "file")["-O"]["--output"]
+            ("file for JSON results, default: stdout")
+      | Opt(device_init_time, "ms")["-i"]["--init-time"]
+            (fmt::format("device init time (milliseconds), default: {}",
+               device_init_time))
+      | Opt(io_op_time, "ms")["-o"]["--io-op-time"]
+            (fmt::format("device IO-operation time (milliseconds), default: {}",
+               io_op_time))
+      | Opt(w.queue_backend_, "mchain|lock-free|work-stealing")
+            ["-q"]["--queue-backend"]
+            (fmt::format("type of demand queues of tricky dispatcher, "
+               "default: {}", w.queue_backend_))
+      | Opt(w.batch_size_, "count")["--batch-size"]
+            (fmt::format("max count of demands extracted by a worker of "
+               "tricky dispatcher at once, default: {}", w.batch_size_))
+      | Opt(w.edf_)["--edf"]
+            ("serve demands with the earliest expected time first "
+               "in tricky dispatcher")
+      | Opt(w.timer_wheel_)["--timer-wheel"]
+            ("schedule IO-ops via the timer of tricky dispatcher")
+      | Opt(w.pooled_alloc_)["--pooled-alloc"]
+            ("allocate devices and messages with devices from pools")
+      | Opt(w.affinity_)["--affinity"]
+            ("handle demands for the same device on the same worker of "
+               "tricky dispatcher, requires work-stealing queues")
+      | Opt(w.async_io_)["--async-io"]
+            ("don't block worker threads during device operations")
+      | Opt(w.wait_strategy_, "blocking|spin-then-park")["--wait-strategy"]
+            (fmt::format("how idle workers of tricky dispatcher wait for "
+               "demands, default: {}", w.wait_strategy_))
+      | Help(help_requested);
+
+   auto parse_result = cli.parse(Args(argc, argv));
+   if(!parse_result)
+      throw std::runtime_error("Invalid command line: "
+            + parse_result.errorMessage());
+
+   if(help_requested) {
+      std::cout << cli << std::endl;
+      return help_requested_t{};
+   }
+
+   result.dispatchers_ = parse_names(dispatchers);
+   result.thread_counts_ = parse_counts(thread_counts, "thread counts");
+   result.device_counts_ = parse_counts(device_counts, "device counts");
+   // The tricky dispatcher requires at least two threads.
+   for(const auto t : result.thread_counts_)
+      if(t < 2u)
+         throw std::invalid_argument("minimal allowed thread count is 2");
+
+   if(warmup < 0 || duration < 1)
+      throw std::invalid_argument(
+            "warm-up time can't be negative and duration can't be zero");
+   result.warmup_ = std::chrono::seconds{warmup};
+   result.duration_ = std::chrono::seconds{duration};
+
+   if(device_init_time < 10 || io_op_time < 10)
+      throw std::invalid_argument(
+            "minimal allowed value for init and IO-op times is 10ms");
+   w.device_init_time_ = std::chrono::milliseconds{device_init_time};
+   w.io_op_time_ = std::chrono::milliseconds{io_op_time};
+
+   if(!w.batch_size_)
+      throw std::invalid_argument("minimal allowed value for batch_size is 1");
+
+   return result;
+}
+
+using clock_type = std::chrono::steady_clock;
+
+// Results of one run.
+struct run_result_t {
+   std::string dispatcher_;
+   unsigned threads_;
+   unsigned devices_;
+   clock_type::duration wall_time_;
+   // CPU time of the whole process during the measurement.
+   std::chrono::duration<double> cpu_time_;
+   // Calls of the global operator new during the measurement.
+   std::uint64_t heap_allocations_;
+   // The resident set size of the process at the end of the measurement
+   // (0 if it's unknown).
+   std::uint64_t rss_kb_;
+   a_dashboard_t::slot_data_array_t ops_;
+};
+
+// A dispatcher for the device manager.
+struct dispatcher_t {
+   so_5::disp_binder_shptr_t binder_;
+   // It's not null only for tricky dispatcher with the timer.
+   demand_scheduler_shptr_t demand_scheduler_;
+};
+
+dispatcher_t make_dispatcher(
+      so_5::environment_t & env,
+      const std::string & dispatcher,
+      const args_t & args) {
+   if("tricky" == dispatcher) {
+      auto disp = std::make_shared<tricky_dispatcher_t>(
+            env, make_disp_params(args));
+      demand_scheduler_shptr_t demand_scheduler;
+      if(args.timer_wheel_)
+         demand_scheduler = disp;
+      return { std::move(disp), std::move(demand_scheduler) };
+   }
+   else if("generic" == dispatcher)
+      return { make_generic_device_dispatcher(env, args), {} };
+   else if("adv_thread_pool" == dispatcher) {
+      namespace disp = so_5::disp::adv_thread_pool;
+      return { disp::make_dispatcher(env, args.thread_pool_size_)
+            .binder(disp::bind_params_t{}), {} };
+   }
+   else {
+      // NOTE: events of one agent are handled one at a time
+      // by this dispatcher.
+      namespace disp = so_5::disp::thread_pool;
+      return { disp::make_dispatcher(env, args.thread_pool_size_)
+            .binder(disp::bind_params_t{}), {} };
+   }
+}
+
+// CPU time of the process (for all threads).
+std::chrono::duration<double> process_cpu_time() {
+   return std::chrono::duration<double>{
+         static_cast<double>(std::clock()) / CLOCKS_PER_SEC};
+}
+
+// The current resident set size of the process in KiB.
+std::uint64_t current_rss_kb() {
+#if defined(__linux__)
+   std::ifstream statm{"/proc/self/statm"};
+   std::uint64_t size{}, resident{};
+   if(statm >> size >> resident)
+      return resident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE)) / 1024u;
+#endif
+   return 0u;
+}
+
+run_result_t run_once(
+      const bench_args_t & bench_args,
+      const std::string & dispatcher,
+      unsigned threads,
+      unsigned devices) {
+   std::cerr << fmt::format("running {} with {} threads and {} devices...",
+         dispatcher, threads, devices) << std::endl;
+
+   args_t args = bench_args.workload_;
+   args.thread_pool_size_ = threads;
+   args.device_count_ = devices;
+   // Metrics are not needed, only delays are measured.
+   args.metrics_ = false;
+
+   // Delays are recorded without messages, so there is no dashboard.
+   const auto stats_collector =
+         std::make_shared<a_dashboard_t::stats_collector_t>();
+
+   run_result_t result{ dispatcher, threads, devices, {}, {}, {}, {}, {} };
+
+   so_5::wrapped_env_t sobj;
+   auto & env = sobj.environment();
+   env.introduce_coop([&](so_5::coop_t & coop) {
+         auto disp = make_dispatcher(env, dispatcher, args);
+         coop.make_agent_with_binder<a_device_manager_t>(
+               std::move(disp.binder_),
+               args,
+               env.create_mbox(),
+               stats_collector,
+               std::move(disp.demand_scheduler_));
+      });
+
+   std::this_thread::sleep_for(bench_args.warmup_);
+
+   // Delays for the warm-up period are dropped.
+   auto ops = std::make_unique<a_dashboard_t::slot_data_array_t>();
+   stats_collector->take(*ops);
+   for(auto & op : *ops)
+      op.reset();
+
+   const auto started_at = clock_type::now();
+   const auto cpu_started_at = process_cpu_time();
+   const auto allocations_before = g_heap_allocations.load();
+
+   std::this_thread::sleep_for(bench_args.duration_);
+
+   stats_collector->take(*ops);
+   result.wall_time_ = clock_type::now() - started_at;
+   result.cpu_time_ = process_cpu_time() - cpu_started_at;
+   result.heap_allocations_ = g_heap_allocations.load() - allocations_before;
+   result.rss_kb_ = current_rss_kb();
+   result.ops_ = *ops;
+
+   // All agents are deregistered and all threads are joined.
+   sobj.stop_then_join();
+
+   return result;
+}
+
+void write_op_json(
+      std::ostream & to,
+      const char * name,
+      const a_dashboard_t::time_slot_data_t & data) {
+   using namespace std::chrono;
+
+   const auto us = [](auto v) {
+      return duration_cast<duration<double, std::micro>>(v).count();
+   };
+
+   fmt::print(to, "        \"{}\": {{ \"count\": {}, \"avg_us\": {:.1f}",
+         name, data.total_events_, us(data.avg()));
+   for(const auto p : { 50.0, 90.0, 99.0, 99.9 })
+      fmt::print(to, ", \"p{}_us\": {:.1f}", p, us(data.percentile(p)));
+   fmt::print(to, ", \"max_us\": {:.1f} }}", us(data.max()));
+}
+
+void write_json(
+      std::ostream & to,
+      const bench_args_t & args,
+      const std::vector<run_result_t> & results) {
+   using namespace std::chrono;
+   using op_type_t = a_dashboard_t::op_type_t;
+
+   fmt::print(to, "{{\n  \"warmup_sec\": {},\n  \"duration_sec\": {},\n"
+         "  \"pooled_alloc\": {},\n  \"wait_strategy\": \"{}\",\n"
+         "  \"async_io\": {},\n  \"affinity\": {},\n  \"runs\": [\n",
+         args.warmup_.count(), args.duration_.count(),
+         args.workload_.pooled_alloc_, args.workload_.wait_strategy_,
+         args.workload_.async_io_, args.workload_.affinity_);
+
+   for(std::size_t i = 0u; i != results.size(); ++i) {
+      const auto & r = results[i];
+      const double seconds = duration_cast<duration<double>>(r.wall_time_).count();
+
+      std::uint64_t events = 0u;
+      for(const auto & op : r.ops_)
+         events += op.total_events_;
+
+      fmt::print(to, "    {{\n"
+            "      \"dispatcher\": \"{}\",\n"
+            "      \"threads\": {},\n"
+            "      \"devices\": {},\n"
+            "      \"wall_time_sec\": {:.3f},\n"
+            "      \"events\": {},\n"
+            "      \"throughput_per_sec\": {:.1f},\n"
+            "      \"cpu_time_sec\": {:.3f},\n"
+            "      \"cpu_utilization\": {:.3f},\n"
+            "      \"heap_allocations\": {},\n"
+            "      \"heap_allocations_per_event\": {:.2f},\n"
+            "      \"rss_kb\": {},\n"
+            "      \"ops\": {{\n",
+            r.dispatcher_, r.threads_, r.devices_,
+            seconds,
+            events,
+            static_cast<double>(events) / seconds,
+            r.cpu_time_.count(),
+            r.cpu_time_.count() / seconds,
+            r.heap_allocations_,
+            events ? static_cast<double>(r.heap_allocations_) / events : 0.0,
+            r.rss_kb_);
+
+      write_op_json(to, "init", r.ops_[a_dashboard_t::to_size_t(op_type_t::init)]);
+      to << ",\n";
+      write_op_json(to, "reinit", r.ops_[a_dashboard_t::to_size_t(op_type_t::reinit)]);
+      to << ",\n";
+      write_op_json(to, "io_op", r.ops_[a_dashboard_t::to_size_t(op_type_t::io_op)]);
+      to << "\n      }\n    }" << (i + 1u != results.size() ? ",\n" : "\n");
+   }
+
+   to << "  ]\n}" << std::endl;
+}
+
+void run_benchmark(const bench_args_t & args) {
+   // It has to be done before the creation of the first device.
+   pooled_allocation_enabled().store(args.workload_.pooled_alloc_);
+
+   std::vector<run_result_t> results;
+   for(const auto & dispatcher : args.dispatchers_)
+      for(const auto threads : args.thread_counts_)
+         for(const auto devices : args.device_counts_)
+            results.push_back(run_once(args, dispatcher, threads, devices));
+
+   if(args.output_file_.empty())
+      write_json(std::cout, args, results);
+   else {
+      std::ofstream file;
+      file.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+      file.open(args.output_file_);
+      write_json(file, args, results);
+   }
+}
+
+int main(int argc, char ** argv) {
+   try {
+      const auto r = parse_args(argc, argv);
+      if(auto a = std::get_if<bench_args_t>(&r))
+         run_benchmark(*a);
+
+      return 0;
+   }
+   catch(const std::exception & x) {
+      std::cerr << "Exception caught: " << x.what() << std::endl;
+   }
+
+   return 2;
+}
+
@@ -0,0 +1,11 @@
+require 'mxx_ru/cpp'
+
+MxxRu::Cpp::exe_target {
+
+  target 'disp_bench_app'
+
+  required_prj 'fmt_mxxru/prj.rb'
+  required_prj 'so_5/prj_s.rb'
+
+  cpp_source 'main.cpp'
+}
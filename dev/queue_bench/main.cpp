@@ -0,0 +1,222 @@
+// A simple benchmark for comparison of push/pop throughput of mchains
+// and lock-free queues used by tricky_dispatcher_t.
+//
+// Several producers push so_5::execution_demand_t objects into a queue,
+// several consumers pop them and count. Consumers sleep on an empty
+// queue exactly like workers of tricky_dispatcher_t do.
+
+#include <common/bounded_mpmc_queue.hpp>
+#include <common/event_count.hpp>
+
+#include <so_5/all.hpp>
+
+#include <clara/clara.hpp>
+
+#include <fmt/format.h>
+
+#include <iostream>
+#include <variant>
+
+struct bench_args_t {
+   static constexpr unsigned default_producers = 4u;
+   static constexpr unsigned default_consumers = 4u;
+   static constexpr unsigned default_demands = 1000000u;
+   static constexpr unsigned default_capacity = 65536u;
+
+   // The count of producer threads.
+   unsigned producers_{ default_producers };
+   // The count of consumer threads.
+   unsigned consumers_{ default_consumers };
+   // The count of demands to be sent by every producer.
+   unsigned demands_{ default_demands };
+   // The capacity of the lock-free queue.
+   unsigned capacity_{ default_capacity };
+};
+
+struct help_requested_t {};
+
+std::variant<help_requested_t, bench_args_t>
+parse_args(int argc, char ** argv) {
+   bench_args_t result;
+   bool help_requested = false;
+
+   using namespace clara;
+
+   auto cli = Opt(result.producers_, "count")["-p"]["--producers"]
+            (fmt::format("count of producer threads, default: {}",
+               result.producers_))
+      | Opt(result.consumers_, "count")["-c"]["--consumers"]
+            (fmt::format("count of consumer threads, default: {}",
+               result.consumers_))
+      | Opt(result.demands_, "count")["-n"]["--demands"]
+            (fmt::format("count of demands from every producer, default: {}",
+               result.demands_))
+      | Opt(result.capacity_, "capacity")["--lock-free-capacity"]
+            (fmt::format("capacity of a lock-free queue, default: {}",
+               result.capacity_))
+      | Help(help_requested);
+
+   auto parse_result = cli.parse(Args(argc, argv));
+   if(!parse_result)
+      throw std::runtime_error("Invalid command line: "
+            + parse_result.errorMessage());
+
+   if(help_requested) {
+      std::cout << cli << std::endl;
+      return help_requested_t{};
+   }
+
+   if(!result.producers_ || !result.consumers_ || !result.demands_)
+      throw std::invalid_argument(
+            "count of producers, consumers and demands can't be zero");
+
+   return result;
+}
+
+using clock_type = std::chrono::steady_clock;
+
+// Runs producers and consumers and returns the time spent.
+// The close_action is called when all producers finished their work.
+template<typename Producer, typename Consumer, typename Close_Action>
+clock_type::duration run_threads(
+      const bench_args_t & args,
+      Producer producer,
+      Consumer consumer,
+      Close_Action close_action) {
+   std::vector<std::thread> consumers;
+   std::vector<std::thread> producers;
+
+   const auto started_at = clock_type::now();
+
+   for(auto i = 0u; i < args.consumers_; ++i)
+      consumers.emplace_back(consumer);
+   for(auto i = 0u; i < args.producers_; ++i)
+      producers.emplace_back(producer);
+
+   for(auto & t : producers)
+      t.join();
+   close_action();
+   for(auto & t : consumers)
+      t.join();
+
+   return clock_type::now() - started_at;
+}
+
+clock_type::duration bench_mchain(
+      so_5::environment_t & env,
+      const bench_args_t & args,
+      std::atomic<std::uint64_t> & handled) {
+   auto ch = so_5::create_mchain(env);
+
+   return run_threads(args,
+         [&] {
+            for(auto i = 0u; i < args.demands_; ++i)
+               so_5::send<so_5::execution_demand_t>(ch,
+                     so_5::execution_demand_t{});
+         },
+         [&] {
+            so_5::receive(so_5::from(ch).handle_all(),
+                  [&](so_5::execution_demand_t) {
+                     handled.fetch_add(1u, std::memory_order_relaxed);
+                  });
+         },
+         [&] {
+            so_5::close_retain_content(so_5::terminate_if_throws, ch);
+         });
+}
+
+clock_type::duration bench_lock_free(
+      const bench_args_t & args,
+      std::atomic<std::uint64_t> & handled) {
+   bounded_mpmc_queue_t<so_5::execution_demand_t> queue{args.capacity_};
+   event_count_t waiters;
+   std::atomic<bool> closed{false};
+
+   return run_threads(args,
+         [&] {
+            for(auto i = 0u; i < args.demands_; ++i) {
+               so_5::execution_demand_t d;
+               while(!queue.try_push(std::move(d)))
+                  std::this_thread::yield();
+               waiters.notify_one();
+            }
+         },
+         [&] {
+            so_5::execution_demand_t d;
+            for(;;) {
+               if(queue.try_pop(d)) {
+                  handled.fetch_add(1u, std::memory_order_relaxed);
+                  continue;
+               }
+
+               const auto ticket = waiters.prepare_wait();
+               if(queue.try_pop(d)) {
+                  waiters.cancel_wait();
+                  handled.fetch_add(1u, std::memory_order_relaxed);
+               }
+               else if(closed.load(std::memory_order_acquire)) {
+                  waiters.cancel_wait();
+                  break;
+               }
+               else
+                  waiters.wait(ticket);
+            }
+         },
+         [&] {
+            closed.store(true, std::memory_order_release);
+            waiters.notify_all();
+         });
+}
+
+void show_result(
+      const char * name,
+      const bench_args_t & args,
+      clock_type::duration time,
+      std::uint64_t handled) {
+   using namespace std::chrono;
+
+   const double expected = static_cast<double>(args.producers_) * args.demands_;
+   const double seconds = duration_cast<duration<double>>(time).count();
+
+   fmt::print("{:9}: {:.0f} demands in {}ms, throughput: {:.0f} demands/sec{}\n",
+         name,
+         expected,
+         duration_cast<milliseconds>(time).count(),
+         expected / seconds,
+         static_cast<double>(handled) != expected ? " (LOST DEMANDS!)" : "");
+}
+
+void run_benchmark(const bench_args_t & args) {
+   fmt::print("producers: {}, consumers: {}, demands per producer: {}, "
+         "lock-free capacity: {}\n",
+         args.producers_, args.consumers_, args.demands_, args.capacity_);
+
+   so_5::wrapped_env_t sobj;
+
+   {
+      std::atomic<std::uint64_t> handled{0u};
+      const auto time = bench_mchain(sobj.environment(), args, handled);
+      show_result("mchain", args, time, handled.load());
+   }
+   {
+      std::atomic<std::uint64_t> handled{0u};
+      const auto time = bench_lock_free(args, handled);
+      show_result("lock_free", args, time, handled.load());
+   }
+}
+
+int main(int argc, char ** argv) {
+   try {
+      const auto r = parse_args(argc, argv);
+      if(auto a = std::get_if<bench_args_t>(&r))
+         run_benchmark(*a);
+
+      return 0;
+   }
+   catch(const std::exception & x) {
+      std::cerr << "Exception caught: " << x.what() << std::endl;
+   }
+
+   return 2;
+}
+
@@ -0,0 +1,180 @@
+// A stress test for the shutdown of tricky_dispatcher_t with lock-free
+// and work-stealing queues.
+//
+// Every cycle starts an environment with an agent that sends a short
+// burst of messages to itself and stops the environment after handling
+// of the last one. So queues are closed exactly when worker threads
+// become idle and go to sleep. A worker that misses the closing sleeps
+// forever and the shutdown hangs, so every cycle has a deadline.
+//
+// Returns 0 if all cycles are finished in time, 1 if the shutdown hangs.
+
+#include <common/tricky_dispatcher.hpp>
+
+#include <so_5/all.hpp>
+
+#include <clara/clara.hpp>
+
+#include <fmt/format.h>
+
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <variant>
+
+struct test_args_t {
+   static constexpr unsigned default_cycles = 200u;
+   static constexpr unsigned default_messages = 16u;
+   static constexpr std::chrono::seconds default_cycle_timeout{ 10 };
+
+   // The count of cycles for every combination of params.
+   unsigned cycles_{ default_cycles };
+   // The count of messages handled in every cycle.
+   unsigned messages_{ default_messages };
+   // The max time of one cycle.
+   std::chrono::seconds cycle_timeout_{ default_cycle_timeout };
+};
+
+struct help_requested_t {};
+
+std::variant<help_requested_t, test_args_t>
+parse_args(int argc, char ** argv) {
+   test_args_t result;
+   auto cycle_timeout = result.cycle_timeout_.count();
+   bool help_requested = false;
+
+   using namespace clara;
+
+   auto cli = Opt(result.cycles_, "count")["-c"]["--cycles"]
+            (fmt::format("count of cycles for every combination of params, "
+               "default: {}", result.cycles_))
+      | Opt(result.messages_, "count")["-m"]["--messages"]
+            (fmt::format("count of messages in every cycle, default: {}",
+               result.messages_))
+      | Opt(cycle_timeout, "sec")["--cycle-timeout"]
+            (fmt::format("max time of one cycle (seconds), default: {}",
+               cycle_timeout))
+      | Help(help_requested);
+
+   auto parse_result = cli.parse(Args(argc, argv));
+   if(!parse_result)
+      throw std::runtime_error("Invalid command line: "
+            + parse_result.errorMessage());
+
+   if(help_requested) {
+      std::cout << cli << std::endl;
+      return help_requested_t{};
+   }
+
+   if(!result.messages_)
+      throw std::invalid_argument("minimal allowed value for messages is 1");
+   if(cycle_timeout < 1)
+      throw std::invalid_argument("minimal allowed value for cycle_timeout is 1");
+   result.cycle_timeout_ = std::chrono::seconds{cycle_timeout};
+
+   return result;
+}
+
+// An agent that handles a burst of messages and stops the environment.
+class a_burst_t final : public so_5::agent_t {
+   struct tick_t final : public so_5::signal_t {};
+
+public:
+   a_burst_t(context_t ctx, unsigned messages)
+      :  so_5::agent_t(std::move(ctx))
+      ,  remaining_(messages) {
+      so_subscribe_self().event(&a_burst_t::on_tick, so_5::thread_safe);
+   }
+
+   void so_evt_start() override {
+      for(auto i = remaining_.load(); i; --i)
+         so_5::send<tick_t>(*this);
+   }
+
+private:
+   std::atomic<unsigned> remaining_;
+
+   void on_tick(mhood_t<tick_t>) {
+      if(1u == remaining_.fetch_sub(1u))
+         so_environment().stop();
+   }
+};
+
+// Runs one cycle, terminates the process if it isn't finished in time.
+void run_cycle(
+      const test_args_t & args,
+      const tricky_dispatcher_t::disp_params_t & params,
+      const std::string & name,
+      unsigned cycle) {
+   std::mutex lock;
+   std::condition_variable finished_cv;
+   bool finished = false;
+
+   std::thread watchdog{[&] {
+         std::unique_lock<std::mutex> l{lock};
+         if(!finished_cv.wait_for(l, args.cycle_timeout_,
+               [&]{ return finished; })) {
+            std::cerr << "shutdown hangs: " << name << ", cycle #" << cycle
+                  << std::endl;
+            std::_Exit(1);
+         }
+      }};
+
+   so_5::launch([&](so_5::environment_t & env) {
+         env.introduce_coop([&](so_5::coop_t & coop) {
+               coop.make_agent_with_binder<a_burst_t>(
+                     tricky_dispatcher_t::make(env, params),
+                     args.messages_);
+            });
+      });
+
+   {
+      std::lock_guard<std::mutex> l{lock};
+      finished = true;
+   }
+   finished_cv.notify_one();
+   watchdog.join();
+}
+
+void run_test(const test_args_t & args) {
+   using queue_backend_t = tricky_dispatcher_t::queue_backend_t;
+   using wait_strategy_t = tricky_dispatcher_t::wait_strategy_t;
+
+   const std::pair<queue_backend_t, const char *> backends[] = {
+         { queue_backend_t::lock_free, "lock_free" },
+         { queue_backend_t::work_stealing, "work_stealing" } };
+   const std::pair<wait_strategy_t, const char *> strategies[] = {
+         { wait_strategy_t::blocking, "blocking" },
+         { wait_strategy_t::spin_then_park, "spin_then_park" } };
+
+   const auto pool_size = std::max(4u, std::thread::hardware_concurrency());
+   for(const auto & [backend, backend_name] : backends)
+      for(const auto & [strategy, strategy_name] : strategies) {
+         tricky_dispatcher_t::disp_params_t params{pool_size};
+         params.queue_backend_ = backend;
+         params.wait_strategy_ = strategy;
+
+         const auto name = fmt::format("{}/{}", backend_name, strategy_name);
+         for(unsigned cycle = 0u; cycle != args.cycles_; ++cycle)
+            run_cycle(args, params, name, cycle);
+         fmt::print("{}: {} cycles OK\n", name, args.cycles_);
+      }
+}
+
+int main(int argc, char ** argv) {
+   try {
+      const auto r = parse_args(argc, argv);
+      if(auto a = std::get_if<test_args_t>(&r))
+         run_test(*a);
+
+      return 0;
+   }
+   catch(const std::exception & x) {
+      std::cerr << "Exception caught: " << x.what() << std::endl;
+   }
+
+   return 2;
+}
+
@@ -1,301 +1,352 @@
 #include <common/args.hpp>
 #include <common/args_parser.hpp>
 
-#include <common/a_device_manager.hpp>
+#include <common/generic_device_dispatcher.hpp>
+#include <common/metrics_exporter.hpp>
+#include <common/tricky_dispatcher.hpp>
 
 #include <fmt/ostream.h>
 
-// A class of dispatcher intended to process events of a_device_manager_t agent.
-class tricky_dispatcher_t final
-      : public so_5::disp_binder_t
-      , public so_5::event_queue_t {
-
-   // A kind of std::latch from C++20, but without a fixed number of participant.
-   // It's something similar to Run-Down Protection from Windows's kernel:
-   //
-   // https://learn.microsoft.com/en-us/windows-hardware/drivers/kernel/run-down-protection
-   class rundown_latch_t {
-      std::mutex lock_;
-      std::condition_variable wakeup_cv_;
-
-      bool closed_{false};
-      unsigned attenders_{};
-
-   public:
-      rundown_latch_t() = default;
-
-      void acquire() {
-         std::lock_guard<std::mutex> lock{lock_};
-         if(closed_)
-            throw std::runtime_error{"rundown_latch is closed"};
-         ++attenders_;
-      }
-
-      void release() noexcept {
-         std::lock_guard<std::mutex> lock{lock_};
-         --attenders_;
-         if(!attenders_)
-            wakeup_cv_.notify_all();
-      }
-
-      void wait_then_close() {
-         std::unique_lock<std::mutex> lock{lock_};
-         if(attenders_)
-         {
-            wakeup_cv_.wait(lock, [this]{ return 0u == attenders_; });
-            closed_ = true;
-         }
-      }
-   };
-
-   // A kind of std::lock_guard, but for rundown_latch_t.
-   class auto_acquire_release_rundown_latch_t {
-      rundown_latch_t & room_;
-
-   public:
-      auto_acquire_release_rundown_latch_t(rundown_latch_t & room) : room_{room} {
-         room_.acquire();
-      }
-      ~auto_acquire_release_rundown_latch_t() {
-         room_.release();
-      }
-   };
-
-   // Type of container for worker threads.
-   using thread_pool_t = std::vector<std::thread>;
-
-   // Channels to be used as event-queues.
-   so_5::mchain_t start_finish_ch_;
-   so_5::mchain_t init_reinit_ch_;
-   so_5::mchain_t other_demands_ch_;
-
-   // The pool of worker threads for that dispatcher.
-   thread_pool_t work_threads_;
-
-   // Synchronization objects required for thread management.
-   //
-   // This one is for starting worker threads.
-   // The leader thread should wait while all workers are created.
-   rundown_latch_t launch_room_;
-   // This one is for handling evt_start,
-   // All workers (except the leader) have to wait while evt_start completed.
-   rundown_latch_t start_room_;
-   // This on is for handling evt_finish.
-   // The leader thread has to wait while all workers complete their work.
-   rundown_latch_t finish_room_;
-
-   static const std::type_index init_device_type;
-   static const std::type_index reinit_device_type;
-
-   // Helper method for calculation of sizes of sub-pools.
-   static auto calculate_pools_sizes(unsigned pool_size) {
-      if( 2u == pool_size)
-         // Only two thread in the pool. Use one thread for each sub-pool.
-         return std::make_tuple(1u, 1u);
-      else {
-         // Threads of the first type will be 3/4 of the total count of threads.
-         const auto first_pool_size = (pool_size/4u)*3u;
-         return std::make_tuple(first_pool_size, pool_size - first_pool_size);
-      }
-   }
-
-   // Helper method for shutdown and join all threads.
-   void shutdown_work_threads() noexcept {
-      // All channels should be closed first.
-      so_5::close_drop_content(so_5::terminate_if_throws, start_finish_ch_);
-      so_5::close_drop_content(so_5::terminate_if_throws, init_reinit_ch_);
-      so_5::close_drop_content(so_5::terminate_if_throws, other_demands_ch_);
+#include <fstream>
 
-      // Now all threads can be joined.
-      for(auto & t : work_threads_)
-         t.join();
+// An agent that periodically shows metrics of the dispatcher
+// and publishes them to the exporter.
+class a_disp_metrics_reporter_t final : public so_5::agent_t {
+   struct show_metrics_t final : public so_5::signal_t {};
 
-      // The pool should be dropped.
-      work_threads_.clear();
-   }
-
-   // Launch all threads.
-   // If there is an error then all previously started threads
-   // should be stopped.
-   void launch_work_threads(
-         unsigned first_type_threads_count,
-         unsigned second_type_threads_count) {
-      work_threads_.reserve(first_type_threads_count + second_type_threads_count);
-      try {
-         // The leader has to be suspended until all workers will be created.
-         auto_acquire_release_rundown_latch_t launch_room_changer{launch_room_};
-
-         // Start the leader thread first.
-         work_threads_.emplace_back([this]{ leader_thread_body(); });
-
-         // Now we can launch all remaining workers.
-         for(auto i = 1u; i < first_type_threads_count; ++i)
-            work_threads_.emplace_back([this]{ first_type_thread_body(); });
-
-         for(auto i = 0u; i < second_type_threads_count; ++i)
-            work_threads_.emplace_back([this]{ second_type_thread_body(); });
-      }
-      catch(...) {
-         shutdown_work_threads();
-         throw; // Rethrow an exception to be handled somewhere upper.
-      }
+public:
+   a_disp_metrics_reporter_t(
+         context_t ctx,
+         std::shared_ptr<const tricky_dispatcher_t> disp,
+         // Should metrics be printed?
+         bool print,
+         // If it's not null then metrics are published to it.
+         metrics_exporter_shptr_t exporter,
+         std::chrono::milliseconds period)
+      :  so_5::agent_t(std::move(ctx))
+      ,  disp_(std::move(disp))
+      ,  print_(print)
+      ,  exporter_(std::move(exporter))
+      ,  period_(period) {
+      so_subscribe_self().event(&a_disp_metrics_reporter_t::on_show_metrics);
    }
 
-   // A handler for so_5::execution_demand_t.
-   static void exec_demand_handler(so_5::execution_demand_t d) {
-      d.call_handler(so_5::null_current_thread_id());
+   void so_evt_start() override {
+      timer_ = so_5::send_periodic<show_metrics_t>(*this, period_, period_);
    }
 
-   // The body of the leader thread.
-   void leader_thread_body() {
-      // We have to wait while all workers are created.
-      // NOTE: not all of them can start their work actually, but all
-      // std::thread objects should be created.
-      launch_room_.wait_then_close();
-
-      {
-         // We have to block all other threads until evt_start will be processed.
-         auto_acquire_release_rundown_latch_t start_room_changer{start_room_};
-         // Process evt_start.
-         so_5::receive(so_5::from(start_finish_ch_).handle_n(1),
-               exec_demand_handler);
-      }
+private:
+   const std::shared_ptr<const tricky_dispatcher_t> disp_;
+   const bool print_;
+   const metrics_exporter_shptr_t exporter_;
+   const std::chrono::milliseconds period_;
+   so_5::timer_id_t timer_;
 
-      // Now the leader can play the role of the first thread type.
-      first_type_thread_body();
+   static auto us(std::uint64_t ns) { return ns / 1000u; }
 
-      // All worker should finish their work before processing of evt_finish.
-      finish_room_.wait_then_close();
+   static std::string cpus_to_string(const cpu_list_t & cpus) {
+      if(cpus.empty())
+         return "no";
 
-      // Process evt_finish.
-      so_5::receive(so_5::from(start_finish_ch_).handle_n(1),
-            exec_demand_handler);
+      std::string result;
+      for(const auto cpu : cpus)
+         result += (result.empty() ? "" : ",") + std::to_string(cpu);
+      return result;
    }
 
-   // The body for a thread of the first type.
-   void first_type_thread_body() {
-      // Processing of evt_finish has to be enabled at the end.
-      auto_acquire_release_rundown_latch_t finish_room_changer{finish_room_};
-
-      // Wait while evt_start is processed.
-      start_room_.wait_then_close();
-
-      // Run until all channels will be closed.
-      so_5::select(so_5::from_all().handle_all(),
-            receive_case(init_reinit_ch_, exec_demand_handler),
-            receive_case(other_demands_ch_, exec_demand_handler));
+   template<typename D>
+   static auto ms(D v) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(v).count();
    }
 
-   // The body for a thread of the second type.
-   void second_type_thread_body() {
-      // Processing of evt_finish has to be enabled at the end.
-      auto_acquire_release_rundown_latch_t finish_room_changer{finish_room_};
-
-      // Wait while evt_start is processed.
-      start_room_.wait_then_close();
-
-      // Run until all channels will be closed.
-      so_5::select(so_5::from_all().handle_all(),
-            receive_case(other_demands_ch_, exec_demand_handler));
+   void on_show_metrics(mhood_t<show_metrics_t>) {
+      const auto m = disp_->metrics_snapshot();
+      const auto classes = disp_->message_type_classes();
+      if(exporter_)
+         exporter_->publish("dispatcher", to_prometheus_text(m, classes));
+      if(print_)
+         print_metrics(m, classes);
    }
 
-   // Implementation of the methods inherited from disp_binder.
-   void preallocate_resources(so_5::agent_t & /*agent*/) override {
-      // Nothing to do.
-   }
-
-   void undo_preallocation(so_5::agent_t & /*agent*/) noexcept override {
-      // Nothing to do.
-   }
+   static std::string to_prometheus_text(
+         const tricky_dispatcher_t::metrics_snapshot_t & m,
+         const std::vector<service_time_classifier_t::type_class_t> & classes) {
+      prometheus_text_t t;
+      const auto per_lane = [&](
+            const char * name, const char * type, const char * help,
+            auto value) {
+         t.family(name, type, help);
+         for(const auto & l : m.lanes_)
+            t.sample(name, {{"lane", l.name_}}, value(l));
+      };
+      per_lane("tricky_lane_enqueued_total", "counter",
+            "Demands pushed to the lane",
+            [](const auto & l) { return l.enqueued_; });
+      per_lane("tricky_lane_dequeued_total", "counter",
+            "Demands extracted from the lane",
+            [](const auto & l) { return l.dequeued_; });
+      per_lane("tricky_lane_depth", "gauge",
+            "Demands in the lane",
+            [](const auto & l) { return l.depth_; });
+      per_lane("tricky_lane_max_depth", "gauge",
+            "Max count of demands in the lane",
+            [](const auto & l) { return l.max_depth_; });
+      per_lane("tricky_lane_dropped_total", "counter",
+            "Demands dropped because of the overflow of the lane",
+            [](const auto & l) { return l.dropped_; });
+      per_lane("tricky_lane_rejected_total", "counter",
+            "Demands rejected because of the overflow of the lane",
+            [](const auto & l) { return l.rejected_; });
+
+      t.family("tricky_lane_wait_seconds", "summary",
+            "Time from the push of a demand to the start of its handling");
+      for(const auto & l : m.lanes_)
+         t.summary_samples("tricky_lane_wait_seconds", "lane", l.name_,
+               l.wait_ns_, 1e-9);
+      t.family("tricky_lane_service_seconds", "summary",
+            "Time of handling of a demand");
+      for(const auto & l : m.lanes_)
+         t.summary_samples("tricky_lane_service_seconds", "lane", l.name_,
+               l.service_ns_, 1e-9);
+
+      const auto seconds = [](auto d) {
+         return std::chrono::duration<double>(d).count();
+      };
+      per_lane("tricky_lane_served_seconds_total", "counter",
+            "Time of handling of demands of the lane",
+            [&](const auto & l) { return seconds(l.served_); });
+      t.family("tricky_group_lane_share", "gauge",
+            "Share of the lane in the time of handling of demands by threads "
+            "of the group");
+      for(const auto & g : m.groups_)
+         for(std::size_t pos = 0u; pos != g.lanes_.size(); ++pos)
+            t.sample("tricky_group_lane_share",
+                  {{"group", g.group_}, {"lane", m.lanes_[g.lanes_[pos]].name_}},
+                  g.shares_[pos]);
+      const auto per_worker = [&](
+            const char * name, const char * type, const char * help,
+            auto value) {
+         t.family(name, type, help);
+         for(const auto & w : m.workers_)
+            t.sample(name,
+                  {{"thread", std::to_string(w.index_)}, {"group", w.group_}},
+                  value(w));
+      };
+      per_worker("tricky_worker_handled_total", "counter",
+            "Demands handled by the thread",
+            [](const auto & w) { return w.handled_; });
+      per_worker("tricky_worker_busy_seconds_total", "counter",
+            "Time spent by the thread in event handlers",
+            [&](const auto & w) { return seconds(w.busy_); });
+      per_worker("tricky_worker_utilization", "gauge",
+            "Share of time spent by the thread in event handlers since the start",
+            [&](const auto & w) {
+               return m.uptime_.count() > 0 ?
+                     seconds(w.busy_) / seconds(m.uptime_) : 0.0;
+            });
+      per_worker("tricky_worker_active", "gauge",
+            "Does the thread run (0 for retired threads of the elastic pool)",
+            [](const auto & w) { return w.active_ ? 1 : 0; });
+
+      if(!classes.empty()) {
+         t.family("tricky_msg_type_heavy", "gauge",
+               "Is the message type routed to the heavy lane");
+         for(const auto & c : classes)
+            t.sample("tricky_msg_type_heavy",
+                  {{"type", chrome_trace_writer_t::type_name(c.type_.name())}},
+                  c.heavy_ ? 1 : 0);
+         t.family("tricky_msg_type_service_seconds", "gauge",
+               "Average time of handling of a message of the type");
+         for(const auto & c : classes)
+            t.sample("tricky_msg_type_service_seconds",
+                  {{"type", chrome_trace_writer_t::type_name(c.type_.name())}},
+                  seconds(c.service_));
+      }
 
-   void bind(so_5::agent_t & agent) noexcept override {
-      agent.so_bind_to_dispatcher(*this);
-   }
+      t.family("tricky_threads_added_total", "counter",
+            "Threads added by the elastic pool");
+      t.sample("tricky_threads_added_total", {}, m.threads_added_);
+      t.family("tricky_threads_retired_total", "counter",
+            "Threads retired by the elastic pool");
+      t.sample("tricky_threads_retired_total", {}, m.threads_retired_);
 
-   void unbind(so_5::agent_t & /*agent*/) noexcept override {
-      // Nothing to do.
+      return t.release();
    }
 
-   // Implementation of the methods inherited from event_queue.
-   void push(so_5::execution_demand_t demand) override {
-      if(init_device_type == demand.m_msg_type ||
-            reinit_device_type == demand.m_msg_type) {
-         // That demand should go to a separate queue.
-         so_5::send<so_5::execution_demand_t>(init_reinit_ch_, std::move(demand));
+   void print_metrics(
+         const tricky_dispatcher_t::metrics_snapshot_t & m,
+         const std::vector<service_time_classifier_t::type_class_t> & classes) {
+      fmt::print("### dispatcher metrics, uptime {}ms ###\n", ms(m.uptime_));
+      fmt::print("threads: active={} added={} retired={}\n",
+            std::count_if(m.workers_.begin(), m.workers_.end(),
+                  [](const auto & w) { return w.active_; }),
+            m.threads_added_, m.threads_retired_);
+
+      std::uint64_t affinity_hits = 0u;
+      std::uint64_t affinity_misses = 0u;
+      for(const auto & w : m.workers_) {
+         affinity_hits += w.affinity_hits_;
+         affinity_misses += w.affinity_misses_;
       }
-      else {
-         // That demand should go to the common queue.
-         so_5::send<so_5::execution_demand_t>(other_demands_ch_, std::move(demand));
+      if(const auto total = affinity_hits + affinity_misses)
+         fmt::print("affinity: hits={} misses={} hit_rate={:.1f}%\n",
+               affinity_hits, affinity_misses,
+               100.0 * static_cast<double>(affinity_hits) /
+                     static_cast<double>(total));
+      for(const auto & l : m.lanes_)
+         fmt::print("lane {:12}: enq={} deq={} depth={} (max={}) | "
+               "wait p50={}us p99={}us max={}us | "
+               "service p50={}us p99={}us max={}us\n",
+               l.name_, l.enqueued_, l.dequeued_, l.depth_, l.max_depth_,
+               us(l.wait_ns_.percentile(50.0)),
+               us(l.wait_ns_.percentile(99.0)),
+               us(l.wait_ns_.max()),
+               us(l.service_ns_.percentile(50.0)),
+               us(l.service_ns_.percentile(99.0)),
+               us(l.service_ns_.max()));
+      for(const auto & l : m.lanes_)
+         if(l.capacity_)
+            fmt::print("lane {:12}: capacity={} dropped={} rejected={}\n",
+                  l.name_, l.capacity_, l.dropped_, l.rejected_);
+      for(const auto & g : m.groups_) {
+         std::string shares;
+         for(std::size_t pos = 0u; pos != g.lanes_.size(); ++pos)
+            shares += fmt::format(" {}={:.1f}% (min {:.1f}%)",
+                  m.lanes_[g.lanes_[pos]].name_,
+                  100.0 * g.shares_[pos], 100.0 * g.min_shares_[pos]);
+         fmt::print("shares of group {}:{}\n", g.group_, shares);
       }
+      for(const auto & c : classes)
+         fmt::print("type {}: {} avg={}us measurements={} reclassified={}\n",
+               chrome_trace_writer_t::type_name(c.type_.name()),
+               c.heavy_ ? "heavy" : "light",
+               std::chrono::duration_cast<std::chrono::microseconds>(
+                     c.service_).count(),
+               c.measurements_, c.reclassifications_);
+      for(const auto & w : m.workers_)
+         fmt::print("thread #{:<3} ({}{}): handled={} busy={}ms idle={}ms | "
+               "cpu={} node={} migrations={} pinned={} | "
+               "wakeups: spin={} yield={} park={} spin_budget={}us\n",
+               w.index_, w.group_, w.active_ ? "" : ", retired",
+               w.handled_, ms(w.busy_), ms(w.idle_),
+               w.last_cpu_, w.last_numa_node_, w.cpu_migrations_,
+               cpus_to_string(w.pinned_to_),
+               w.wait_.spin_hits_, w.wait_.yield_hits_, w.wait_.parks_,
+               std::chrono::duration_cast<std::chrono::microseconds>(
+                     w.wait_.budget_).count());
+      fmt::print("\n");
    }
+};
 
-   void push_evt_start(so_5::execution_demand_t demand) override {
-      so_5::send<so_5::execution_demand_t>(start_finish_ch_, std::move(demand));
-   }
+// An agent that writes the trace of the dispatcher to the file once,
+// after the specified time since the start.
+class a_trace_writer_t final : public so_5::agent_t {
+   struct write_trace_t final : public so_5::signal_t {};
 
-   // NOTE: don't care about exception, if the demand can't be stored
-   // into the queue the application has to be aborted anyway.
-   void push_evt_finish(so_5::execution_demand_t demand) noexcept override {
-      // Chains for "ordinary" messages has to be closed.
-      so_5::close_retain_content(so_5::terminate_if_throws, init_reinit_ch_);
-      so_5::close_retain_content(so_5::terminate_if_throws, other_demands_ch_);
+public:
+   a_trace_writer_t(
+         context_t ctx,
+         std::shared_ptr<const tricky_dispatcher_t> disp,
+         std::string file_name,
+         std::chrono::seconds delay)
+      :  so_5::agent_t(std::move(ctx))
+      ,  disp_(std::move(disp))
+      ,  file_name_(std::move(file_name))
+      ,  delay_(delay) {
+      so_subscribe_self().event(&a_trace_writer_t::on_write_trace);
+   }
 
-      // Now we can store the evt_finish demand in the special chain.
-      so_5::send<so_5::execution_demand_t>(start_finish_ch_, std::move(demand));
+   void so_evt_start() override {
+      so_5::send_delayed<write_trace_t>(*this, delay_);
    }
 
-public:
-   // The constructor that starts all worker threads.
-   tricky_dispatcher_t(
-         // SObjectizer Environment to work in.
-         so_5::environment_t & env,
-         // The size of the thread pool.
-         unsigned pool_size)
-         :  start_finish_ch_{
-               so_5::create_mchain(env,
-                     2u, // Just evt_start and evt_finish.
-                     so_5::mchain_props::memory_usage_t::preallocated,
-                     so_5::mchain_props::overflow_reaction_t::abort_app)
-            }
-         ,  init_reinit_ch_{so_5::create_mchain(env)}
-         ,  other_demands_ch_{so_5::create_mchain(env)}
-   {
-      const auto [first_type_count, second_type_count] =
-            calculate_pools_sizes(pool_size);
+private:
+   const std::shared_ptr<const tricky_dispatcher_t> disp_;
+   const std::string file_name_;
+   const std::chrono::seconds delay_;
+
+   void on_write_trace(mhood_t<write_trace_t>) {
+      // A failure of tracing mustn't stop the example.
+      std::ofstream to{file_name_, std::ios::out | std::ios::trunc};
+      if(!to) {
+         std::cerr << "unable to open file for trace: " << file_name_
+               << std::endl;
+         return;
+      }
 
-      launch_work_threads(first_type_count, second_type_count);
-   }
-   ~tricky_dispatcher_t() noexcept override {
-      // All worker threads should be stopped.
-      shutdown_work_threads();
-   }
+      const auto started_at = std::chrono::steady_clock::now();
+      disp_->write_trace(to);
+      to.flush();
+      if(!to) {
+         std::cerr << "unable to write trace to: " << file_name_ << std::endl;
+         return;
+      }
 
-   // A factory for the creation of the dispatcher.
-   [[nodiscard]]
-   static so_5::disp_binder_shptr_t make(
-         so_5::environment_t & env, unsigned pool_size) {
-      return std::make_shared<tricky_dispatcher_t>(env, pool_size);
+      fmt::print("*** trace is written to {} in {}ms ***\n", file_name_,
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - started_at).count());
    }
 };
 
-const std::type_index tricky_dispatcher_t::init_device_type =
-      typeid(a_device_manager_t::init_device_t);
-const std::type_index tricky_dispatcher_t::reinit_device_type =
-      typeid(so_5::mutable_msg<a_device_manager_t::reinit_device_t>);
-
 void run_example(const args_t & args ) {
    print_args(args);
 
+   // The generic dispatcher has no runtime features of tricky dispatcher.
+   if(args.generic_dispatcher_ &&
+         (args.metrics_ || args.trace_capacity_ || args.timer_wheel_))
+      throw std::invalid_argument("--metrics, --trace-capacity and "
+            "--timer-wheel can't be used with --generic-dispatcher");
+
+   // It has to be done before the creation of the first device.
+   pooled_allocation_enabled().store(args.pooled_alloc_);
+
+   // An error of listening is reported before the start of SObjectizer.
+   const auto exporter = make_metrics_exporter(args);
+
    so_5::launch([&](so_5::environment_t & env) {
          env.introduce_coop([&](so_5::coop_t & coop) {
+            a_dashboard_t::stats_collector_shptr_t stats_collector;
+            if(args.thread_local_stats_)
+               stats_collector = std::make_shared<
+                     a_dashboard_t::stats_collector_t>();
+
             const auto dashboard_mbox =
-                  coop.make_agent<a_dashboard_t>()->so_direct_mbox();
+                  coop.make_agent<a_dashboard_t>(
+                        stats_collector, make_dashboard_params(args, exporter))
+                        ->so_direct_mbox();
+
+            if(args.generic_dispatcher_) {
+               // Lanes and the split of the pool are the same as for
+               // tricky dispatcher with lock-free queues.
+               coop.make_agent_with_binder<a_device_manager_t>(
+                     make_generic_device_dispatcher(env, args),
+                     args,
+                     dashboard_mbox,
+                     std::move(stats_collector));
+               return;
+            }
+
+            auto disp = std::make_shared<tricky_dispatcher_t>(
+                  env, make_disp_params(args));
+            if(args.metrics_ || exporter)
+               coop.make_agent<a_disp_metrics_reporter_t>(
+                     disp, args.metrics_, exporter, args.stats_interval_);
+            if(args.trace_capacity_)
+               coop.make_agent<a_trace_writer_t>(
+                     disp, args.trace_file_, args.trace_after_);
+
+            // IO-ops can be scheduled via the timer of the dispatcher.
+            demand_scheduler_shptr_t demand_scheduler;
+            if(args.timer_wheel_)
+               demand_scheduler = disp;
 
             // Run the device manager of an instance of our tricky dispatcher.
             coop.make_agent_with_binder<a_device_manager_t>(
-                  tricky_dispatcher_t::make(env, args.thread_pool_size_),
+                  std::move(disp),
                   args,
-                  dashboard_mbox);
+                  dashboard_mbox,
+                  std::move(stats_collector),
+                  std::move(demand_scheduler));
          });
       });
 }